@@ -0,0 +1,137 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Sums `float` payloads of many `MakeRefCounted` records, whose arrays have
+// the default alignment of `float`, or are aligned and padded to 64 bytes.
+//
+// The default case loads vectors unaligned and needs a scalar loop for the
+// remainder of each array, the aligned one processes whole aligned vectors
+// only. Compile with `-march=native` to let the compiler use wider vectors
+// than SSE2.
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+// The total number of floats of all records, 64 KiB, so that the sums are
+// bound by computation and not by memory bandwidth.
+constexpr size_t kFloats = 16384;
+// The number of floats in 64 bytes.
+constexpr size_t kLanes = 16;
+
+struct Header {
+  explicit Header(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+struct Record {
+  const float* array;
+  size_t length;
+};
+
+// A vector of 4 floats, which every x86-64 target supports natively. Four of
+// them cover `kLanes`, and the compiler fuses them if the target has wider
+// registers.
+typedef float Vector __attribute__((vector_size(4 * sizeof(float))));
+
+float Total(Vector sum) { return sum[0] + sum[1] + sum[2] + sum[3]; }
+
+Vector LoadUnaligned(const float* array) {
+  Vector v;
+  std::memcpy(&v, array, sizeof(v));
+  return v;
+}
+
+// Loads whole vectors unaligned and adds the remainder one by one.
+float SumDefault(const float* array, size_t length) {
+  Vector s0 = {}, s1 = {}, s2 = {}, s3 = {};
+  size_t i = 0;
+  for (; i + kLanes <= length; i += kLanes) {
+    s0 += LoadUnaligned(array + i);
+    s1 += LoadUnaligned(array + i + 4);
+    s2 += LoadUnaligned(array + i + 8);
+    s3 += LoadUnaligned(array + i + 12);
+  }
+  float total = Total((s0 + s1) + (s2 + s3));
+  for (; i < length; i++) {
+    total += array[i];
+  }
+  return total;
+}
+
+// Relies on `array` being aligned to 64 bytes and padded with zeros.
+float SumAligned(const float* array, size_t length) {
+  const Vector* vectors = reinterpret_cast<const Vector*>(
+      __builtin_assume_aligned(array, kLanes * sizeof(float)));
+  const size_t padded = (length + kLanes - 1) / kLanes * 4;
+  Vector s0 = {}, s1 = {}, s2 = {}, s3 = {};
+  for (size_t i = 0; i < padded; i += 4) {
+    s0 += vectors[i];
+    s1 += vectors[i + 1];
+    s2 += vectors[i + 2];
+    s3 += vectors[i + 3];
+  }
+  return Total((s0 + s1) + (s2 + s3));
+}
+
+// Argument: The length of each array.
+template <size_t ArrayAlignment>
+void BM_Sum(benchmark::State& state) {
+  using RecordRef =
+      Ref<Header, VarAllocator<float, std::allocator<Header>, Header,
+                               ArrayAlignment>>;
+  const size_t length = static_cast<size_t>(state.range(0));
+  const size_t count = kFloats / length;
+  std::vector<RecordRef> refs;
+  std::vector<Record> records;
+  for (size_t r = 0; r < count; r++) {
+    float* array;
+    refs.push_back(MakeRefCounted<Header, float, ArrayAlignment, size_t>(
+        length, array, size_t{length}));
+    for (size_t i = 0; i < length; i++) {
+      array[i] = static_cast<float>(i % 7);
+    }
+    records.push_back(Record{array, length});
+  }
+  for (auto _ : state) {
+    float sum = 0;
+    for (const Record& record : records) {
+      sum += ArrayAlignment == alignof(float)
+                 ? SumDefault(record.array, record.length)
+                 : SumAligned(record.array, record.length);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * count * length);
+  state.SetLabel(ArrayAlignment == alignof(float) ? "default" : "aligned64");
+}
+BENCHMARK_TEMPLATE(BM_Sum, alignof(float))
+    ->Arg(7)
+    ->Arg(16)
+    ->Arg(61)
+    ->Arg(256)
+    ->Arg(1000);
+BENCHMARK_TEMPLATE(BM_Sum, 64)->Arg(7)->Arg(16)->Arg(61)->Arg(256)->Arg(1000);
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,310 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks comparing `Ref`, `MakeRefCounted` and `CopyOnWrite` to common
+// alternatives for sharing immutable strings: `std::shared_ptr`, intrusive
+// reference counting in the style of `boost::intrusive_ptr`, and a chunked
+// buffer in the style of `absl::Cord`. The latter two are minimal local
+// re-implementations, so that no additional dependencies are needed.
+//
+// Each alternative is measured for creation, copying and releasing on
+// a different thread, with strings of 16 bytes and 4 KiB. Allocations are
+// counted by replacing the global `operator new`, since not all alternatives
+// accept a custom allocator.
+//
+// For regression tracking, run with
+// `--benchmark_out=<file> --benchmark_out_format=json`; the `ctest` run writes
+// `alternatives_benchmark.json` into the build directory.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "absl/utility/utility.h"
+#include "benchmark/benchmark.h"
+#include "benchmark_channel.h"
+#include "copy_on_write.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace {
+
+std::atomic<int64_t> allocations{0};
+std::atomic<int64_t> allocated_bytes{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace refptr {
+namespace {
+
+// Intrusive reference counting in the style of `boost::intrusive_ptr`.
+//
+// `Derived` inherits from `IntrusiveRefCounted<Derived>`, which holds the
+// count. Newly created instances have the count of 1, adopted by the first
+// `IntrusivePtr`.
+template <typename Derived>
+class IntrusiveRefCounted {
+ public:
+  friend void IntrusiveAddRef(const Derived* ptr) {
+    ptr->refs_.fetch_add(1, std::memory_order_relaxed);
+  }
+  friend void IntrusiveRelease(const Derived* ptr) {
+    if (ptr->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      Derived::Delete(ptr);
+    }
+  }
+
+ protected:
+  // Can be hidden by `Derived` to customize deletion.
+  static void Delete(const Derived* ptr) { delete ptr; }
+
+ private:
+  mutable std::atomic<int> refs_{1};
+};
+
+template <typename T>
+class IntrusivePtr {
+ public:
+  // Adopts the initial reference of a newly created `ptr`.
+  explicit IntrusivePtr(T* ptr) : ptr_(ptr) {}
+  IntrusivePtr(const IntrusivePtr& other) : ptr_(other.ptr_) {
+    if (ptr_ != nullptr) {
+      IntrusiveAddRef(ptr_);
+    }
+  }
+  IntrusivePtr(IntrusivePtr&& other)
+      : ptr_(absl::exchange(other.ptr_, nullptr)) {}
+  IntrusivePtr& operator=(IntrusivePtr other) {
+    std::swap(ptr_, other.ptr_);
+    return *this;
+  }
+  ~IntrusivePtr() {
+    if (ptr_ != nullptr) {
+      IntrusiveRelease(ptr_);
+    }
+  }
+
+  T& operator*() const { return *ptr_; }
+  T* operator->() const { return ptr_; }
+
+ private:
+  T* ptr_;
+};
+
+struct IntrusiveString : public IntrusiveRefCounted<IntrusiveString> {
+  explicit IntrusiveString(const std::string& value_) : value(value_) {}
+
+  const std::string value;
+};
+
+// An immutable sequence of shared chunks of at most `kChunkSize` bytes, in the
+// style of `absl::Cord`. Copies share the whole representation, and chunks can
+// be shared among different cords.
+class MiniCord {
+ public:
+  static constexpr size_t kChunkSize = 1024;
+
+  explicit MiniCord(const std::string& data) : rep_(new Rep()) {
+    for (size_t i = 0; i < data.size(); i += kChunkSize) {
+      rep_->chunks.push_back(Chunk::Make(
+          data.data() + i, std::min(kChunkSize, data.size() - i)));
+    }
+    rep_->size = data.size();
+  }
+
+  size_t size() const { return rep_->size; }
+  char front() const { return rep_->chunks.front()->data()[0]; }
+
+ private:
+  // Allocated together with its data.
+  struct Chunk : public IntrusiveRefCounted<Chunk> {
+    static IntrusivePtr<const Chunk> Make(const char* data, size_t length) {
+      void* memory = ::operator new(sizeof(Chunk) + length);
+      Chunk* chunk = new (memory) Chunk(length);
+      memcpy(chunk->data(), data, length);
+      return IntrusivePtr<const Chunk>(chunk);
+    }
+
+    static void Delete(const Chunk* chunk) {
+      chunk->~Chunk();
+      ::operator delete(const_cast<Chunk*>(chunk));
+    }
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    const char* data() const {
+      return reinterpret_cast<const char*>(this + 1);
+    }
+
+    const size_t length;
+
+   private:
+    explicit Chunk(size_t length_) : length(length_) {}
+  };
+
+  struct Rep : public IntrusiveRefCounted<Rep> {
+    std::vector<IntrusivePtr<const Chunk>> chunks;
+    size_t size = 0;
+  };
+
+  IntrusivePtr<Rep> rep_;
+};
+
+constexpr size_t MiniCord::kChunkSize;
+
+// Backends, each with a `Pointer` type sharing an immutable string.
+
+struct SharedPtrBackend {
+  using Pointer = std::shared_ptr<const std::string>;
+  static Pointer Make(const std::string& source) {
+    return std::make_shared<const std::string>(source);
+  }
+  static char Front(const Pointer& ptr) { return ptr->front(); }
+};
+
+struct RefBackend {
+  using Pointer = Ref<const std::string>;
+  static Pointer Make(const std::string& source) {
+    return New<std::string>(source).Share();
+  }
+  static char Front(const Pointer& ptr) { return ptr->front(); }
+};
+
+struct MakeRefCountedBackend {
+  struct Header {
+    explicit Header(size_t length_) : length(length_) {}
+
+    size_t length;
+    const char* data = nullptr;
+  };
+  using Alloc = VarAllocator<char, std::allocator<Header>, Header>;
+  using Pointer = Ref<const Header, Alloc>;
+  static Pointer Make(const std::string& source) {
+    char* array;
+    auto ref = MakeRefCounted<Header, char, size_t>(source.size(), array,
+                                                    source.size());
+    memcpy(array, source.data(), source.size());
+    ref->data = array;
+    return std::move(ref).Share();
+  }
+  static char Front(const Pointer& ptr) { return ptr->data[0]; }
+};
+
+struct CopyOnWriteBackend {
+  using Pointer = CopyOnWrite<std::string>;
+  static Pointer Make(const std::string& source) {
+    return CopyOnWrite<std::string>(absl::in_place, source);
+  }
+  static char Front(const Pointer& ptr) { return ptr->front(); }
+};
+
+struct IntrusiveBackend {
+  using Pointer = IntrusivePtr<const IntrusiveString>;
+  static Pointer Make(const std::string& source) {
+    return Pointer(new IntrusiveString(source));
+  }
+  static char Front(const Pointer& ptr) { return ptr->value.front(); }
+};
+
+struct CordBackend {
+  using Pointer = MiniCord;
+  static Pointer Make(const std::string& source) { return MiniCord(source); }
+  static char Front(const Pointer& ptr) { return ptr.front(); }
+};
+
+// Creates and destroys a shared string of `state.range(0)` bytes. Reports the
+// number of allocations and allocated bytes per object.
+template <typename B>
+void BM_Create(benchmark::State& state) {
+  const std::string source(state.range(0), 'x');
+  const int64_t allocations_before = allocations.load();
+  const int64_t bytes_before = allocated_bytes.load();
+  for (auto _ : state) {
+    typename B::Pointer ptr = B::Make(source);
+    benchmark::DoNotOptimize(B::Front(ptr));
+  }
+  const double objects = static_cast<double>(state.iterations());
+  state.counters["allocs/obj"] =
+      (allocations.load() - allocations_before) / objects;
+  state.counters["bytes/obj"] =
+      (allocated_bytes.load() - bytes_before) / objects;
+}
+
+// Copies and destroys the copy of a shared string.
+template <typename B>
+void BM_Copy(benchmark::State& state) {
+  const typename B::Pointer original =
+      B::Make(std::string(state.range(0), 'x'));
+  for (auto _ : state) {
+    typename B::Pointer copy(original);
+    benchmark::DoNotOptimize(B::Front(copy));
+  }
+}
+
+// Creates shared strings and passes them to another thread, which releases
+// them.
+template <typename B>
+void BM_CrossThreadRelease(benchmark::State& state) {
+  const std::string source(state.range(0), 'x');
+  Channel<absl::optional<typename B::Pointer>> channel;
+  std::thread consumer([&channel] {
+    while (auto ptr = channel.Pop()) {
+      benchmark::DoNotOptimize(B::Front(*ptr));
+    }
+  });
+  for (auto _ : state) {
+    channel.Push(B::Make(source));
+  }
+  channel.Push(absl::nullopt);
+  consumer.join();
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Registers benchmark `b` for all backends, applying `options` to each.
+#define BENCHMARK_ALTERNATIVES(b, options)                                   \
+  BENCHMARK_TEMPLATE(b, SharedPtrBackend)->Arg(16)->Arg(4096) options;      \
+  BENCHMARK_TEMPLATE(b, RefBackend)->Arg(16)->Arg(4096) options;            \
+  BENCHMARK_TEMPLATE(b, MakeRefCountedBackend)->Arg(16)->Arg(4096) options; \
+  BENCHMARK_TEMPLATE(b, CopyOnWriteBackend)->Arg(16)->Arg(4096) options;    \
+  BENCHMARK_TEMPLATE(b, IntrusiveBackend)->Arg(16)->Arg(4096) options;      \
+  BENCHMARK_TEMPLATE(b, CordBackend)->Arg(16)->Arg(4096) options
+
+BENCHMARK_ALTERNATIVES(BM_Create, );
+BENCHMARK_ALTERNATIVES(BM_Copy, );
+BENCHMARK_ALTERNATIVES(BM_CrossThreadRelease, ->UseRealTime());
+
+#undef BENCHMARK_ALTERNATIVES
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,65 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BENCHMARK_CHANNEL_H
+#define _BENCHMARK_CHANNEL_H
+
+// Helpers for passing values between threads of multi-threaded benchmarks.
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+
+#include "absl/types/optional.h"
+
+namespace refptr {
+
+// Bounded single-producer, single-consumer channel. Waiting threads yield so
+// that the benchmarks also make progress with fewer cores than threads.
+template <typename P>
+class Channel {
+ public:
+  void Push(P value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    while (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+      std::this_thread::yield();
+    }
+    slots_[tail % kCapacity].emplace(std::move(value));
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  P Pop() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    while (tail_.load(std::memory_order_acquire) == head) {
+      std::this_thread::yield();
+    }
+    auto& slot = slots_[head % kCapacity];
+    P value = std::move(*slot);
+    slot.reset();
+    head_.store(head + 1, std::memory_order_release);
+    return value;
+  }
+
+ private:
+  static constexpr size_t kCapacity = 64;
+
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  absl::optional<P> slots_[kCapacity];
+};
+
+}  // namespace refptr
+
+#endif  // _BENCHMARK_CHANNEL_H
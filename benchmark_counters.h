@@ -0,0 +1,169 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BENCHMARK_COUNTERS_H
+#define _BENCHMARK_COUNTERS_H
+
+// Helpers for reporting additional measurements as counters of
+// https://github.com/google/benchmark benchmarks.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "counting_allocator.h"
+#include "latency_histogram.h"
+#include "perf_counters.h"
+
+namespace refptr {
+
+// Reports allocations of `Tag` made during the lifetime of an instance as
+// counters of `state`:
+//
+// - `allocs/obj` and `bytes/obj`: The number of allocations and allocated
+//   bytes per object.
+// - `peak_bytes`: The peak of live bytes above the level at construction.
+// - `overhead/obj`: Allocated bytes per object exceeding the bytes of payload
+//   reported by `AddPayloadBytes`, if any.
+//
+// Intended for single-threaded benchmarks, create it before the benchmark loop:
+//
+//     ScopedAllocationCounters<MyTag> counters(state, /*objects=*/100);
+//     for (auto _ : state) {
+//       for (int i = 0; i < 100; i++) {
+//         ... allocate with CountingAllocator<..., MyTag> ...
+//       }
+//     }
+template <typename Tag>
+class ScopedAllocationCounters {
+ public:
+  // `objects_per_iteration` is the number of objects created in each
+  // iteration of the benchmark loop.
+  explicit ScopedAllocationCounters(benchmark::State& state,
+                                    int64_t objects_per_iteration = 1)
+      : state_(state),
+        objects_per_iteration_(objects_per_iteration),
+        before_((AllocationCounter<Tag>::ResetPeak(),
+                 AllocationCounter<Tag>::Snapshot())) {}
+
+  // Records `bytes` of payload of the created objects, that is the bytes of
+  // the objects and their arrays without any allocation overhead.
+  void AddPayloadBytes(int64_t bytes) { payload_bytes_ += bytes; }
+
+  ScopedAllocationCounters(const ScopedAllocationCounters&) = delete;
+  ScopedAllocationCounters& operator=(const ScopedAllocationCounters&) =
+      delete;
+
+  ~ScopedAllocationCounters() {
+    const AllocationStats stats =
+        AllocationCounter<Tag>::Snapshot().Since(before_);
+    const double objects =
+        static_cast<double>(state_.iterations()) * objects_per_iteration_;
+    if (objects <= 0) {
+      return;
+    }
+    state_.counters["allocs/obj"] =
+        benchmark::Counter(stats.allocations / objects);
+    state_.counters["bytes/obj"] =
+        benchmark::Counter(stats.allocated_bytes / objects);
+    state_.counters["peak_bytes"] = benchmark::Counter(
+        stats.peak_live_bytes - before_.live_bytes(),
+        benchmark::Counter::kDefaults, benchmark::Counter::kIs1024);
+    if (payload_bytes_ > 0) {
+      state_.counters["overhead/obj"] = benchmark::Counter(
+          (stats.allocated_bytes - payload_bytes_) / objects);
+    }
+  }
+
+ private:
+  benchmark::State& state_;
+  const int64_t objects_per_iteration_;
+  const AllocationStats before_;
+  int64_t payload_bytes_ = 0;
+};
+
+// Reports hardware events of the current thread during the lifetime of an
+// instance as counters of `state`, such as `cycles/obj` and `LLC_misses/obj`,
+// per object. See `PerfCounters` for the list of events.
+//
+// Enabled only if the environment variable `REFPTR_PERF_COUNTERS` is set to
+// a value other than `0`. If no events are available, labels the benchmark
+// instead. Used the same way as `ScopedAllocationCounters`.
+class ScopedPerfCounters {
+ public:
+  explicit ScopedPerfCounters(benchmark::State& state,
+                              int64_t objects_per_iteration = 1)
+      : state_(state), objects_per_iteration_(objects_per_iteration) {
+    if (Enabled()) {
+      counters_.reset(new PerfCounters());
+      counters_->Start();
+    }
+  }
+
+  ScopedPerfCounters(const ScopedPerfCounters&) = delete;
+  ScopedPerfCounters& operator=(const ScopedPerfCounters&) = delete;
+
+  ~ScopedPerfCounters() {
+    if (counters_ == nullptr) {
+      return;
+    }
+    counters_->Stop();
+    if (!counters_->AnyAvailable()) {
+      state_.SetLabel("perf events unavailable");
+      return;
+    }
+    const double objects =
+        static_cast<double>(state_.iterations()) * objects_per_iteration_;
+    if (objects <= 0) {
+      return;
+    }
+    for (int i = 0; i < PerfCounters::kEvents; i++) {
+      const auto event = static_cast<PerfCounters::Event>(i);
+      const int64_t count = counters_->Read(event);
+      if (count >= 0) {
+        state_.counters[std::string(PerfCounters::Name(event)) + "/obj"] =
+            benchmark::Counter(count / objects);
+      }
+    }
+  }
+
+  static bool Enabled() {
+    const char* value = std::getenv("REFPTR_PERF_COUNTERS");
+    return value != nullptr && std::strcmp(value, "0") != 0;
+  }
+
+ private:
+  benchmark::State& state_;
+  const int64_t objects_per_iteration_;
+  std::unique_ptr<PerfCounters> counters_;
+};
+
+// Reports percentiles of `histogram` as counters `<prefix>p50`, `<prefix>p99`,
+// `<prefix>p999` and `<prefix>max` of `state`. Values are in the units of the
+// histogram, typically nanoseconds.
+inline void ReportLatencyCounters(benchmark::State& state,
+                                  const LatencyHistogram& histogram,
+                                  const std::string& prefix = "") {
+  state.counters[prefix + "p50"] = histogram.Percentile(50);
+  state.counters[prefix + "p99"] = histogram.Percentile(99);
+  state.counters[prefix + "p999"] = histogram.Percentile(99.9);
+  state.counters[prefix + "max"] = histogram.max();
+}
+
+}  // namespace refptr
+
+#endif  // _BENCHMARK_COUNTERS_H
@@ -0,0 +1,137 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BULK_CONSTRUCT_H
+#define _BULK_CONSTRUCT_H
+
+// Parallel construction of many var-sized, reference-counted records, for
+// example from columnar input.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+
+// The number of consecutive records constructed by a thread at once. Large
+// enough to amortize claiming them, small enough to balance the load.
+constexpr size_t kBulkConstructChunk = 1024;
+
+// Creates `count` records using up to `threads` threads, including the calling
+// one. Record `i` is created as if by
+//
+//   B* array;
+//   Ref<U, VarAllocator<B, Alloc, U>> record =
+//       MakeRefCounted<U, B, H>(length(i), array, header(i), alloc);
+//   fill(i, array, length(i));
+//
+// where `header(i)` returns some type `H` from which `U` is constructible.
+// `length`, `header` and `fill` are called concurrently for different `i`.
+// Returns the records in the order of `i`.
+//
+// Each thread allocates through its own copy of `alloc`. Copies of a stateful
+// allocator share its state, which must then be thread-safe. If any of the
+// calls throws, or a thread can't be started, all the records created
+// so far are destroyed and one of the exceptions is rethrown.
+template <typename U, typename B, typename Alloc = std::allocator<U>,
+          typename LengthFn, typename HeaderFn, typename FillFn>
+std::vector<Ref<const U, VarAllocator<B, Alloc, U>>> BulkMakeRefCounted(
+    size_t count, const LengthFn& length, const HeaderFn& header,
+    const FillFn& fill, int threads, const Alloc& alloc = {}) {
+  using Block = Refcounted<U, VarAllocator<B, Alloc, U>>;
+  std::vector<Block*> blocks(count, nullptr);
+  std::atomic<size_t> next_chunk{0};
+  std::atomic<bool> failed{false};
+  std::mutex exception_mutex;
+  std::exception_ptr exception;
+  auto record_exception = [&]() {
+    std::lock_guard<std::mutex> lock(exception_mutex);
+    if (!exception) {
+      exception = std::current_exception();
+    }
+    failed.store(true, std::memory_order_relaxed);
+  };
+
+  auto work = [&]() {
+    Alloc thread_alloc(alloc);
+    try {
+      while (!failed.load(std::memory_order_relaxed)) {
+        const size_t begin = next_chunk.fetch_add(kBulkConstructChunk,
+                                                  std::memory_order_relaxed);
+        if (begin >= count) {
+          return;
+        }
+        const size_t end = std::min(count, begin + kBulkConstructChunk);
+        for (size_t i = begin; i < end; i++) {
+          const size_t record_length = length(i);
+          B* array;
+          Ref<U, VarAllocator<B, Alloc, U>> record =
+              MakeRefCounted<U, B, decltype(header(i))>(
+                  record_length, array, header(i), thread_alloc);
+          fill(i, array, record_length);
+          blocks[i] = std::move(record).Release();
+        }
+      }
+    } catch (...) {
+      record_exception();
+    }
+  };
+
+  const size_t chunks = (count + kBulkConstructChunk - 1) / kBulkConstructChunk;
+  const size_t helpers =
+      std::min(chunks, static_cast<size_t>(std::max(threads, 1))) - (count > 0);
+  std::vector<std::thread> pool;
+  pool.reserve(helpers);
+  try {
+    for (size_t t = 0; t < helpers; t++) {
+      pool.emplace_back(work);
+    }
+  } catch (...) {
+    // The threads started so far stop after their current chunk and are
+    // joined below.
+    record_exception();
+  }
+  work();
+  for (std::thread& thread : pool) {
+    thread.join();
+  }
+
+  std::vector<Ref<const U, VarAllocator<B, Alloc, U>>> result;
+  if (exception) {
+    for (Block* block : blocks) {
+      if (block != nullptr) {
+        Ref<U, VarAllocator<B, Alloc, U>> destroyed(block);
+      }
+    }
+    std::rethrow_exception(exception);
+  }
+  result.reserve(count);
+  for (Block* block : blocks) {
+    result.emplace_back(block);
+  }
+  return result;
+}
+
+}  // namespace refptr
+
+#endif  // _BULK_CONSTRUCT_H
@@ -0,0 +1,122 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Construction of 2^20 var-sized records from columnar input by
+// `BulkMakeRefCounted` with 1 to 64 threads, compared to a serial loop of
+// `MakeRefCounted`. Destruction of the records isn't timed.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "bulk_construct.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct Record {
+  Record(int64_t id_, double score_) : id(id_), score(score_) {}
+
+  int64_t id;
+  double score;
+};
+
+// Records with payloads of 16 to 256 bytes stored in columns.
+struct Columns {
+  explicit Columns(size_t count)
+      : ids(count), scores(count), offsets(count + 1) {
+    std::mt19937_64 random(42);
+    std::uniform_int_distribution<size_t> length(16, 256);
+    for (size_t i = 0; i < count; i++) {
+      ids[i] = static_cast<int64_t>(random());
+      scores[i] = static_cast<double>(i) / count;
+      offsets[i + 1] = offsets[i] + length(random);
+    }
+    payload.resize(offsets[count]);
+    for (size_t i = 0; i < payload.size(); i++) {
+      payload[i] = static_cast<char>('a' + i % 26);
+    }
+  }
+
+  size_t size() const { return ids.size(); }
+  size_t Length(size_t i) const { return offsets[i + 1] - offsets[i]; }
+  Record Header(size_t i) const { return Record(ids[i], scores[i]); }
+  void Fill(size_t i, char* array, size_t length) const {
+    std::memcpy(array, payload.data() + offsets[i], length);
+  }
+
+  std::vector<int64_t> ids;
+  std::vector<double> scores;
+  std::vector<size_t> offsets;
+  std::string payload;
+};
+
+const Columns& Input() {
+  static const Columns* const columns = new Columns(size_t{1} << 20);
+  return *columns;
+}
+
+using RecordRef = Ref<const Record, VarAllocator<char, std::allocator<Record>,
+                                                 Record>>;
+
+// Argument: The number of threads, or 0 for a serial loop.
+void BM_BulkConstruct(benchmark::State& state) {
+  const Columns& input = Input();
+  const int threads = static_cast<int>(state.range(0));
+  for (auto _ : state) {
+    std::vector<RecordRef> records;
+    if (threads == 0) {
+      records.reserve(input.size());
+      for (size_t i = 0; i < input.size(); i++) {
+        char* array;
+        const size_t length = input.Length(i);
+        auto record = MakeRefCounted<Record, char, Record>(length, array,
+                                                           input.Header(i));
+        input.Fill(i, array, length);
+        records.push_back(std::move(record).Share());
+      }
+    } else {
+      records = BulkMakeRefCounted<Record, char>(
+          input.size(), [&input](size_t i) { return input.Length(i); },
+          [&input](size_t i) { return input.Header(i); },
+          [&input](size_t i, char* array, size_t length) {
+            input.Fill(i, array, length);
+          },
+          threads);
+    }
+    benchmark::DoNotOptimize(records.data());
+    state.PauseTiming();
+    records.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * input.size());
+  state.SetBytesProcessed(state.iterations() * input.payload.size());
+}
+BENCHMARK(BM_BulkConstruct)
+    ->Arg(0)
+    ->RangeMultiplier(2)
+    ->Range(1, 64)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace refptr
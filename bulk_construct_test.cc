@@ -0,0 +1,140 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "bulk_construct.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "counting_allocator.h"
+#include "gtest/gtest.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct Record {
+  explicit Record(int64_t id_) : id(id_) {}
+
+  int64_t id;
+  const char* data = nullptr;
+  size_t length = 0;
+};
+
+size_t LengthOf(size_t i) { return i % 37; }
+int64_t IdOf(size_t i) { return static_cast<int64_t>(i) * 3; }
+
+void Fill(size_t i, char* array, size_t length) {
+  for (size_t j = 0; j < length; j++) {
+    array[j] = static_cast<char>('a' + (i + j) % 26);
+  }
+}
+
+std::string Expected(size_t i) {
+  std::string expected(LengthOf(i), ' ');
+  Fill(i, &expected[0], expected.size());
+  return expected;
+}
+
+TEST(BulkConstructTest, ConstructsInInputOrder) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  // Not a multiple of `kBulkConstructChunk`.
+  const size_t count = 5 * kBulkConstructChunk + 17;
+  {
+    auto records = BulkMakeRefCounted<Record, char>(
+        count, &LengthOf, &IdOf,
+        [](size_t i, char* array, size_t length) { Fill(i, array, length); },
+        /*threads=*/4, CountingAllocator<Record, Tag>());
+    ASSERT_EQ(records.size(), count);
+    for (size_t i = 0; i < count; i++) {
+      EXPECT_EQ(records[i]->id, IdOf(i));
+    }
+    const AllocationStats stats =
+        AllocationCounter<Tag>::Snapshot().Since(before);
+    EXPECT_EQ(stats.allocations, static_cast<int64_t>(count));
+  }
+  EXPECT_EQ(AllocationCounter<Tag>::Snapshot().Since(before).live_bytes(), 0);
+}
+
+TEST(BulkConstructTest, FillsArrays) {
+  const size_t count = 3000;
+  std::vector<const char*> arrays(count);
+  auto records = BulkMakeRefCounted<Record, char>(
+      count, &LengthOf, &IdOf,
+      [&arrays](size_t i, char* array, size_t length) {
+        Fill(i, array, length);
+        arrays[i] = array;
+      },
+      /*threads=*/3);
+  for (size_t i = 0; i < count; i++) {
+    EXPECT_EQ(std::string(arrays[i], LengthOf(i)), Expected(i));
+  }
+}
+
+TEST(BulkConstructTest, Empty) {
+  auto records = BulkMakeRefCounted<Record, char>(
+      0, &LengthOf, &IdOf, [](size_t, char*, size_t) {}, /*threads=*/8);
+  EXPECT_TRUE(records.empty());
+}
+
+TEST(BulkConstructTest, SingleThread) {
+  auto records = BulkMakeRefCounted<Record, char>(
+      100, &LengthOf, &IdOf, [](size_t, char*, size_t) {}, /*threads=*/1);
+  ASSERT_EQ(records.size(), 100);
+  EXPECT_EQ(records[99]->id, IdOf(99));
+}
+
+TEST(BulkConstructTest, AllocatesEachRecordThroughAlloc) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  const size_t count = 4 * kBulkConstructChunk;
+  {
+    auto records = BulkMakeRefCounted<Record, char>(
+        count, &LengthOf, &IdOf,
+        [](size_t i, char* array, size_t length) { Fill(i, array, length); },
+        /*threads=*/4, CountingAllocator<Record, Tag>());
+    ASSERT_EQ(records.size(), count);
+    EXPECT_EQ(records[count - 1]->id, IdOf(count - 1));
+    EXPECT_EQ(AllocationCounter<Tag>::Snapshot().Since(before).allocations,
+              static_cast<int64_t>(count));
+  }
+  const AllocationStats stats =
+      AllocationCounter<Tag>::Snapshot().Since(before);
+  EXPECT_EQ(stats.live_allocations(), 0);
+}
+
+TEST(BulkConstructTest, DestroysRecordsOnException) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  auto fill = [](size_t i, char*, size_t) {
+    if (i == 7 * kBulkConstructChunk + 5) {
+      throw std::runtime_error("fill");
+    }
+  };
+  EXPECT_THROW((BulkMakeRefCounted<Record, char>(
+                   10 * kBulkConstructChunk, &LengthOf, &IdOf, fill,
+                   /*threads=*/4, CountingAllocator<Record, Tag>())),
+               std::runtime_error);
+  const AllocationStats stats =
+      AllocationCounter<Tag>::Snapshot().Since(before);
+  EXPECT_GT(stats.allocations, 0);
+  EXPECT_EQ(stats.live_allocations(), 0);
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,86 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Creates a deliberately contended `Ref<const T>` and verifies that
+// `ContentionProfiler` reports it as the hottest block.
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "contention_profiler.h"
+#include "ref.h"
+
+#ifndef REFPTR_CONTENTION_PROFILING
+#error "This benchmark requires REFPTR_CONTENTION_PROFILING to be defined"
+#endif
+
+namespace refptr {
+namespace {
+
+struct HotPayload {
+  int64_t values[8];
+};
+
+struct ColdPayload {
+  int64_t values[8];
+};
+
+// All threads copy a single shared `HotPayload`, while each also copies its
+// own `ColdPayload`. Only the former must be reported.
+void BM_ContendedRef(benchmark::State& state) {
+  static Ref<const HotPayload>* hot;
+  if (state.thread_index() == 0) {
+    ContentionProfiler::ClearDestroyed();
+    hot = new Ref<const HotPayload>(New<HotPayload>().Share());
+  }
+  const Ref<const ColdPayload> cold = New<ColdPayload>().Share();
+  int64_t i = 0;
+  for (auto _ : state) {
+    Ref<const HotPayload> hot_copy(*hot);
+    Ref<const ColdPayload> cold_copy(cold);
+    benchmark::DoNotOptimize(hot_copy->values[0]);
+    benchmark::DoNotOptimize(cold_copy->values[0]);
+    // Interleaves the threads even if there are fewer cores than threads.
+    if (++i % 64 == 0) {
+      std::this_thread::yield();
+    }
+  }
+  if (state.thread_index() == 0) {
+    const std::vector<ContendedBlock> blocks =
+        ContentionProfiler::HottestBlocks(1);
+    if (blocks.empty() ||
+        blocks[0].type_name.find("HotPayload") == std::string::npos ||
+        !blocks[0].live) {
+      state.SkipWithError("The contended block was not detected");
+    } else {
+      state.counters["cpu_bounces"] = blocks[0].cpu_bounces;
+      state.counters["thread_switches"] = blocks[0].thread_switches;
+      state.counters["threads_seen"] = blocks[0].threads;
+    }
+    delete hot;
+  }
+}
+// Fixed iterations so that even the shortest run takes enough samples.
+BENCHMARK(BM_ContendedRef)
+    ->Iterations(1 << 14)
+    ->Threads(2)
+    ->Threads(4)
+    ->Threads(8)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace refptr
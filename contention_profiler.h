@@ -0,0 +1,329 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CONTENTION_PROFILER_H
+#define _CONTENTION_PROFILER_H
+
+// Profiler of contended reference counts, that is `Refcounted` blocks whose
+// counter is modified by multiple threads and cores, causing its cache line to
+// bounce between them.
+//
+// Collected only if `REFPTR_CONTENTION_PROFILING` is defined, for example by
+// linking the `ref_contention_profiling` CMake target. It must be defined
+// consistently in all translation units of a program, as it changes the layout
+// of `Refcount`.
+//
+// On average one in `GetSamplingPeriod()` calls of `Refcount::Inc` and
+// `Refcount::Dec` of each thread is sampled, recording its thread and CPU in
+// the block. A block is reported by `HottestBlocks` once two consecutive
+// samples of its counter come from different threads or CPUs.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <unordered_set>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/numeric/bits.h"
+#include "demangle.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace refptr {
+
+// A block with a contended reference count, as returned by
+// `ContentionProfiler::HottestBlocks`.
+struct ContendedBlock {
+  // Address of the `Refcounted` block. Might have been reused if `!live`.
+  const void* block = nullptr;
+  // Demangled, if possible.
+  std::string type_name;
+  // Whether the block still exists.
+  bool live = false;
+  // The number of sampled `Inc` and `Dec` calls.
+  int64_t samples = 0;
+  // The number of distinct threads among the samples (at most 64).
+  int threads = 0;
+  // The number of consecutive samples executed on different CPUs.
+  int64_t cpu_bounces = 0;
+  // The number of consecutive samples executed by different threads.
+  int64_t thread_switches = 0;
+};
+
+namespace internal {
+class ContentionStats;
+}  // namespace internal
+
+class ContentionProfiler {
+ public:
+  static constexpr int64_t kDefaultSamplingPeriod = 64;
+
+  // Sets the average number of `Inc` and `Dec` calls between samples. Zero
+  // disables sampling. Threads pick up the new value only after their next
+  // sample (or within `kDisabledRecheckCalls` if sampling was disabled).
+  static void SetSamplingPeriod(int64_t calls) {
+    GetState().period.store(calls, std::memory_order_relaxed);
+  }
+  static int64_t GetSamplingPeriod() {
+    return GetState().period.load(std::memory_order_relaxed);
+  }
+
+  // Returns up to `max_blocks` blocks, both live and destroyed, with the most
+  // CPU bounces first, and those with the most thread switches among equal
+  // ones.
+  static std::vector<ContendedBlock> HottestBlocks(size_t max_blocks);
+
+  // Writes `HottestBlocks(max_blocks)` to `out` in a human-readable form, one
+  // line per block.
+  static void DumpHottestBlocks(std::ostream& out, size_t max_blocks) {
+    for (const ContendedBlock& block : HottestBlocks(max_blocks)) {
+      out << block.type_name << " @" << block.block
+          << (block.live ? "" : " (destroyed)")
+          << ": cpu_bounces=" << block.cpu_bounces
+          << " thread_switches=" << block.thread_switches
+          << " threads=" << block.threads << " samples=" << block.samples
+          << "\n";
+    }
+  }
+
+  // Forgets all destroyed blocks.
+  static void ClearDestroyed() {
+    State& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.destroyed.clear();
+  }
+
+  // If sampling is disabled, threads check again after this many calls.
+  static constexpr int64_t kDisabledRecheckCalls = int64_t{1} << 16;
+
+ private:
+  // At most this many of the hottest destroyed blocks are kept.
+  static constexpr size_t kMaxDestroyed = 256;
+
+  struct State {
+    std::atomic<int64_t> period{kDefaultSamplingPeriod};
+    // The number of threads that have taken a sample, used to identify them.
+    std::atomic<int32_t> threads{0};
+    // Guards `live` and `destroyed`.
+    std::mutex mutex;
+    std::unordered_set<const internal::ContentionStats*> live;
+    std::vector<ContendedBlock> destroyed;
+  };
+
+  static State& GetState() {
+    // Never destroyed, so that it's usable during the whole program shutdown.
+    static State* const state = new State();
+    return *state;
+  }
+
+  // The number of calls until the next sample of the current thread.
+  static int64_t& Countdown() {
+    static thread_local int64_t countdown = 0;
+    return countdown;
+  }
+
+  // Draws uniformly from [1, 2 * period - 1], so that samples aren't aliased
+  // with regular patterns of calls.
+  static int64_t NextCountdown(int64_t period) {
+    // xorshift64*, seeded from the thread-local address.
+    static thread_local uint64_t random = 0;
+    if (random == 0) {
+      random = reinterpret_cast<uintptr_t>(&random) | 1;
+    }
+    random ^= random >> 12;
+    random ^= random << 25;
+    random ^= random >> 27;
+    return 1 + static_cast<int64_t>((random * 0x2545F4914F6CDD1Dull >> 11) %
+                                    static_cast<uint64_t>(2 * period - 1));
+  }
+
+  static int32_t ThreadIndex() {
+    static thread_local int32_t index =
+        GetState().threads.fetch_add(1, std::memory_order_relaxed);
+    return index;
+  }
+
+  static int32_t CurrentCpu() {
+#if defined(__linux__)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+  }
+
+  static bool Hotter(const ContendedBlock& a, const ContendedBlock& b) {
+    return a.cpu_bounces != b.cpu_bounces
+               ? a.cpu_bounces > b.cpu_bounces
+               : a.thread_switches > b.thread_switches;
+  }
+
+  static void Register(internal::ContentionStats& stats);
+  static void Unregister(const internal::ContentionStats& stats);
+
+  friend class internal::ContentionStats;
+};
+
+namespace internal {
+
+// Contention statistics of a single reference count, embedded in `Refcount`
+// when profiling.
+class ContentionStats {
+ public:
+  constexpr ContentionStats() {}
+
+  ContentionStats(const ContentionStats&) = delete;
+  ContentionStats& operator=(const ContentionStats&) = delete;
+
+  // Identifies the block of this reference count for reporting. Must be
+  // called before the block is shared with other threads.
+  void SetBlock(const void* block, const std::type_info& type) {
+    block_ = block;
+    type_ = &type;
+  }
+
+  // Called on every `Inc` and `Dec`, while the caller still holds a
+  // reference.
+  inline void OnAccess() {
+    if (ABSL_PREDICT_FALSE(--ContentionProfiler::Countdown() <= 0)) {
+      Sample();
+    }
+  }
+
+  // Called before the block is destroyed.
+  void OnDestroy() {
+    // Relaxed is sufficient, since the final `Dec` synchronizes with all the
+    // previous ones.
+    if (ABSL_PREDICT_FALSE(registered_.load(std::memory_order_relaxed))) {
+      ContentionProfiler::Unregister(*this);
+    }
+  }
+
+  ContendedBlock Snapshot(bool live) const {
+    ContendedBlock result;
+    result.block = block_;
+    result.type_name = type_ != nullptr ? Demangle(type_->name()) : "?";
+    result.live = live;
+    result.samples = samples_.load(std::memory_order_relaxed);
+    result.threads =
+        absl::popcount(thread_mask_.load(std::memory_order_relaxed));
+    result.cpu_bounces = cpu_bounces_.load(std::memory_order_relaxed);
+    result.thread_switches = thread_switches_.load(std::memory_order_relaxed);
+    return result;
+  }
+
+ private:
+  ABSL_ATTRIBUTE_NOINLINE void Sample() {
+    const int64_t period = ContentionProfiler::GetSamplingPeriod();
+    if (period <= 0) {
+      ContentionProfiler::Countdown() =
+          ContentionProfiler::kDisabledRecheckCalls;
+      return;
+    }
+    ContentionProfiler::Countdown() = ContentionProfiler::NextCountdown(period);
+    samples_.fetch_add(1, std::memory_order_relaxed);
+    const int32_t thread = ContentionProfiler::ThreadIndex();
+    thread_mask_.fetch_or(uint64_t{1} << (thread % 64),
+                          std::memory_order_relaxed);
+    bool contended = false;
+    const int32_t cpu = ContentionProfiler::CurrentCpu();
+    const int32_t last_cpu =
+        last_cpu_.exchange(cpu, std::memory_order_relaxed);
+    if (cpu >= 0 && last_cpu >= 0 && cpu != last_cpu) {
+      cpu_bounces_.fetch_add(1, std::memory_order_relaxed);
+      contended = true;
+    }
+    const int32_t last_thread =
+        last_thread_.exchange(thread, std::memory_order_relaxed);
+    if (last_thread >= 0 && last_thread != thread) {
+      thread_switches_.fetch_add(1, std::memory_order_relaxed);
+      contended = true;
+    }
+    if (contended && !registered_.load(std::memory_order_relaxed)) {
+      ContentionProfiler::Register(*this);
+    }
+  }
+
+  const void* block_ = nullptr;
+  const std::type_info* type_ = nullptr;
+  std::atomic<int64_t> samples_{0};
+  std::atomic<int64_t> cpu_bounces_{0};
+  std::atomic<int64_t> thread_switches_{0};
+  // Bit `i % 64` is set if a thread with index `i` took a sample.
+  std::atomic<uint64_t> thread_mask_{0};
+  std::atomic<int32_t> last_cpu_{-1};
+  std::atomic<int32_t> last_thread_{-1};
+  // Modified only under `ContentionProfiler::State::mutex`.
+  std::atomic<bool> registered_{false};
+
+  friend class refptr::ContentionProfiler;
+};
+
+}  // namespace internal
+
+inline std::vector<ContendedBlock> ContentionProfiler::HottestBlocks(
+    size_t max_blocks) {
+  State& state = GetState();
+  std::vector<ContendedBlock> result;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    result = state.destroyed;
+    for (const internal::ContentionStats* stats : state.live) {
+      result.push_back(stats->Snapshot(/*live=*/true));
+    }
+  }
+  std::stable_sort(result.begin(), result.end(), &Hotter);
+  if (result.size() > max_blocks) {
+    result.resize(max_blocks);
+  }
+  return result;
+}
+
+inline void ContentionProfiler::Register(internal::ContentionStats& stats) {
+  State& state = GetState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  if (!stats.registered_.load(std::memory_order_relaxed)) {
+    state.live.insert(&stats);
+    stats.registered_.store(true, std::memory_order_relaxed);
+  }
+}
+
+inline void ContentionProfiler::Unregister(
+    const internal::ContentionStats& stats) {
+  ContendedBlock block = stats.Snapshot(/*live=*/false);
+  State& state = GetState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.live.erase(&stats);
+  if (state.destroyed.size() < kMaxDestroyed) {
+    state.destroyed.push_back(std::move(block));
+    return;
+  }
+  auto coldest =
+      std::max_element(state.destroyed.begin(), state.destroyed.end(), &Hotter);
+  if (Hotter(block, *coldest)) {
+    *coldest = std::move(block);
+  }
+}
+
+}  // namespace refptr
+
+#endif  // _CONTENTION_PROFILER_H
@@ -0,0 +1,85 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "contention_profiler.h"
+
+#include <sstream>
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "ref.h"
+
+#ifndef REFPTR_CONTENTION_PROFILING
+#error "This test must be compiled with REFPTR_CONTENTION_PROFILING defined"
+#endif
+
+namespace refptr {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::SizeIs;
+
+struct HotFoo {
+  int value;
+};
+
+struct ColdFoo {
+  int value;
+};
+
+TEST(ContentionProfilerTest, ReportsBlocksSharedByThreads) {
+  // Threads pick up a new period only after their next sample, which is the
+  // very first call of each new thread.
+  ContentionProfiler::SetSamplingPeriod(1);
+  ContentionProfiler::ClearDestroyed();
+  {
+    Ref<const HotFoo> hot = New<HotFoo>(HotFoo{1}).Share();
+    const Ref<const ColdFoo> cold = New<ColdFoo>(ColdFoo{2}).Share();
+    for (int i = 0; i < 4; i++) {
+      std::thread([&hot] {
+        for (int j = 0; j < 10; j++) {
+          Ref<const HotFoo> copy = hot;
+        }
+      }).join();
+    }
+    for (int j = 0; j < 10; j++) {
+      Ref<const ColdFoo> copy = cold;
+    }
+
+    const auto blocks = ContentionProfiler::HottestBlocks(10);
+    ASSERT_THAT(blocks, SizeIs(1));
+    EXPECT_THAT(blocks[0].type_name, HasSubstr("HotFoo"));
+    EXPECT_TRUE(blocks[0].live);
+    EXPECT_EQ(blocks[0].threads, 4);
+    // Each copy increments and decrements the reference count.
+    EXPECT_EQ(blocks[0].samples, 4 * 10 * 2);
+    EXPECT_EQ(blocks[0].thread_switches, 3);
+  }
+  const auto blocks = ContentionProfiler::HottestBlocks(10);
+  ASSERT_THAT(blocks, SizeIs(1));
+  EXPECT_THAT(blocks[0].type_name, HasSubstr("HotFoo"));
+  EXPECT_FALSE(blocks[0].live);
+
+  std::ostringstream dump;
+  ContentionProfiler::DumpHottestBlocks(dump, 1);
+  EXPECT_THAT(dump.str(), HasSubstr("HotFoo"));
+  EXPECT_THAT(dump.str(), HasSubstr("(destroyed)"));
+  ContentionProfiler::ClearDestroyed();
+  ContentionProfiler::SetSamplingPeriod(
+      ContentionProfiler::kDefaultSamplingPeriod);
+}
+
+}  // namespace
+}  // namespace refptr
@@ -14,6 +14,9 @@
 
 // Benchmarks comparing var-sized, reference-counted data structures to
 // unique/shared pointers.
+//
+// Hardware events per iteration are reported if `REFPTR_PERF_COUNTERS=1` is
+// set in the environment.
 
 #include <cassert>
 #include <cstring>
@@ -21,6 +24,7 @@
 
 #include "absl/utility/utility.h"
 #include "benchmark/benchmark.h"
+#include "benchmark_counters.h"
 #include "copy_on_write.h"
 
 namespace refptr {
@@ -28,6 +32,7 @@ namespace {
 
 static void BM_MutatingOwned(benchmark::State& state) {
   CopyOnWrite<benchmark::IterationCount> value(absl::in_place);
+  ScopedPerfCounters perf(state);
   for (auto _ : state) {
     auto& ref = value.AsMutable();
     ref = state.iterations();
@@ -39,6 +44,7 @@ BENCHMARK(BM_MutatingOwned);
 
 static void BM_MutatingCopy(benchmark::State& state) {
   CopyOnWrite<benchmark::IterationCount> value(absl::in_place);
+  ScopedPerfCounters perf(state);
   for (auto _ : state) {
     CopyOnWrite<benchmark::IterationCount> copy(value);
     auto& ref = copy.AsMutable();
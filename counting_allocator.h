@@ -0,0 +1,208 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _COUNTING_ALLOCATOR_H
+#define _COUNTING_ALLOCATOR_H
+
+// Allocator adapter that counts allocations made through it. Useful for
+// verifying that `MakeUnique`, `MakeShared` and `MakeRefCounted` perform only a
+// single allocation, and for reporting memory usage in benchmarks:
+//
+//     struct MyTag {};
+//     char* array;
+//     auto ref = MakeRefCounted<Foo, char>(16, array,
+//                                          CountingAllocator<char, MyTag>());
+//     AllocationStats stats = AllocationCounter<MyTag>::Snapshot();
+//
+// Statistics are kept separately for each `Tag` type, which allows to
+// attribute them to individual call sites.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "absl/numeric/bits.h"
+#include "thread_shards.h"
+
+namespace refptr {
+
+// A point-in-time copy of the counters of a single tag.
+struct AllocationStats {
+  // Allocation sizes are bucketed by powers of two: Bucket 0 counts empty
+  // allocations, bucket `i > 0` those of size in [2^(i-1), 2^i).
+  static constexpr int kSizeBuckets = 64;
+
+  static int SizeBucket(size_t bytes) {
+    const int bucket =
+        static_cast<int>(absl::bit_width(static_cast<uint64_t>(bytes)));
+    return bucket < kSizeBuckets ? bucket : kSizeBuckets - 1;
+  }
+
+  int64_t live_allocations() const { return allocations - deallocations; }
+  int64_t live_bytes() const { return allocated_bytes - deallocated_bytes; }
+
+  // Returns the difference of counters between `*this` and an `earlier`
+  // snapshot. The peak is kept as is.
+  AllocationStats Since(const AllocationStats& earlier) const {
+    AllocationStats result = *this;
+    result.allocations -= earlier.allocations;
+    result.deallocations -= earlier.deallocations;
+    result.allocated_bytes -= earlier.allocated_bytes;
+    result.deallocated_bytes -= earlier.deallocated_bytes;
+    for (int i = 0; i < kSizeBuckets; i++) {
+      result.size_histogram[i] -= earlier.size_histogram[i];
+    }
+    return result;
+  }
+
+  int64_t allocations = 0;
+  int64_t deallocations = 0;
+  int64_t allocated_bytes = 0;
+  int64_t deallocated_bytes = 0;
+  // Exact if each thread deallocates only what it allocated. Otherwise this is
+  // an upper bound, the sum of per-thread peaks.
+  int64_t peak_live_bytes = 0;
+  int64_t size_histogram[kSizeBuckets] = {};
+};
+
+namespace internal {
+
+// Counters of a single thread.
+struct AllocationShard {
+  std::atomic<int64_t> allocations{0};
+  std::atomic<int64_t> deallocations{0};
+  std::atomic<int64_t> allocated_bytes{0};
+  std::atomic<int64_t> deallocated_bytes{0};
+  std::atomic<int64_t> peak_live_bytes{0};
+  std::atomic<int64_t> size_histogram[AllocationStats::kSizeBuckets] = {};
+};
+
+}  // namespace internal
+
+// Collects statistics of allocations tagged by `Tag`.
+template <typename Tag>
+class AllocationCounter {
+ public:
+  static void RecordAllocation(size_t bytes) {
+    internal::AllocationShard& shard = Shards::Local();
+    internal::AddToShardCounter(shard.allocations, 1);
+    internal::AddToShardCounter(shard.allocated_bytes, bytes);
+    internal::AddToShardCounter(
+        shard.size_histogram[AllocationStats::SizeBucket(bytes)], 1);
+    const int64_t live =
+        shard.allocated_bytes.load(std::memory_order_relaxed) -
+        shard.deallocated_bytes.load(std::memory_order_relaxed);
+    if (live > shard.peak_live_bytes.load(std::memory_order_relaxed)) {
+      shard.peak_live_bytes.store(live, std::memory_order_relaxed);
+    }
+  }
+
+  static void RecordDeallocation(size_t bytes) {
+    internal::AllocationShard& shard = Shards::Local();
+    internal::AddToShardCounter(shard.deallocations, 1);
+    internal::AddToShardCounter(shard.deallocated_bytes, bytes);
+  }
+
+  // Sums the counters of all threads. Counters modified concurrently might be
+  // observed in an inconsistent state with each other.
+  static AllocationStats Snapshot() {
+    AllocationStats stats;
+    Shards::ForEach([&stats](const internal::AllocationShard& shard) {
+      stats.allocations += shard.allocations.load(std::memory_order_relaxed);
+      stats.deallocations +=
+          shard.deallocations.load(std::memory_order_relaxed);
+      stats.allocated_bytes +=
+          shard.allocated_bytes.load(std::memory_order_relaxed);
+      stats.deallocated_bytes +=
+          shard.deallocated_bytes.load(std::memory_order_relaxed);
+      stats.peak_live_bytes +=
+          shard.peak_live_bytes.load(std::memory_order_relaxed);
+      for (int i = 0; i < AllocationStats::kSizeBuckets; i++) {
+        stats.size_histogram[i] +=
+            shard.size_histogram[i].load(std::memory_order_relaxed);
+      }
+    });
+    return stats;
+  }
+
+  // Resets the peak to the currently live bytes. Must not be called
+  // concurrently with allocations of `Tag`.
+  static void ResetPeak() {
+    Shards::ForEach([](internal::AllocationShard& shard) {
+      shard.peak_live_bytes.store(
+          shard.allocated_bytes.load(std::memory_order_relaxed) -
+              shard.deallocated_bytes.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    });
+  }
+
+ private:
+  using Shards = internal::ThreadShards<internal::AllocationShard, Tag>;
+};
+
+// Forwards all allocations to `Alloc` and records them with
+// `AllocationCounter<Tag>`. Can be used as the `Alloc` argument of
+// `VarAllocator`, `Refcounted` and the `Make...` functions, which rebind it to
+// the types they actually allocate.
+template <typename T, typename Tag, typename Alloc = std::allocator<T>>
+class CountingAllocator {
+ public:
+  using value_type = T;
+
+  CountingAllocator() = default;
+  explicit CountingAllocator(Alloc allocator)
+      : allocator_(std::move(allocator)) {}
+
+  template <typename U, typename UAlloc>
+  CountingAllocator(const CountingAllocator<U, Tag, UAlloc>& other)
+      : allocator_(other.allocator_) {}
+
+  T* allocate(size_t n) {
+    T* result = std::allocator_traits<Alloc>::allocate(allocator_, n);
+    AllocationCounter<Tag>::RecordAllocation(n * sizeof(T));
+    return result;
+  }
+  void deallocate(T* ptr, size_t n) {
+    AllocationCounter<Tag>::RecordDeallocation(n * sizeof(T));
+    std::allocator_traits<Alloc>::deallocate(allocator_, ptr, n);
+  }
+
+  template <typename U>
+  struct rebind {
+    using other = CountingAllocator<
+        U, Tag,
+        typename std::allocator_traits<Alloc>::template rebind_alloc<U>>;
+  };
+
+  template <typename U, typename UAlloc>
+  bool operator==(const CountingAllocator<U, Tag, UAlloc>& other) const {
+    return allocator_ == other.allocator_;
+  }
+  template <typename U, typename UAlloc>
+  bool operator!=(const CountingAllocator<U, Tag, UAlloc>& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  Alloc allocator_;
+
+  template <typename U, typename UTag, typename UAlloc>
+  friend class CountingAllocator;
+};
+
+}  // namespace refptr
+
+#endif  // _COUNTING_ALLOCATOR_H
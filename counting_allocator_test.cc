@@ -0,0 +1,168 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "counting_allocator.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct Foo {
+  explicit Foo(int value) : value_(value) {}
+
+  int value_;
+};
+
+template <typename Tag>
+class ScopedStats {
+ public:
+  ScopedStats() : before_(AllocationCounter<Tag>::Snapshot()) {}
+
+  AllocationStats Get() const {
+    return AllocationCounter<Tag>::Snapshot().Since(before_);
+  }
+
+ private:
+  const AllocationStats before_;
+};
+
+TEST(CountingAllocatorTest, MakeUniqueAllocatesOnce) {
+  struct Tag {};
+  ScopedStats<Tag> stats;
+  {
+    char* array;
+    auto owned = MakeUnique<Foo, char, int>(16, array, 42,
+                                            CountingAllocator<char, Tag>());
+    EXPECT_EQ(stats.Get().allocations, 1);
+    EXPECT_GE(stats.Get().allocated_bytes, sizeof(Foo) + 16);
+  }
+  EXPECT_EQ(stats.Get().live_allocations(), 0);
+  EXPECT_EQ(stats.Get().live_bytes(), 0);
+}
+
+TEST(CountingAllocatorTest, MakeSharedAllocatesOnce) {
+  struct Tag {};
+  ScopedStats<Tag> stats;
+  {
+    char* array;
+    auto shared = MakeShared<Foo, char, int>(16, array, 42,
+                                             CountingAllocator<char, Tag>());
+    EXPECT_EQ(stats.Get().allocations, 1);
+    EXPECT_GE(stats.Get().allocated_bytes, sizeof(Foo) + 16);
+  }
+  EXPECT_EQ(stats.Get().live_allocations(), 0);
+  EXPECT_EQ(stats.Get().live_bytes(), 0);
+}
+
+TEST(CountingAllocatorTest, MakeRefCountedAllocatesOnce) {
+  struct Tag {};
+  ScopedStats<Tag> stats;
+  {
+    char* array;
+    auto ref = MakeRefCounted<Foo, char, int>(16, array, 42,
+                                              CountingAllocator<char, Tag>());
+    EXPECT_EQ(ref->value_, 42);
+    Ref<const Foo, VarAllocator<char, CountingAllocator<char, Tag>, Foo>>
+        shared = std::move(ref).Share();
+    auto copy = shared;
+    EXPECT_EQ(stats.Get().allocations, 1);
+    EXPECT_GE(stats.Get().allocated_bytes, sizeof(Foo) + 16);
+  }
+  EXPECT_EQ(stats.Get().live_allocations(), 0);
+  EXPECT_EQ(stats.Get().live_bytes(), 0);
+}
+
+TEST(CountingAllocatorTest, RecordsSizeHistogramAndPeak) {
+  struct Tag {};
+  AllocationCounter<Tag>::ResetPeak();
+  CountingAllocator<char, Tag> allocator;
+  char* small = allocator.allocate(3);
+  char* large = allocator.allocate(1000);
+  allocator.deallocate(small, 3);
+  char* medium = allocator.allocate(100);
+  allocator.deallocate(medium, 100);
+  allocator.deallocate(large, 1000);
+
+  const AllocationStats stats = AllocationCounter<Tag>::Snapshot();
+  EXPECT_EQ(stats.allocations, 3);
+  EXPECT_EQ(stats.deallocations, 3);
+  EXPECT_EQ(stats.allocated_bytes, 1103);
+  EXPECT_EQ(stats.peak_live_bytes, 1100);
+  EXPECT_EQ(stats.size_histogram[AllocationStats::SizeBucket(3)], 1);
+  EXPECT_EQ(stats.size_histogram[AllocationStats::SizeBucket(100)], 1);
+  EXPECT_EQ(stats.size_histogram[AllocationStats::SizeBucket(1000)], 1);
+  EXPECT_EQ(AllocationStats::SizeBucket(0), 0);
+  EXPECT_EQ(AllocationStats::SizeBucket(1), 1);
+  EXPECT_EQ(AllocationStats::SizeBucket(2), 2);
+  EXPECT_EQ(AllocationStats::SizeBucket(3), 2);
+  EXPECT_EQ(AllocationStats::SizeBucket(4), 3);
+}
+
+TEST(CountingAllocatorTest, SumsCountsOfAllThreads) {
+  struct Tag {};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([] {
+      for (int j = 0; j < 10; j++) {
+        auto shared = std::allocate_shared<Foo>(CountingAllocator<Foo, Tag>(),
+                                                j);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const AllocationStats stats = AllocationCounter<Tag>::Snapshot();
+  EXPECT_EQ(stats.allocations, 40);
+  EXPECT_EQ(stats.live_allocations(), 0);
+}
+
+struct LateTag {};
+
+// Allocates in its destructor, after the thread released its shard.
+struct LateAllocation {
+  ~LateAllocation() {
+    auto shared =
+        std::allocate_shared<Foo>(CountingAllocator<Foo, LateTag>(), 1);
+  }
+};
+
+TEST(CountingAllocatorTest, CountsThreadLocalDestructors) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([] {
+      // Constructed before the shard is taken, so destroyed after it's
+      // released.
+      static thread_local LateAllocation late;
+      (void)late;
+      auto shared =
+          std::allocate_shared<Foo>(CountingAllocator<Foo, LateTag>(), 0);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const AllocationStats stats = AllocationCounter<LateTag>::Snapshot();
+  EXPECT_EQ(stats.allocations, 8);
+  EXPECT_EQ(stats.live_allocations(), 0);
+}
+
+}  // namespace
+}  // namespace refptr
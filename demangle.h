@@ -0,0 +1,45 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _DEMANGLE_H
+#define _DEMANGLE_H
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+namespace refptr {
+namespace internal {
+
+// Returns the demangled form of a `std::type_info::name()`, if possible.
+inline std::string Demangle(const char* name) {
+#if defined(__GNUG__)
+  int status = 0;
+  std::unique_ptr<char, void (*)(void*)> demangled(
+      abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free);
+  if (status == 0 && demangled != nullptr) {
+    return demangled.get();
+  }
+#endif
+  return name;
+}
+
+}  // namespace internal
+}  // namespace refptr
+
+#endif  // _DEMANGLE_H
@@ -0,0 +1,288 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _HEAP_SAMPLER_H
+#define _HEAP_SAMPLER_H
+
+// Sampling heap profiler of `Refcounted` blocks and `VarAllocator`
+// allocations, cheap enough to be enabled in production.
+//
+// Collected only if `REFPTR_HEAP_SAMPLING` is defined, for example by linking
+// the `ref_heap_sampling` CMake target. It must be defined consistently in all
+// translation units of a program.
+//
+// On average one allocation per `GetSamplingInterval()` allocated bytes is
+// sampled, recording its size and stack trace until it is deallocated. The
+// distances between samples are drawn from an exponential distribution, so
+// that the samples aren't biased by regular allocation patterns.
+// `TopSites` then estimates live bytes per allocation site from live samples.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/debugging/stacktrace.h"
+#include "absl/debugging/symbolize.h"
+
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+
+namespace refptr {
+
+// Live sampled allocations with the same stack trace.
+struct HeapSampleSite {
+  // Return addresses of the allocation site, innermost first.
+  std::vector<void*> stack;
+  int64_t live_samples = 0;
+  // The actual bytes of the live sampled allocations.
+  int64_t sampled_bytes = 0;
+  // The estimated live bytes of all allocations from this site.
+  int64_t estimated_live_bytes = 0;
+};
+
+class HeapSampler {
+ public:
+  static constexpr int64_t kDefaultSamplingInterval = int64_t{1} << 20;
+
+  // Sets the average number of bytes between samples. Zero disables sampling.
+  // Threads pick up the new value only after their next sample (or within
+  // `kDisabledRecheckBytes` if sampling was disabled).
+  static void SetSamplingInterval(int64_t bytes) {
+    GetState().interval.store(bytes, std::memory_order_relaxed);
+  }
+  static int64_t GetSamplingInterval() {
+    return GetState().interval.load(std::memory_order_relaxed);
+  }
+
+  // Returns up to `max_sites` allocation sites with live samples, largest
+  // estimated live bytes first.
+  static std::vector<HeapSampleSite> TopSites(size_t max_sites) {
+    State& state = GetState();
+    std::map<std::vector<void*>, HeapSampleSite> sites;
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      for (int i = 0; i < kSlots; i++) {
+        if (state.slots[i].load(std::memory_order_relaxed) == nullptr) {
+          continue;
+        }
+        const Sample& sample = state.samples[i];
+        std::vector<void*> stack(sample.stack, sample.stack + sample.depth);
+        HeapSampleSite& site = sites[stack];
+        site.live_samples++;
+        site.sampled_bytes += sample.bytes;
+        site.estimated_live_bytes += sample.weight;
+      }
+    }
+    std::vector<HeapSampleSite> result;
+    result.reserve(sites.size());
+    for (auto& site : sites) {
+      result.push_back(std::move(site.second));
+      result.back().stack = site.first;
+    }
+    std::sort(result.begin(), result.end(),
+              [](const HeapSampleSite& a, const HeapSampleSite& b) {
+                return a.estimated_live_bytes > b.estimated_live_bytes;
+              });
+    if (result.size() > max_sites) {
+      result.resize(max_sites);
+    }
+    return result;
+  }
+
+  // Writes `TopSites(max_sites)` to `out` in a human-readable form.
+  // Stack traces are symbolized only if `absl::InitializeSymbolizer` has been
+  // called.
+  static void DumpTopSites(std::ostream& out, size_t max_sites) {
+    for (const HeapSampleSite& site : TopSites(max_sites)) {
+      out << "estimated_live_bytes=" << site.estimated_live_bytes
+          << " live_samples=" << site.live_samples
+          << " sampled_bytes=" << site.sampled_bytes << "\n";
+      for (void* pc : site.stack) {
+        char symbol[1024];
+        out << "    " << pc << " "
+            << (absl::Symbolize(pc, symbol, sizeof(symbol)) ? symbol : "?")
+            << "\n";
+      }
+    }
+  }
+
+  // The number of samples dropped because of too many live samples in the
+  // internal table.
+  static int64_t DroppedSamples() {
+    return GetState().dropped.load(std::memory_order_relaxed);
+  }
+
+  // Called after `bytes` have been allocated at `ptr`.
+  static void OnAllocate(const void* ptr, size_t bytes) {
+    ThreadState& thread = GetThreadState();
+    thread.bytes_until_sample -= static_cast<int64_t>(bytes);
+    if (ABSL_PREDICT_FALSE(thread.bytes_until_sample < 0)) {
+      SampleAllocation(thread, ptr, bytes);
+    }
+  }
+
+  // Called before memory at `ptr` is deallocated.
+  static void OnDeallocate(const void* ptr) {
+    State& state = GetState();
+    if (ABSL_PREDICT_TRUE(state.live.load(std::memory_order_relaxed) == 0)) {
+      return;
+    }
+    std::atomic<const void*>* group = state.slots + Group(ptr);
+    for (int i = 0; i < kGroupSize; i++) {
+      // Relaxed is sufficient: Either this thread sampled `ptr`, or ownership
+      // of `ptr` has been passed to it with proper synchronization.
+      if (group[i].load(std::memory_order_relaxed) == ptr) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        group[i].store(nullptr, std::memory_order_relaxed);
+        state.live.fetch_sub(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  // If sampling is disabled, threads check again after this many bytes.
+  static constexpr int64_t kDisabledRecheckBytes = int64_t{1} << 20;
+
+ private:
+  static constexpr int kMaxDepth = 32;
+  // Live samples are kept in an open-addressed table of groups of slots, each
+  // group occupying a single cache line.
+  static constexpr int kGroupSize = 8;
+  static constexpr int kSlots = 4096;
+
+  struct Sample {
+    size_t bytes;
+    int64_t weight;
+    int depth;
+    void* stack[kMaxDepth];
+  };
+
+  struct State {
+    std::atomic<int64_t> interval{kDefaultSamplingInterval};
+    // The number of non-null `slots`.
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> dropped{0};
+    // Guards modifications of `slots` and `samples`.
+    std::mutex mutex;
+    // Sampled pointers, allowing a lock-free check in `OnDeallocate`.
+    alignas(64) std::atomic<const void*> slots[kSlots] = {};
+    Sample samples[kSlots];
+  };
+
+  struct ThreadState {
+    int64_t bytes_until_sample = 0;
+    bool initialized = false;
+    uint64_t random = 0;
+  };
+
+  static State& GetState() {
+    // Never destroyed, so that it's usable during the whole program shutdown.
+    static State* const state = new State();
+    return *state;
+  }
+
+  static ThreadState& GetThreadState() {
+    static thread_local ThreadState thread;
+    return thread;
+  }
+
+  static size_t Group(const void* ptr) {
+    const uint64_t hash =
+        (reinterpret_cast<uintptr_t>(ptr) >> 4) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(hash >> 40) % (kSlots / kGroupSize) *
+           kGroupSize;
+  }
+
+  // Captures the stack trace of the caller of `SampleAllocation`.
+  ABSL_ATTRIBUTE_NOINLINE static int CaptureStack(void** stack) {
+#if defined(__GLIBC__)
+    // Unlike `absl::GetStackTrace` doesn't require frame pointers.
+    void* frames[kMaxDepth + 2];
+    const int depth = backtrace(frames, kMaxDepth + 2);
+    // Skip this function and `SampleAllocation`.
+    const int skip = depth < 2 ? depth : 2;
+    std::copy(frames + skip, frames + depth, stack);
+    return depth - skip;
+#else
+    return absl::GetStackTrace(stack, kMaxDepth, /*skip_count=*/2);
+#endif
+  }
+
+  // Draws from the exponential distribution with mean `interval`.
+  static int64_t NextInterval(ThreadState& thread, int64_t interval) {
+    // xorshift64*, seeded from the thread-local address.
+    if (thread.random == 0) {
+      thread.random = reinterpret_cast<uintptr_t>(&thread) | 1;
+    }
+    thread.random ^= thread.random >> 12;
+    thread.random ^= thread.random << 25;
+    thread.random ^= thread.random >> 27;
+    const uint64_t bits = (thread.random * 0x2545F4914F6CDD1Dull) >> 11;
+    // Uniform in (0, 1].
+    const double uniform = (bits + 1) * (1.0 / (uint64_t{1} << 53));
+    return static_cast<int64_t>(-std::log(uniform) * interval);
+  }
+
+  ABSL_ATTRIBUTE_NOINLINE static void SampleAllocation(ThreadState& thread,
+                                                       const void* ptr,
+                                                       size_t bytes) {
+    State& state = GetState();
+    const int64_t interval = state.interval.load(std::memory_order_relaxed);
+    if (interval <= 0) {
+      thread.bytes_until_sample = kDisabledRecheckBytes;
+      return;
+    }
+    thread.bytes_until_sample = NextInterval(thread, interval);
+    if (!thread.initialized) {
+      // Don't sample the very first allocation of each thread.
+      thread.initialized = true;
+      return;
+    }
+    Sample sample;
+    sample.bytes = bytes;
+    // The expected number of bytes this sample represents, see
+    // https://github.com/google/tcmalloc/blob/master/docs/sampling.md.
+    sample.weight =
+        bytes == 0 ? interval
+                   : static_cast<int64_t>(
+                         bytes / -std::expm1(-static_cast<double>(bytes) /
+                                             interval));
+    sample.depth = CaptureStack(sample.stack);
+
+    std::atomic<const void*>* group = state.slots + Group(ptr);
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (int i = 0; i < kGroupSize; i++) {
+      if (group[i].load(std::memory_order_relaxed) == nullptr) {
+        state.samples[(group - state.slots) + i] = sample;
+        group[i].store(ptr, std::memory_order_relaxed);
+        state.live.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+    state.dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+}  // namespace refptr
+
+#endif  // _HEAP_SAMPLER_H
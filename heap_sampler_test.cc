@@ -0,0 +1,84 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "heap_sampler.h"
+
+#include <sstream>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "ref.h"
+#include "var_sized.h"
+
+#ifndef REFPTR_HEAP_SAMPLING
+#error "This test must be compiled with REFPTR_HEAP_SAMPLING defined"
+#endif
+
+namespace refptr {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::IsEmpty;
+using ::testing::Not;
+using ::testing::SizeIs;
+
+struct Foo {
+  explicit Foo(int value) : value_(value) {}
+
+  int value_;
+};
+
+TEST(HeapSamplerTest, SamplesLiveAllocationsBySite) {
+  // Threads pick up a new interval only after their next sample, so this must
+  // happen before this thread allocates anything.
+  HeapSampler::SetSamplingInterval(1);
+  // The first allocation of a thread is never sampled.
+  New<Foo>(0);
+
+  std::vector<Ref<Foo>> refs;
+  for (int i = 0; i < 10; i++) {
+    refs.push_back(New<Foo>(i));
+  }
+  {
+    char* array;
+    auto var_sized = MakeRefCounted<Foo, char, int>(1000, array, 42);
+    EXPECT_EQ(HeapSampler::DroppedSamples(), 0);
+
+    // Ordered by estimated live bytes, the var-sized block is the largest.
+    auto sites = HeapSampler::TopSites(10);
+    ASSERT_THAT(sites, SizeIs(2));
+    // The var-sized block is counted only once even though it's allocated
+    // both by `Refcounted` and `VarAllocator`.
+    EXPECT_EQ(sites[0].live_samples, 1);
+    EXPECT_GE(sites[0].sampled_bytes, sizeof(Foo) + 1000);
+    EXPECT_THAT(sites[0].stack, Not(IsEmpty()));
+    EXPECT_EQ(sites[1].live_samples, 10);
+    EXPECT_EQ(sites[1].sampled_bytes,
+              10 * sizeof(Refcounted<Foo, std::allocator<Foo>>));
+    EXPECT_GE(sites[1].estimated_live_bytes, sites[1].sampled_bytes);
+
+    std::ostringstream dump;
+    HeapSampler::DumpTopSites(dump, 1);
+    EXPECT_THAT(dump.str(), HasSubstr("live_samples=1 "));
+
+    refs.clear();
+    EXPECT_THAT(HeapSampler::TopSites(10), SizeIs(1));
+  }
+  EXPECT_THAT(HeapSampler::TopSites(10), IsEmpty());
+  HeapSampler::SetSamplingInterval(HeapSampler::kDefaultSamplingInterval);
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,90 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the cost of heap sampling on allocation-heavy code. Built twice,
+// as `heap_sampling_off_benchmark` and `heap_sampling_on_benchmark` with
+// `REFPTR_HEAP_SAMPLING` at the default interval, so that the two can be
+// compared benchmark by benchmark. Each step replaces the oldest of a window
+// of live blocks by a new one.
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+constexpr size_t kWindow = 256;
+
+struct Msg {
+  explicit Msg(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+const char* Label() {
+#ifdef REFPTR_HEAP_SAMPLING
+  return "sampled";
+#else
+  return "not sampled";
+#endif
+}
+
+// Argument: The length of the payload in bytes. Sampled by `VarAllocator`.
+void BM_MakeRefCountedChurn(benchmark::State& state) {
+  using MsgRef = Ref<const Msg, VarAllocator<char, std::allocator<Msg>, Msg>>;
+  const size_t length = static_cast<size_t>(state.range(0));
+  auto make = [length]() {
+    char* array;
+    auto msg =
+        MakeRefCounted<Msg, char, size_t>(length, array, size_t{length});
+    std::memset(array, 0, length < 64 ? length : 64);
+    return MsgRef(std::move(msg));
+  };
+  std::vector<MsgRef> window;
+  for (size_t i = 0; i < kWindow; i++) {
+    window.push_back(make());
+  }
+  size_t oldest = 0;
+  for (auto _ : state) {
+    window[oldest] = make();
+    oldest = (oldest + 1) % kWindow;
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetLabel(Label());
+}
+BENCHMARK(BM_MakeRefCountedChurn)->RangeMultiplier(16)->Range(16, 4096);
+
+// Fixed-size blocks, sampled by `RefcountedHooks`.
+void BM_NewChurn(benchmark::State& state) {
+  std::vector<Ref<const Msg>> window;
+  for (size_t i = 0; i < kWindow; i++) {
+    window.push_back(New<Msg>(i).Share());
+  }
+  size_t oldest = 0;
+  for (auto _ : state) {
+    window[oldest] = New<Msg>(oldest).Share();
+    oldest = (oldest + 1) % kWindow;
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetLabel(Label());
+}
+BENCHMARK(BM_NewChurn);
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,101 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _HUGE_PAGE_ALLOCATOR_H
+#define _HUGE_PAGE_ALLOCATOR_H
+
+// Slab allocator backed by 2 MiB transparent huge pages, for large
+// populations of small blocks that are traversed by following pointers, where
+// TLB misses of 4 KiB pages would dominate.
+
+#include <cstddef>
+#include <memory>
+
+#include "slab_arena.h"
+#include "thread_shards.h"
+
+namespace refptr {
+
+namespace internal {
+
+#if defined(__linux__)
+struct HugePageShard {
+  SlabArena arena{/*node=*/-1, /*huge_pages=*/true};
+};
+#endif  // defined(__linux__)
+
+}  // namespace internal
+
+// Allocates blocks of up to 64 KiB in size classes from 2 MiB slabs, for
+// which the kernel is advised to use transparent huge pages (`madvise` with
+// `MADV_HUGEPAGE`). Each thread allocates from its own `SlabArena`, so
+// allocation doesn't contend, and blocks of similar size allocated by a
+// thread are kept close together. Blocks can be deallocated by any thread.
+// Larger blocks are mapped individually. Memory of small blocks is never
+// returned to the system.
+//
+// Can be used as `Alloc` of `Refcounted` and `VarAllocator`, for example with
+// `MakeRefCounted`. Whether huge pages are actually used depends on
+// /sys/kernel/mm/transparent_hugepage/enabled being `always` or `madvise`.
+// Other platforms than Linux just use `std::allocator`.
+template <typename T>
+class HugePageAllocator {
+ public:
+  using value_type = T;
+
+  HugePageAllocator() = default;
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+#if defined(__linux__)
+    return static_cast<T*>(
+        internal::ThreadShards<internal::HugePageShard>::Local()
+            .arena.Allocate(n * sizeof(T), alignof(T)));
+#else
+    return std::allocator<T>().allocate(n);
+#endif
+  }
+
+  void deallocate(T* ptr, size_t n) {
+#if defined(__linux__)
+    internal::SlabArena::Deallocate(ptr, n * sizeof(T), alignof(T));
+#else
+    std::allocator<T>().deallocate(ptr, n);
+#endif
+  }
+
+  // Returns the number of bytes used by `allocate(n)`, including rounding up
+  // to its size class.
+  size_t AllocatedBytes(size_t n) const {
+#if defined(__linux__)
+    return internal::SlabArena::AllocatedBytes(n * sizeof(T), alignof(T));
+#else
+    return n * sizeof(T);
+#endif
+  }
+
+  template <typename U>
+  bool operator==(const HugePageAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const HugePageAllocator<U>&) const {
+    return false;
+  }
+};
+
+}  // namespace refptr
+
+#endif  // _HUGE_PAGE_ALLOCATOR_H
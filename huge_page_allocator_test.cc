@@ -0,0 +1,178 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "huge_page_allocator.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct alignas(64) CacheLine {
+  explicit CacheLine(int value_) : value(value_) {}
+
+  int value;
+};
+
+TEST(HugePageAllocatorTest, RoundsUpToSizeClasses) {
+  HugePageAllocator<char> allocator;
+  EXPECT_EQ(allocator.AllocatedBytes(1), 16);
+  EXPECT_EQ(allocator.AllocatedBytes(17), 32);
+  EXPECT_EQ(allocator.AllocatedBytes(33), 48);
+  EXPECT_EQ(allocator.AllocatedBytes(49), 64);
+  EXPECT_EQ(allocator.AllocatedBytes(65), 96);
+  EXPECT_EQ(allocator.AllocatedBytes(1000), 1024);
+  EXPECT_EQ(allocator.AllocatedBytes(1025), 1536);
+  EXPECT_EQ(allocator.AllocatedBytes(65536), 65536);
+  EXPECT_EQ(allocator.AllocatedBytes(65537), 65536 + 4096);
+  EXPECT_EQ(HugePageAllocator<CacheLine>().AllocatedBytes(3), 256);
+}
+
+TEST(HugePageAllocatorTest, AllocatesDistinctAlignedBlocks) {
+  HugePageAllocator<char> allocator;
+  HugePageAllocator<CacheLine> aligned_allocator;
+  std::set<const void*> distinct;
+  std::vector<std::pair<char*, size_t>> blocks;
+  std::vector<std::pair<CacheLine*, size_t>> aligned_blocks;
+  for (size_t n = 1; n <= (size_t{1} << 18); n = n * 3 + 1) {
+    for (int i = 0; i < 10; i++) {
+      char* block = allocator.allocate(n);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % 16, 0) << n;
+      std::memset(block, i, n);
+      EXPECT_TRUE(distinct.insert(block).second);
+      blocks.emplace_back(block, n);
+
+      CacheLine* line = aligned_allocator.allocate(n % 100 + 1);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(line) % 64, 0) << n;
+      EXPECT_TRUE(distinct.insert(line).second);
+      aligned_blocks.emplace_back(line, n % 100 + 1);
+    }
+  }
+  for (const auto& block : blocks) {
+    allocator.deallocate(block.first, block.second);
+  }
+  for (const auto& block : aligned_blocks) {
+    aligned_allocator.deallocate(block.first, block.second);
+  }
+}
+
+struct alignas(16384) OverPage {
+  char bytes[16384];
+};
+
+TEST(HugePageAllocatorTest, AlignsLargeBlocksBeyondPages) {
+  HugePageAllocator<OverPage> allocator;
+  std::vector<OverPage*> blocks;
+  for (int i = 0; i < 10; i++) {
+    // Larger than the biggest size class, so mapped individually.
+    OverPage* block = allocator.allocate(5);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % alignof(OverPage), 0);
+    std::memset(block, i, 5 * sizeof(OverPage));
+    blocks.push_back(block);
+  }
+  for (OverPage* block : blocks) {
+    allocator.deallocate(block, 5);
+  }
+}
+
+TEST(HugePageAllocatorTest, DeallocatesOnOtherThreads) {
+  std::vector<int64_t*> blocks;
+  std::thread producer([&] {
+    HugePageAllocator<int64_t> allocator;
+    for (int i = 0; i < 10000; i++) {
+      blocks.push_back(allocator.allocate(1 + i % 10));
+    }
+  });
+  producer.join();
+  HugePageAllocator<int64_t> allocator;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    allocator.deallocate(blocks[i], 1 + i % 10);
+  }
+}
+
+TEST(HugePageAllocatorTest, RefcountedAndVarSized) {
+  Ref<CacheLine, HugePageAllocator<CacheLine>> line(
+      Refcounted<CacheLine, HugePageAllocator<CacheLine>>::New({}, 42));
+  EXPECT_EQ(line->value, 42);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(&*line) % 64, 0);
+
+  char* array;
+  auto var_sized = MakeRefCounted<CacheLine, char, int>(
+      100, array, 7, HugePageAllocator<CacheLine>());
+  std::memset(array, 'x', 100);
+  EXPECT_EQ(var_sized->value, 7);
+}
+
+// Returns the `AnonHugePages` of the mapping containing `ptr`, in KiB, or -1
+// if unknown.
+int64_t AnonHugePagesKiB(const void* ptr) {
+  std::ifstream smaps("/proc/self/smaps");
+  const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+  bool in_mapping = false;
+  std::string line;
+  while (std::getline(smaps, line)) {
+    unsigned long long begin, end;
+    if (std::sscanf(line.c_str(), "%llx-%llx ", &begin, &end) == 2) {
+      in_mapping = begin <= address && address < end;
+    } else if (in_mapping && line.rfind("AnonHugePages:", 0) == 0) {
+      std::istringstream fields(line.substr(14));
+      int64_t kib = -1;
+      fields >> kib;
+      return kib;
+    }
+  }
+  return -1;
+}
+
+TEST(HugePageAllocatorTest, UsesHugePagesIfEnabled) {
+  std::ifstream enabled("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string modes;
+  std::getline(enabled, modes);
+  if (modes.find("[always]") == std::string::npos &&
+      modes.find("[madvise]") == std::string::npos) {
+    GTEST_SKIP() << "Transparent huge pages disabled: " << modes;
+  }
+  HugePageAllocator<char> allocator;
+  // A whole slab of a dedicated size class.
+  const size_t kBlock = 3 << 12;
+  std::vector<char*> blocks;
+  for (int i = 0; i < 200; i++) {
+    blocks.push_back(allocator.allocate(kBlock));
+    std::memset(blocks.back(), 1, kBlock);
+  }
+  const int64_t huge_kib = AnonHugePagesKiB(blocks[100]);
+  for (char* block : blocks) {
+    allocator.deallocate(block, kBlock);
+  }
+  if (huge_kib <= 0) {
+    GTEST_SKIP() << "No huge page was available";
+  }
+  EXPECT_GE(huge_kib, 2048);
+}
+
+}  // namespace
+}  // namespace refptr
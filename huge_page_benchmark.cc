@@ -0,0 +1,87 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Pointer chasing through many small `Refcounted` blocks allocated by
+// `std::allocator` and `HugePageAllocator`. The blocks are linked in a random
+// cycle, so that every step likely misses the TLB for working sets beyond
+// what its entries cover with 4 KiB pages.
+//
+// Run with `REFPTR_PERF_COUNTERS=1` to report `dTLB_misses` per step.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "benchmark_counters.h"
+#include "huge_page_allocator.h"
+#include "ref.h"
+
+namespace refptr {
+namespace {
+
+struct Node {
+  explicit Node(int64_t value_) : value(value_) {}
+
+  const Node* next = nullptr;
+  int64_t value;
+};
+
+// Argument: The number of nodes.
+template <template <typename> class Alloc>
+void BM_PointerChase(benchmark::State& state) {
+  using NodeRef = Ref<Node, Alloc<Node>>;
+  const size_t nodes = static_cast<size_t>(state.range(0));
+  std::vector<NodeRef> owned;
+  owned.reserve(nodes);
+  for (size_t i = 0; i < nodes; i++) {
+    owned.emplace_back(Refcounted<Node, Alloc<Node>>::New(
+        Alloc<Node>(), static_cast<int64_t>(i)));
+  }
+  std::vector<size_t> order(nodes);
+  for (size_t i = 0; i < nodes; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+  for (size_t i = 0; i < nodes; i++) {
+    owned[order[i]]->next = &*owned[order[(i + 1) % nodes]];
+  }
+
+  const Node* node = &*owned[0];
+  int64_t sum = 0;
+  {
+    ScopedPerfCounters perf(state, static_cast<int64_t>(nodes));
+    for (auto _ : state) {
+      for (size_t i = 0; i < nodes; i++) {
+        sum += node->value;
+        node = node->next;
+      }
+    }
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * nodes);
+}
+BENCHMARK_TEMPLATE(BM_PointerChase, std::allocator)
+    ->RangeMultiplier(8)
+    ->Range(1 << 12, 1 << 21);
+BENCHMARK_TEMPLATE(BM_PointerChase, HugePageAllocator)
+    ->RangeMultiplier(8)
+    ->Range(1 << 12, 1 << 21);
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,160 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks reporting the latency distribution of individual operations,
+// rather than just their mean, to expose the tail latency of allocator slow
+// paths and of destroying large structures.
+//
+// Every operation is timed separately and recorded into a `LatencyHistogram`,
+// whose percentiles are reported as counters `p50`, `p99`, `p999` and `max`
+// in nanoseconds. These include the overhead of reading the clock twice.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "absl/types/variant.h"
+#include "absl/utility/utility.h"
+#include "benchmark/benchmark.h"
+#include "benchmark_counters.h"
+#include "copy_on_write.h"
+#include "latency_histogram.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int64_t NanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+
+// Header of a var-sized block with a `char` array of `length`.
+struct Header {
+  explicit Header(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+// A node of a tree, all of whose nodes are destroyed recursively together
+// with its root.
+struct Node {
+  std::vector<refptr::Ref<const Node>> children;
+};
+
+// Builds a tree of `size` nodes, each with at most 4 children.
+refptr::Ref<const Node> BuildTree(int64_t size) {
+  refptr::Ref<Node> node = refptr::New<Node>();
+  int64_t remaining = size - 1;
+  for (int i = 4; i > 0 && remaining > 0; i--) {
+    const int64_t child_size = (remaining + i - 1) / i;
+    node->children.push_back(BuildTree(child_size));
+    remaining -= child_size;
+  }
+  return std::move(node).Share();
+}
+
+}  // namespace
+
+// Creation and destruction of a var-sized block with an array of
+// `state.range(0)` bytes.
+static void BM_MakeRefCountedLatency(benchmark::State& state) {
+  const size_t length = state.range(0);
+  refptr::LatencyHistogram create;
+  refptr::LatencyHistogram destroy;
+  for (auto _ : state) {
+    char* array;
+    Clock::time_point start = Clock::now();
+    auto ref = refptr::MakeRefCounted<Header, char, size_t>(length, array,
+                                                             size_t{length});
+    create.Record(NanosSince(start));
+    memset(array, 0, length);
+    benchmark::DoNotOptimize(array);
+    start = Clock::now();
+    {
+      auto dying = std::move(ref);
+    }
+    destroy.Record(NanosSince(start));
+  }
+  refptr::ReportLatencyCounters(state, create);
+  refptr::ReportLatencyCounters(state, destroy, "destroy_");
+}
+BENCHMARK(BM_MakeRefCountedLatency)->RangeMultiplier(16)->Range(16, 1 << 16);
+
+// Conversion of a var-sized `Ref<T>` to `Ref<const T>` and back.
+static void BM_ShareAttemptToClaimLatency(benchmark::State& state) {
+  const size_t length = state.range(0);
+  refptr::LatencyHistogram share;
+  refptr::LatencyHistogram claim;
+  char* array;
+  auto ref =
+      refptr::MakeRefCounted<Header, char, size_t>(length, array,
+                                                   size_t{length});
+  for (auto _ : state) {
+    Clock::time_point start = Clock::now();
+    auto shared = std::move(ref).Share();
+    share.Record(NanosSince(start));
+    start = Clock::now();
+    ref = absl::get<0>(std::move(shared).AttemptToClaim());
+    claim.Record(NanosSince(start));
+    benchmark::DoNotOptimize(ref->length);
+  }
+  refptr::ReportLatencyCounters(state, share);
+  refptr::ReportLatencyCounters(state, claim, "claim_");
+}
+BENCHMARK(BM_ShareAttemptToClaimLatency)
+    ->RangeMultiplier(16)
+    ->Range(16, 1 << 16);
+
+// `AsMutable` of a shared `CopyOnWrite`, which copies a string of
+// `state.range(0)` bytes.
+static void BM_CopyOnWriteAsMutableLatency(benchmark::State& state) {
+  const size_t length = state.range(0);
+  refptr::LatencyHistogram histogram;
+  const refptr::CopyOnWrite<std::string> original(absl::in_place, length, 'x');
+  for (auto _ : state) {
+    refptr::CopyOnWrite<std::string> copy = original;
+    const Clock::time_point start = Clock::now();
+    copy.AsMutable()[0] = 'y';
+    histogram.Record(NanosSince(start));
+    benchmark::DoNotOptimize(copy->data());
+  }
+  refptr::ReportLatencyCounters(state, histogram);
+}
+BENCHMARK(BM_CopyOnWriteAsMutableLatency)
+    ->RangeMultiplier(16)
+    ->Range(16, 1 << 16);
+
+// Destruction of a tree of `state.range(0)` nodes by releasing its root.
+static void BM_NestedTeardownLatency(benchmark::State& state) {
+  refptr::LatencyHistogram histogram;
+  for (auto _ : state) {
+    state.PauseTiming();
+    absl::optional<refptr::Ref<const Node>> root(BuildTree(state.range(0)));
+    state.ResumeTiming();
+    const Clock::time_point start = Clock::now();
+    root.reset();
+    histogram.Record(NanosSince(start));
+  }
+  refptr::ReportLatencyCounters(state, histogram);
+}
+BENCHMARK(BM_NestedTeardownLatency)->RangeMultiplier(16)->Range(16, 1 << 16);
@@ -0,0 +1,116 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _LATENCY_HISTOGRAM_H
+#define _LATENCY_HISTOGRAM_H
+
+// Histogram of non-negative values, such as latencies in nanoseconds, with
+// a bounded relative error in the style of https://hdrhistogram.github.io/.
+// Allows computing tail percentiles without keeping all the values:
+//
+//     LatencyHistogram histogram;
+//     for (...) {
+//       histogram.Record(latency_ns);
+//     }
+//     int64_t p99 = histogram.Percentile(99);
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "absl/numeric/bits.h"
+
+namespace refptr {
+
+class LatencyHistogram {
+ public:
+  // Each power of two is split into this many equally sized buckets, so the
+  // relative error of reported values is at most 1 / kSubBuckets.
+  static constexpr int kSubBuckets = 32;
+
+  LatencyHistogram() : counts_(BucketIndex(INT64_MAX) + 1, 0) {}
+
+  // Negative values are recorded as zero.
+  void Record(int64_t value) {
+    value = std::max<int64_t>(value, 0);
+    counts_[BucketIndex(value)]++;
+    count_++;
+    max_ = std::max(max_, value);
+  }
+
+  void Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < counts_.size(); i++) {
+      counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  int64_t count() const { return count_; }
+  int64_t max() const { return max_; }
+
+  // Returns the smallest value such that at least `percent` % of the recorded
+  // values are lower or equal to it, up to the relative error of the buckets.
+  // Returns 0 if the histogram is empty.
+  int64_t Percentile(double percent) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    // The epsilon avoids rounding up for example 99.9% of 1000 due to the
+    // inexact representation of 99.9.
+    const int64_t rank = std::max<int64_t>(
+        1, static_cast<int64_t>(std::ceil(percent * count_ / 100 - 1e-9)));
+    int64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(BucketUpperBound(i), max_);
+      }
+    }
+    return max_;
+  }
+
+  // Values below `2 * kSubBuckets` have their own buckets. Larger values `v`
+  // are bucketed by their highest `log2(kSubBuckets) + 1` bits.
+  static size_t BucketIndex(int64_t value) {
+    const int shift = std::max(
+        0, static_cast<int>(absl::bit_width(static_cast<uint64_t>(value))) -
+               kSubBucketBits - 1);
+    return static_cast<size_t>(shift) * kSubBuckets +
+           static_cast<size_t>(value >> shift);
+  }
+
+  // The largest value in bucket `index`.
+  static int64_t BucketUpperBound(size_t index) {
+    if (index < 2 * kSubBuckets) {
+      return static_cast<int64_t>(index);
+    }
+    const int shift = static_cast<int>(index / kSubBuckets) - 1;
+    const uint64_t mantissa = index - static_cast<size_t>(shift) * kSubBuckets;
+    return static_cast<int64_t>(((mantissa + 1) << shift) - 1);
+  }
+
+ private:
+  static constexpr int kSubBucketBits = 5;
+  static_assert(kSubBuckets == 1 << kSubBucketBits, "Must be a power of two");
+
+  std::vector<int64_t> counts_;
+  int64_t count_ = 0;
+  int64_t max_ = 0;
+};
+
+}  // namespace refptr
+
+#endif  // _LATENCY_HISTOGRAM_H
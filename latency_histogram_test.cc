@@ -0,0 +1,83 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "latency_histogram.h"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+namespace refptr {
+namespace {
+
+TEST(LatencyHistogramTest, EmptyHistogram) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.max(), 0);
+  EXPECT_EQ(histogram.Percentile(50), 0);
+}
+
+TEST(LatencyHistogramTest, SmallValuesAreExact) {
+  LatencyHistogram histogram;
+  for (int64_t i = 1; i <= 50; i++) {
+    histogram.Record(i);
+  }
+  EXPECT_EQ(histogram.count(), 50);
+  EXPECT_EQ(histogram.Percentile(50), 25);
+  EXPECT_EQ(histogram.Percentile(100), 50);
+  EXPECT_EQ(histogram.max(), 50);
+}
+
+TEST(LatencyHistogramTest, TailPercentilesWithinRelativeError) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 990; i++) {
+    histogram.Record(1000);
+  }
+  for (int i = 0; i < 9; i++) {
+    histogram.Record(100000);
+  }
+  histogram.Record(12345678);
+  const double error = 1.0 / LatencyHistogram::kSubBuckets;
+  EXPECT_NEAR(histogram.Percentile(50), 1000, 1000 * error);
+  EXPECT_NEAR(histogram.Percentile(99), 1000, 1000 * error);
+  EXPECT_NEAR(histogram.Percentile(99.9), 100000, 100000 * error);
+  EXPECT_EQ(histogram.Percentile(100), 12345678);
+  EXPECT_EQ(histogram.max(), 12345678);
+}
+
+TEST(LatencyHistogramTest, BucketsAreContiguous) {
+  for (size_t i = 0; i < LatencyHistogram::BucketIndex(INT64_MAX); i++) {
+    const int64_t upper = LatencyHistogram::BucketUpperBound(i);
+    ASSERT_EQ(LatencyHistogram::BucketIndex(upper), i);
+    ASSERT_EQ(LatencyHistogram::BucketIndex(upper + 1), i + 1);
+  }
+  EXPECT_EQ(LatencyHistogram::BucketUpperBound(
+                LatencyHistogram::BucketIndex(INT64_MAX)),
+            INT64_MAX);
+}
+
+TEST(LatencyHistogramTest, Merge) {
+  LatencyHistogram a;
+  LatencyHistogram b;
+  a.Record(10);
+  b.Record(20);
+  b.Record(30);
+  a.Merge(b);
+  EXPECT_EQ(a.count(), 3);
+  EXPECT_EQ(a.max(), 30);
+  EXPECT_EQ(a.Percentile(50), 20);
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,182 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _NUMA_ALLOCATOR_H
+#define _NUMA_ALLOCATOR_H
+
+// Allocator that places memory on a given NUMA node, or on the node of the
+// calling thread, so that blocks read and reference-counted mostly by threads
+// of one node don't incur cross-node traffic.
+//
+// Uses the `mbind` and `get_mempolicy` system calls directly, so it doesn't
+// depend on libnuma. On machines with a single node, on other platforms and if
+// the calls fail, memory is allocated the same way, just without binding it.
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "absl/numeric/bits.h"
+#include "slab_arena.h"
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace refptr {
+
+// Nodes are identified by indices 0 to `kMaxNumaNodes - 1`.
+constexpr int kMaxNumaNodes = 64;
+
+// Returns the number of NUMA nodes the process can allocate memory on, at
+// least 1.
+inline int NumaNodeCount() {
+#if defined(__linux__)
+  static const int count = [] {
+    uint64_t mask = 0;
+    if (syscall(SYS_get_mempolicy, nullptr, &mask, kMaxNumaNodes + 1, nullptr,
+                MPOL_F_MEMS_ALLOWED) != 0 ||
+        mask == 0) {
+      return 1;
+    }
+    return kMaxNumaNodes - absl::countl_zero(mask);
+  }();
+  return count;
+#else
+  return 1;
+#endif
+}
+
+// Returns the node of the CPU the calling thread currently runs on, or 0 if
+// unknown. The thread can be migrated to another node at any time.
+inline int CurrentNumaNode() {
+#if defined(__linux__)
+  unsigned cpu = 0;
+  unsigned node = 0;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 29)
+  // Uses the vDSO, if available, avoiding a system call.
+  const int result = getcpu(&cpu, &node);
+#else
+  const int result =
+      static_cast<int>(syscall(SYS_getcpu, &cpu, &node, nullptr));
+#endif
+  if (result == 0 && node < static_cast<unsigned>(kMaxNumaNodes)) {
+    return static_cast<int>(node);
+  }
+#endif
+  return 0;
+}
+
+// Returns the node of the page containing `ptr`, faulting it in if needed, or
+// -1 if unknown.
+inline int NumaNodeOf(const void* ptr) {
+#if defined(__linux__)
+  int node = -1;
+  if (syscall(SYS_get_mempolicy, &node, nullptr, 0, ptr,
+              MPOL_F_NODE | MPOL_F_ADDR) == 0) {
+    return node;
+  }
+#else
+  (void)ptr;
+#endif
+  return -1;
+}
+
+namespace internal {
+
+#if defined(__linux__)
+// Returns the arena of memory placed on `node`.
+inline SlabArena& NumaNodeArena(int node) {
+  static std::atomic<SlabArena*> arenas[kMaxNumaNodes] = {};
+  SlabArena* arena = arenas[node].load(std::memory_order_acquire);
+  if (arena == nullptr) {
+    // Never destroyed, as blocks can outlive any static object.
+    SlabArena* created = new SlabArena(node, /*huge_pages=*/false);
+    if (arenas[node].compare_exchange_strong(arena, created,
+                                             std::memory_order_acq_rel)) {
+      arena = created;
+    } else {
+      delete created;
+    }
+  }
+  return *arena;
+}
+#endif  // defined(__linux__)
+
+}  // namespace internal
+
+// Allocates memory on NUMA node `node()`, or on the node of the calling thread
+// if it's `kLocalNode`. Can be used as `Alloc` of `Refcounted` and
+// `VarAllocator`, for example with `MakeRefCounted`.
+//
+// Memory of blocks up to 64 KiB is kept in per-node `SlabArena`s after
+// deallocation, and can be deallocated by any instance, on any thread. Other
+// platforms than Linux just use `std::allocator`.
+template <typename T>
+class NumaAllocator {
+ public:
+  using value_type = T;
+
+  static constexpr int kLocalNode = -1;
+
+  // `node` must be `kLocalNode` or in [0, kMaxNumaNodes). Nodes that don't
+  // exist are accepted, but memory isn't bound to them.
+  explicit NumaAllocator(int node = kLocalNode) : node_(node) {
+    assert(node == kLocalNode || (node >= 0 && node < kMaxNumaNodes));
+  }
+
+  template <typename U>
+  NumaAllocator(const NumaAllocator<U>& other) : node_(other.node()) {}
+
+  int node() const { return node_; }
+
+  T* allocate(size_t n) {
+#if defined(__linux__)
+    const int node = node_ == kLocalNode ? CurrentNumaNode() : node_;
+    return static_cast<T*>(internal::NumaNodeArena(node).Allocate(
+        n * sizeof(T), alignof(T)));
+#else
+    return std::allocator<T>().allocate(n);
+#endif
+  }
+
+  void deallocate(T* ptr, size_t n) {
+#if defined(__linux__)
+    internal::SlabArena::Deallocate(ptr, n * sizeof(T), alignof(T));
+#else
+    std::allocator<T>().deallocate(ptr, n);
+#endif
+  }
+
+  template <typename U>
+  bool operator==(const NumaAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const NumaAllocator<U>&) const {
+    return false;
+  }
+
+ private:
+  int node_;
+};
+
+}  // namespace refptr
+
+#endif  // _NUMA_ALLOCATOR_H
@@ -0,0 +1,128 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "numa_allocator.h"
+
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct Header {
+  explicit Header(int64_t value_) : value(value_) {}
+
+  int64_t value;
+};
+
+TEST(NumaAllocatorTest, Topology) {
+  EXPECT_GE(NumaNodeCount(), 1);
+  EXPECT_LE(NumaNodeCount(), kMaxNumaNodes);
+  EXPECT_GE(CurrentNumaNode(), 0);
+  EXPECT_LT(CurrentNumaNode(), NumaNodeCount());
+}
+
+TEST(NumaAllocatorTest, AllocatesDistinctAlignedBlocks) {
+  NumaAllocator<char> allocator(0);
+  std::vector<std::pair<char*, size_t>> blocks;
+  std::set<char*> distinct;
+  for (size_t bytes = 1; bytes <= (size_t{1} << 18); bytes = bytes * 3 + 1) {
+    for (int i = 0; i < 10; i++) {
+      char* block = allocator.allocate(bytes);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % 16, 0) << bytes;
+      std::memset(block, i, bytes);
+      EXPECT_TRUE(distinct.insert(block).second);
+      blocks.emplace_back(block, bytes);
+    }
+  }
+  for (const auto& block : blocks) {
+    allocator.deallocate(block.first, block.second);
+  }
+}
+
+TEST(NumaAllocatorTest, ReusesDeallocatedBlocks) {
+  NumaAllocator<int64_t> allocator(0);
+  int64_t* first = allocator.allocate(4);
+  allocator.deallocate(first, 4);
+  int64_t* second = allocator.allocate(3);
+  EXPECT_EQ(first, second);
+  allocator.deallocate(second, 3);
+}
+
+TEST(NumaAllocatorTest, PlacesOnRequestedNode) {
+  const int node = NumaNodeCount() - 1;
+  NumaAllocator<char> allocator(node);
+  for (size_t bytes : {size_t{64}, size_t{1} << 20}) {
+    char* block = allocator.allocate(bytes);
+    block[0] = 1;
+    const int actual = NumaNodeOf(block);
+    if (actual < 0) {
+      allocator.deallocate(block, bytes);
+      GTEST_SKIP() << "get_mempolicy unavailable";
+    }
+    EXPECT_EQ(actual, node);
+    allocator.deallocate(block, bytes);
+  }
+}
+
+TEST(NumaAllocatorTest, NonexistentNodeFallsBack) {
+  NumaAllocator<char> allocator(kMaxNumaNodes - 1);
+  char* block = allocator.allocate(100);
+  std::memset(block, 0, 100);
+  allocator.deallocate(block, 100);
+}
+
+TEST(NumaAllocatorTest, MakeRefCounted) {
+  char* array;
+  auto local = MakeRefCounted<Header, char, int64_t>(
+      1000, array, int64_t{42}, NumaAllocator<Header>());
+  std::memset(array, 'x', 1000);
+  Ref<const Header, VarAllocator<char, NumaAllocator<Header>, Header>> shared =
+      std::move(local).Share();
+  EXPECT_EQ(shared->value, 42);
+  auto on_node = Ref<Header, NumaAllocator<Header>>(
+      Refcounted<Header, NumaAllocator<Header>>::New(NumaAllocator<Header>(0),
+                                                     int64_t{7}));
+  EXPECT_EQ(on_node->value, 7);
+}
+
+TEST(NumaAllocatorTest, DeallocatesOnOtherThreads) {
+  NumaAllocator<int64_t> allocator;
+  std::vector<int64_t*> blocks;
+  for (int i = 0; i < 10000; i++) {
+    blocks.push_back(allocator.allocate(1 + i % 64));
+  }
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t] {
+      for (size_t i = t; i < blocks.size(); i += 4) {
+        allocator.deallocate(blocks[i], 1 + i % 64);
+        allocator.deallocate(allocator.allocate(1 + i % 64), 1 + i % 64);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace
+}  // namespace refptr
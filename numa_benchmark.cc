@@ -0,0 +1,106 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of `NumaAllocator`: The cost of allocation compared to
+// `std::allocator`, and reading and reference counting blocks placed on the
+// node of the benchmark thread compared to another node.
+//
+// The remote placement is skipped on machines with a single NUMA node. The
+// benchmark thread isn't pinned, so it should be run under `numactl
+// --cpunodebind` for stable results.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "numa_allocator.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct Header {
+  explicit Header(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+template <typename Alloc>
+void BM_MakeRefCounted(benchmark::State& state) {
+  const size_t length = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    char* array;
+    auto ref = MakeRefCounted<Header, char, size_t>(length, array,
+                                                    size_t{length}, Alloc());
+    benchmark::DoNotOptimize(array);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_MakeRefCounted, std::allocator<Header>)
+    ->RangeMultiplier(8)
+    ->Range(8, 1 << 15);
+BENCHMARK_TEMPLATE(BM_MakeRefCounted, NumaAllocator<Header>)
+    ->RangeMultiplier(8)
+    ->Range(8, 1 << 15);
+
+struct Payload {
+  explicit Payload(int64_t value) {
+    for (auto& v : values) {
+      v = value++;
+    }
+  }
+
+  int64_t values[8];
+};
+
+using PayloadRef = Ref<const Payload, NumaAllocator<Payload>>;
+
+// Argument: 0 to place the blocks on the node of the benchmark thread, 1 to
+// place them on another node.
+void BM_ReadAndShare(benchmark::State& state) {
+  const int nodes = NumaNodeCount();
+  if (state.range(0) == 1 && nodes < 2) {
+    state.SkipWithError("Requires at least 2 NUMA nodes");
+    return;
+  }
+  const int node = (CurrentNumaNode() + static_cast<int>(state.range(0))) %
+                   nodes;
+  std::vector<PayloadRef> blocks;
+  for (int64_t i = 0; i < (1 << 16); i++) {
+    blocks.emplace_back(Ref<Payload, NumaAllocator<Payload>>(
+        Refcounted<Payload, NumaAllocator<Payload>>::New(
+            NumaAllocator<Payload>(node), int64_t{i})));
+  }
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const PayloadRef& block : blocks) {
+      PayloadRef copy = block;
+      for (int64_t v : copy->values) {
+        sum += v;
+      }
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * blocks.size());
+  state.SetLabel(state.range(0) == 0 ? "local" : "remote");
+}
+BENCHMARK(BM_ReadAndShare)->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,355 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _PARALLEL_TEARDOWN_H
+#define _PARALLEL_TEARDOWN_H
+
+// Parallel destruction of large graphs of `Ref`s, such as trees with millions
+// of nodes, which would otherwise take a long time on the thread that drops
+// the last reference to their root.
+//
+// Types opt in by specializing `EnableParallelTeardown`:
+//
+//   template <>
+//   struct refptr::EnableParallelTeardown<Node> : std::true_type {};
+//
+// `TeardownPool::Release` then destroys a block on one of the pool's threads.
+// Whenever destroying a block drops the last reference to another block of an
+// opted-in type, its `SelfDelete` pushes it to a stack of the thread instead
+// of destroying it recursively. While some threads are idle, the others move
+// the older halves of their stacks, which are closer to the root, to deques
+// from which the idle threads steal.
+//
+// As a side effect, destroying deep graphs, such as long linked lists, doesn't
+// recurse and can't overflow the stack.
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "ref.h"
+#include "reference_counted.h"
+
+namespace refptr {
+
+namespace internal {
+
+// Tracks the pending blocks of a single `TeardownPool::Release` call.
+struct TeardownJob {
+  // The number of blocks scheduled but not yet destroyed.
+  std::atomic<int64_t> pending{1};
+  // Keeps the job alive while `pending > 0`.
+  std::shared_ptr<TeardownJob> self;
+  absl::Mutex mutex;
+  bool done ABSL_GUARDED_BY(mutex) = false;
+};
+
+}  // namespace internal
+
+// Completion handle of `TeardownPool::Release`. Can be copied, or discarded
+// to let the teardown finish asynchronously.
+class TeardownHandle {
+ public:
+  // A handle of a teardown that is already done.
+  TeardownHandle() = default;
+
+  bool Done() const {
+    if (job_ == nullptr) {
+      return true;
+    }
+    absl::MutexLock lock(&job_->mutex);
+    return job_->done;
+  }
+
+  // Blocks until all the blocks of the teardown are destroyed.
+  void Wait() const {
+    if (job_ == nullptr) {
+      return;
+    }
+    absl::MutexLock lock(&job_->mutex);
+    job_->mutex.Await(absl::Condition(&job_->done));
+  }
+
+ private:
+  explicit TeardownHandle(std::shared_ptr<internal::TeardownJob> job)
+      : job_(std::move(job)) {}
+
+  std::shared_ptr<internal::TeardownJob> job_;
+
+  friend class TeardownPool;
+};
+
+// A pool of threads that destroy `Refcounted` blocks, see above.
+class TeardownPool {
+ public:
+  // Requires `threads >= 1`.
+  explicit TeardownPool(int threads) {
+    assert(threads >= 1);
+    workers_.reserve(threads);
+    for (int i = 0; i < threads; i++) {
+      workers_.emplace_back(new Worker(*this, i));
+    }
+    for (auto& worker : workers_) {
+      Worker* w = worker.get();
+      w->thread = std::thread([w] { w->Run(); });
+    }
+  }
+
+  TeardownPool(const TeardownPool&) = delete;
+  TeardownPool& operator=(const TeardownPool&) = delete;
+
+  // Finishes all pending teardowns and stops the threads.
+  ~TeardownPool() {
+    {
+      absl::MutexLock lock(&sleep_mutex_);
+      stop_ = true;
+      sleep_cv_.SignalAll();
+    }
+    for (auto& worker : workers_) {
+      worker->thread.join();
+    }
+  }
+
+  int threads() const { return static_cast<int>(workers_.size()); }
+
+  // Drops `ref`. If it was the last reference to its block, the block is
+  // destroyed on the pool together with all the blocks of opted-in types it
+  // transitively owns, and the returned handle tracks their destruction.
+  // Otherwise the returned handle is already done.
+  template <typename T, typename Alloc>
+  TeardownHandle Release(Ref<T, Alloc> ref) {
+    using Block = Refcounted<typename std::remove_const<T>::type, Alloc>;
+    Block* block = std::move(ref).Release();
+    if (block == nullptr) {
+      return TeardownHandle();
+    }
+    const int_fast32_t refcount =
+        block->refcount.DecAndGet(/*expect_one=*/!std::is_const<T>::value);
+    if (refcount > 0) {
+      internal::RefcountedHooks<typename std::remove_const<T>::type,
+                                Alloc>::OnRelease(block, refcount);
+      return TeardownHandle();
+    }
+    // Like `SelfDelete`, lets the allocator take over the block first.
+    if (std::move(*block).Recycle()) {
+      return TeardownHandle();
+    }
+    auto job = std::make_shared<internal::TeardownJob>();
+    job->self = job;
+    const size_t index =
+        next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    Publish(*workers_[index], Task{&Block::DeleteBlock, block, job.get()});
+    return TeardownHandle(std::move(job));
+  }
+
+ private:
+  struct Task {
+    void (*deleter)(void*);
+    void* block;
+    internal::TeardownJob* job;
+  };
+
+  struct Worker final : public internal::TeardownQueue {
+    Worker(TeardownPool& pool_, int index_) : pool(pool_), index(index_) {}
+
+    void Push(void (*deleter)(void*), void* block) override {
+      released.push_back(Task{deleter, block, job});
+    }
+
+    void Run() {
+      internal::TeardownQueue::Current() = this;
+      Task task = {nullptr, nullptr, nullptr};
+      // `Sleep` returns `true` without a task, just to retry.
+      while (Pop(task) || pool.Steal(index, task) || pool.Sleep()) {
+        if (task.deleter != nullptr) {
+          RunTask(task);
+          task.deleter = nullptr;
+        }
+      }
+      internal::TeardownQueue::Current() = nullptr;
+    }
+
+    void RunTask(const Task& task) {
+      if (task.job != job) {
+        Settle();
+        job = task.job;
+      }
+      task.deleter(task.block);
+      // Released blocks are accounted for before they become visible to other
+      // threads, so `pending` never drops to zero prematurely. Finished tasks
+      // are subtracted only in `Settle`, which keeps contention on `pending`
+      // low.
+      if (released.empty()) {
+        finished++;
+      } else if (released.size() > 1) {
+        job->pending.fetch_add(static_cast<int64_t>(released.size()) - 1,
+                               std::memory_order_relaxed);
+      }
+      // Reversed, so that the blocks are popped in the order of release.
+      local.insert(local.end(), released.rbegin(), released.rend());
+      released.clear();
+      if (local.size() > 1 &&
+          pool.sleeping_.load(std::memory_order_relaxed) > 0) {
+        Share();
+      }
+    }
+
+    // Subtracts the finished tasks from `pending` of their job.
+    void Settle() {
+      if (finished > 0 &&
+          job->pending.fetch_sub(finished, std::memory_order_acq_rel) ==
+              finished) {
+        Finish(*job);
+        job = nullptr;
+      }
+      finished = 0;
+    }
+
+    // Moves the older half of `local`, whose blocks are closer to the root,
+    // to `tasks` for other threads to steal.
+    void Share() {
+      const size_t half = local.size() / 2;
+      {
+        absl::MutexLock lock(&mutex);
+        tasks.insert(tasks.end(), local.begin(), local.begin() + half);
+      }
+      local.erase(local.begin(), local.begin() + half);
+      pool.WakeIfSleeping();
+    }
+
+    // Pops the newest task of this worker, which is likely still in cache.
+    bool Pop(Task& task) {
+      if (!local.empty()) {
+        task = local.back();
+        local.pop_back();
+        return true;
+      }
+      Settle();
+      absl::MutexLock lock(&mutex);
+      if (tasks.empty()) {
+        return false;
+      }
+      task = tasks.back();
+      tasks.pop_back();
+      return true;
+    }
+
+    // Steals the oldest task, which likely owns the largest subgraph.
+    bool StealFrom(Task& task) {
+      absl::MutexLock lock(&mutex);
+      if (tasks.empty()) {
+        return false;
+      }
+      task = tasks.front();
+      tasks.pop_front();
+      return true;
+    }
+
+    bool HasTasks() {
+      absl::MutexLock lock(&mutex);
+      return !tasks.empty();
+    }
+
+    TeardownPool& pool;
+    const int index;
+    std::thread thread;
+    // The job of the last task run.
+    internal::TeardownJob* job = nullptr;
+    // The number of finished tasks of `job` not yet subtracted from its
+    // `pending`.
+    int64_t finished = 0;
+    // Blocks released by the task being run.
+    std::vector<Task> released;
+    // Tasks private to this thread, accessed without locking.
+    std::vector<Task> local;
+    absl::Mutex mutex;
+    // Tasks that other threads can steal.
+    std::deque<Task> tasks ABSL_GUARDED_BY(mutex);
+  };
+
+  static void Finish(internal::TeardownJob& job) {
+    // Destroys the job at the end of the scope, unless held by a handle.
+    std::shared_ptr<internal::TeardownJob> self = std::move(job.self);
+    absl::MutexLock lock(&job.mutex);
+    job.done = true;
+  }
+
+  void Publish(Worker& worker, const Task& task) {
+    {
+      absl::MutexLock lock(&worker.mutex);
+      worker.tasks.push_back(task);
+    }
+    WakeIfSleeping();
+  }
+
+  bool Steal(int thief, Task& task) {
+    const size_t n = workers_.size();
+    for (size_t i = 1; i < n; i++) {
+      if (workers_[(thief + i) % n]->StealFrom(task)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Called after publishing tasks. A sleeping worker increments `sleeping_`
+  // before checking all the deques, so either it finds the published tasks, or
+  // the check happens before the publication and the increment is visible
+  // here.
+  void WakeIfSleeping() {
+    if (sleeping_.load(std::memory_order_relaxed) > 0) {
+      absl::MutexLock lock(&sleep_mutex_);
+      sleep_cv_.Signal();
+    }
+  }
+
+  // Waits until there are some tasks, returning `true`, or until the pool is
+  // stopped with no tasks left, returning `false`.
+  bool Sleep() {
+    absl::MutexLock lock(&sleep_mutex_);
+    sleeping_.fetch_add(1, std::memory_order_relaxed);
+    bool has_tasks = false;
+    while (true) {
+      for (auto& worker : workers_) {
+        has_tasks = has_tasks || worker->HasTasks();
+      }
+      if (has_tasks || stop_) {
+        break;
+      }
+      sleep_cv_.Wait(&sleep_mutex_);
+    }
+    sleeping_.fetch_sub(1, std::memory_order_relaxed);
+    return has_tasks;
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_{0};
+  std::atomic<int> sleeping_{0};
+  absl::Mutex sleep_mutex_;
+  absl::CondVar sleep_cv_;
+  bool stop_ ABSL_GUARDED_BY(sleep_mutex_) = false;
+};
+
+}  // namespace refptr
+
+#endif  // _PARALLEL_TEARDOWN_H
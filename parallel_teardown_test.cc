@@ -0,0 +1,154 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parallel_teardown.h"
+
+#include <atomic>
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "gtest/gtest.h"
+#include "ref.h"
+#include "ref_pool.h"
+
+namespace refptr {
+namespace {
+
+std::atomic<int64_t> live_nodes{0};
+
+struct Node {
+  Node() { live_nodes++; }
+  ~Node() { live_nodes--; }
+
+  std::vector<Ref<const Node>> children;
+};
+
+// Not opted in, so destroyed recursively by its parent `Node`.
+struct Leaf {
+  explicit Leaf(std::set<std::thread::id>& threads_) : threads(threads_) {}
+  ~Leaf() { threads.insert(std::this_thread::get_id()); }
+
+  std::set<std::thread::id>& threads;
+};
+
+}  // namespace
+
+template <>
+struct EnableParallelTeardown<Node> : std::true_type {};
+
+namespace {
+
+Ref<const Node> BuildTree(int depth, int fanout) {
+  Ref<Node> node = New<Node>();
+  if (depth > 0) {
+    for (int i = 0; i < fanout; i++) {
+      node->children.push_back(BuildTree(depth - 1, fanout));
+    }
+  }
+  return std::move(node).Share();
+}
+
+class ParallelTeardownTest : public testing::Test {
+ protected:
+  void TearDown() override { EXPECT_EQ(live_nodes.load(), 0); }
+};
+
+TEST_F(ParallelTeardownTest, DestroysTree) {
+  TeardownPool pool(4);
+  Ref<const Node> root = BuildTree(/*depth=*/8, /*fanout=*/4);
+  EXPECT_EQ(live_nodes.load(), (int64_t{1} << 18) / 3);
+  TeardownHandle handle = pool.Release(std::move(root));
+  handle.Wait();
+  EXPECT_TRUE(handle.Done());
+  EXPECT_EQ(live_nodes.load(), 0);
+}
+
+TEST_F(ParallelTeardownTest, KeepsSharedSubtrees) {
+  TeardownPool pool(2);
+  Ref<const Node> root = BuildTree(/*depth=*/3, /*fanout=*/3);
+  Ref<const Node> subtree = root->children[1];
+  pool.Release(std::move(root)).Wait();
+  EXPECT_EQ(live_nodes.load(), 1 + 3 + 9);
+  EXPECT_EQ(subtree->children.size(), 3);
+}
+
+TEST_F(ParallelTeardownTest, NotLastReference) {
+  TeardownPool pool(1);
+  Ref<const Node> root = BuildTree(/*depth=*/2, /*fanout=*/2);
+  TeardownHandle handle = pool.Release(Ref<const Node>(root));
+  EXPECT_TRUE(handle.Done());
+  EXPECT_EQ(live_nodes.load(), 7);
+}
+
+TEST_F(ParallelTeardownTest, UniqueRef) {
+  TeardownPool pool(1);
+  Ref<Node> root = New<Node>();
+  root->children.push_back(BuildTree(/*depth=*/2, /*fanout=*/2));
+  pool.Release(std::move(root)).Wait();
+}
+
+TEST_F(ParallelTeardownTest, DeepListDoesNotRecurse) {
+  TeardownPool pool(1);
+  absl::optional<Ref<const Node>> head;
+  for (int i = 0; i < 1000000; i++) {
+    Ref<Node> node = New<Node>();
+    if (head) {
+      node->children.push_back(*std::move(head));
+    }
+    head = std::move(node).Share();
+  }
+  pool.Release(*std::move(head)).Wait();
+}
+
+TEST_F(ParallelTeardownTest, DestroysOtherTypesOnPool) {
+  std::set<std::thread::id> threads;
+  {
+    TeardownPool pool(1);
+    Ref<const Leaf> leaf = New<Leaf>(threads).Share();
+    pool.Release(std::move(leaf)).Wait();
+  }
+  ASSERT_EQ(threads.size(), 1);
+  EXPECT_NE(*threads.begin(), std::this_thread::get_id());
+}
+
+TEST_F(ParallelTeardownTest, PoolFinishesDiscardedHandles) {
+  {
+    TeardownPool pool(3);
+    for (int i = 0; i < 10; i++) {
+      pool.Release(BuildTree(/*depth=*/5, /*fanout=*/3));
+    }
+  }
+  EXPECT_EQ(live_nodes.load(), 0);
+}
+
+TEST_F(ParallelTeardownTest, RecyclesPooledBlocks) {
+  struct Pooled {
+    int value = 0;
+  };
+  RefPool<Pooled, char> blocks(16);
+  char* array;
+  auto pooled = blocks.Acquire(array);
+  const Pooled* address = &*pooled;
+  TeardownPool pool(2);
+  EXPECT_TRUE(pool.Release(std::move(pooled)).Done());
+  EXPECT_EQ(&*blocks.Acquire(array), address) << "Must be kept by the pool";
+}
+
+}  // namespace
+}  // namespace refptr
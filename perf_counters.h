@@ -0,0 +1,188 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+// Minimal wrapper of Linux `perf_event_open` for counting hardware events of
+// the calling thread, such as cycles, instructions and cache misses.
+//
+// Events that can't be opened, for example on other platforms, in virtual
+// machines without a PMU or with a restrictive `perf_event_paranoid` setting,
+// are reported as unavailable rather than failing.
+
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace refptr {
+
+class PerfCounters {
+ public:
+  enum Event {
+    kCycles = 0,
+    kInstructions,
+    kL1dReadMisses,
+    kLlcMisses,
+    kBranchMisses,
+    kDtlbReadMisses,
+    kEvents,
+  };
+
+  static const char* Name(Event event) {
+    static const char* const kNames[kEvents] = {
+        "cycles",        "instructions", "L1d_misses",
+        "LLC_misses",    "branch_misses", "dTLB_misses"};
+    return kNames[event];
+  }
+
+  // Opens all the events for the calling thread. They are counted only
+  // between `Start()` and `Stop()`.
+  PerfCounters() {
+    for (int i = 0; i < kEvents; i++) {
+      fds_[i] = Open(static_cast<Event>(i));
+    }
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+#if defined(__linux__)
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+#endif
+  }
+
+  bool Available(Event event) const { return fds_[event] >= 0; }
+  bool AnyAvailable() const {
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Resets and starts counting all available events.
+  void Start() {
+#if defined(__linux__)
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void Stop() {
+#if defined(__linux__)
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+#endif
+  }
+
+  // Returns the count of `event` between `Start()` and `Stop()`, or -1 if the
+  // event is unavailable or never got scheduled on the PMU. If the kernel
+  // multiplexed the events, the count is extrapolated from the time the event
+  // was actually counted.
+  int64_t Read(Event event) const {
+#if defined(__linux__)
+    if (fds_[event] < 0) {
+      return -1;
+    }
+    // Layout given by `read_format` below.
+    struct {
+      uint64_t value;
+      uint64_t time_enabled;
+      uint64_t time_running;
+    } data;
+    if (read(fds_[event], &data, sizeof(data)) != sizeof(data) ||
+        data.time_running == 0) {
+      return -1;
+    }
+    return static_cast<int64_t>(static_cast<double>(data.value) *
+                                data.time_enabled / data.time_running);
+#else
+    (void)event;
+    return -1;
+#endif
+  }
+
+ private:
+  static int Open(Event event) {
+#if defined(__linux__)
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (event) {
+      case kCycles:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case kInstructions:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case kL1dReadMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+      case kLlcMisses:
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+      case kBranchMisses:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+      case kDtlbReadMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+      case kEvents:
+        return -1;
+    }
+    attr.disabled = 1;
+    // Allowed with the default `perf_event_paranoid` of 2.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, /*pid=*/0,
+                                    /*cpu=*/-1, /*group_fd=*/-1, 0));
+#else
+    (void)event;
+    return -1;
+#endif
+  }
+
+  int fds_[kEvents];
+};
+
+}  // namespace refptr
+
+#endif  // _PERF_COUNTERS_H
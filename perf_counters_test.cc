@@ -0,0 +1,55 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "perf_counters.h"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+namespace refptr {
+namespace {
+
+TEST(PerfCountersTest, CountsInstructionsIfAvailable) {
+  PerfCounters counters;
+  if (!counters.Available(PerfCounters::kInstructions)) {
+    // Must degrade gracefully.
+    EXPECT_EQ(counters.Read(PerfCounters::kInstructions), -1);
+    GTEST_SKIP() << "Instruction counter unavailable";
+  }
+  counters.Start();
+  volatile int64_t sum = 0;
+  for (int i = 0; i < 100000; i++) {
+    sum = sum + i;
+  }
+  counters.Stop();
+  const int64_t instructions = counters.Read(PerfCounters::kInstructions);
+  if (instructions < 0) {
+    GTEST_SKIP() << "Instruction counter never scheduled";
+  }
+  EXPECT_GE(instructions, 100000);
+}
+
+TEST(PerfCountersTest, UnavailableEventsReadAsNegative) {
+  PerfCounters counters;
+  for (int i = 0; i < PerfCounters::kEvents; i++) {
+    const auto event = static_cast<PerfCounters::Event>(i);
+    if (!counters.Available(event)) {
+      EXPECT_EQ(counters.Read(event), -1) << PerfCounters::Name(event);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,274 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// End-to-end benchmark of a message-passing pipeline, where every stage runs
+// in its own thread:
+//
+//     source -> parse -> route -> fan-out -> N consumers (serialize)
+//
+// The parse stage creates a message with a variable-sized payload, which is
+// then passed along as a shared, immutable pointer. The fan-out stage hands
+// a copy of it to each of the N consumers, which serialize the message and
+// release it.
+//
+// Reports the throughput of delivered messages (`items_per_second`) and the
+// latency percentiles from the source to the end of serialization (`p50`,
+// `p99`, `p999` and `max`, in nanoseconds).
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "benchmark/benchmark.h"
+#include "benchmark_channel.h"
+#include "benchmark_counters.h"
+#include "latency_histogram.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+struct Header {
+  Header(int64_t id_, int64_t start_ns_, size_t length_)
+      : id(id_), start_ns(start_ns_), length(length_) {}
+
+  int64_t id;
+  // When the source emitted the message.
+  int64_t start_ns;
+  size_t length;
+  // Set by the parse stage before the message is shared.
+  const char* payload = nullptr;
+};
+
+// Payloads of 64 bytes to 4 KiB.
+size_t PayloadLength(int64_t id) {
+  return 64 + static_cast<size_t>(id * 2654435761u % 4032);
+}
+
+// A single allocation of `Header` and its payload with `MakeRefCounted`.
+struct RefBackend {
+  using Alloc = VarAllocator<char, std::allocator<Header>, Header>;
+  using Message = Ref<Header, Alloc>;
+  using Pointer = Ref<const Header, Alloc>;
+
+  static Message Make(int64_t id, int64_t start_ns, size_t length,
+                      char*& payload) {
+    return MakeRefCounted<Header, char, int64_t, int64_t, size_t>(
+        length, payload, int64_t{id}, int64_t{start_ns}, size_t{length});
+  }
+  static Pointer Share(Message message) { return std::move(message).Share(); }
+};
+
+// A single allocation of `Header` and its payload with `MakeShared`.
+struct MakeSharedBackend {
+  using Message = std::shared_ptr<Header>;
+  using Pointer = std::shared_ptr<const Header>;
+
+  static Message Make(int64_t id, int64_t start_ns, size_t length,
+                      char*& payload) {
+    return MakeShared<Header, char, int64_t, int64_t, size_t>(
+        length, payload, int64_t{id}, int64_t{start_ns}, size_t{length});
+  }
+  static Pointer Share(Message message) { return message; }
+};
+
+// `std::make_shared` of a message owning a separately allocated payload.
+struct SharedPtrBackend {
+  struct Owned : public Header {
+    Owned(int64_t id, int64_t start_ns, size_t length)
+        : Header(id, start_ns, length), buffer(new char[length]) {}
+
+    std::unique_ptr<char[]> buffer;
+  };
+  using Message = std::shared_ptr<Owned>;
+  using Pointer = std::shared_ptr<const Header>;
+
+  static Message Make(int64_t id, int64_t start_ns, size_t length,
+                      char*& payload) {
+    auto message = std::make_shared<Owned>(id, start_ns, length);
+    payload = message->buffer.get();
+    return message;
+  }
+  static Pointer Share(Message message) { return message; }
+};
+
+// The pipeline threads of a single benchmark run. An empty optional in a
+// channel tells the receiving stage to stop.
+template <typename B>
+class Pipeline {
+ public:
+  using Pointer = typename B::Pointer;
+
+  static constexpr uint32_t kRoutes = 16;
+
+  explicit Pipeline(int consumers)
+      : consumer_channels_(consumers), histograms_(consumers) {
+    threads_.emplace_back([this] { Parse(); });
+    threads_.emplace_back([this] { Route(); });
+    threads_.emplace_back([this] { FanOut(); });
+    for (int i = 0; i < consumers; i++) {
+      threads_.emplace_back([this, i] { Consume(i); });
+    }
+  }
+
+  ~Pipeline() {
+    source_.Push(absl::nullopt);
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Emits a new message into the pipeline.
+  void Push(int64_t id) { source_.Push(std::make_pair(id, NowNanos())); }
+
+  // Waits until consumers have serialized `count` messages in total since
+  // the start.
+  void WaitForDeliveries(int64_t count) {
+    while (delivered_.load(std::memory_order_acquire) < count) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Must be called after the pipeline is idle.
+  LatencyHistogram Latencies() const {
+    LatencyHistogram result;
+    for (const LatencyHistogram& histogram : histograms_) {
+      result.Merge(histogram);
+    }
+    return result;
+  }
+
+  int64_t serialized_bytes() const {
+    return serialized_bytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void Parse() {
+    while (auto input = source_.Pop()) {
+      const int64_t id = input->first;
+      const size_t length = PayloadLength(id);
+      char* payload;
+      typename B::Message message = B::Make(id, input->second, length, payload);
+      memset(payload, static_cast<int>(id), length);
+      message->payload = payload;
+      parsed_.Push(B::Share(std::move(message)));
+    }
+    parsed_.Push(absl::nullopt);
+  }
+
+  void Route() {
+    while (auto message = parsed_.Pop()) {
+      // A stand-in for routing decisions based on the message content.
+      const uint32_t route =
+          static_cast<uint32_t>((*message)->payload[0]) % kRoutes;
+      benchmark::DoNotOptimize(route);
+      routed_.Push(std::move(message));
+    }
+    routed_.Push(absl::nullopt);
+  }
+
+  void FanOut() {
+    while (auto message = routed_.Pop()) {
+      for (auto& channel : consumer_channels_) {
+        channel.Push(*message);
+      }
+    }
+    for (auto& channel : consumer_channels_) {
+      channel.Push(absl::nullopt);
+    }
+  }
+
+  void Consume(int index) {
+    std::string buffer;
+    while (auto message = consumer_channels_[index].Pop()) {
+      const Header& header = **message;
+      buffer.clear();
+      buffer.append(reinterpret_cast<const char*>(&header.id),
+                    sizeof(header.id));
+      buffer.append(reinterpret_cast<const char*>(&header.length),
+                    sizeof(header.length));
+      buffer.append(header.payload, header.length);
+      benchmark::DoNotOptimize(buffer.data());
+      histograms_[index].Record(NowNanos() - header.start_ns);
+      // Release the message before reporting the delivery.
+      message.reset();
+      serialized_bytes_.fetch_add(buffer.size(), std::memory_order_relaxed);
+      delivered_.fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  Channel<absl::optional<std::pair<int64_t, int64_t>>> source_;
+  Channel<absl::optional<Pointer>> parsed_;
+  Channel<absl::optional<Pointer>> routed_;
+  std::vector<Channel<absl::optional<Pointer>>> consumer_channels_;
+  // One per consumer.
+  std::vector<LatencyHistogram> histograms_;
+  std::atomic<int64_t> delivered_{0};
+  std::atomic<int64_t> serialized_bytes_{0};
+  std::vector<std::thread> threads_;
+};
+
+// Each iteration pushes a batch of messages through the pipeline and waits
+// until all consumers have serialized them.
+template <typename B>
+void BM_Pipeline(benchmark::State& state) {
+  constexpr int kBatch = 256;
+  const int consumers = static_cast<int>(state.range(0));
+  Pipeline<B> pipeline(consumers);
+  int64_t id = 0;
+  for (auto _ : state) {
+    for (int i = 0; i < kBatch; i++) {
+      pipeline.Push(id++);
+    }
+    pipeline.WaitForDeliveries(id * consumers);
+  }
+  state.SetItemsProcessed(id * consumers);
+  state.SetBytesProcessed(pipeline.serialized_bytes());
+  ReportLatencyCounters(state, pipeline.Latencies());
+}
+BENCHMARK_TEMPLATE(BM_Pipeline, RefBackend)
+    ->ArgName("consumers")
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Pipeline, MakeSharedBackend)
+    ->ArgName("consumers")
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Pipeline, SharedPtrBackend)
+    ->ArgName("consumers")
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace refptr
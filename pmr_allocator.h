@@ -0,0 +1,164 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _PMR_ALLOCATOR_H
+#define _PMR_ALLOCATOR_H
+
+// Allocation of `Refcounted` blocks and var-sized records from memory
+// resources, such as `std::pmr::monotonic_buffer_resource` and
+// `std::pmr::unsynchronized_pool_resource`:
+//
+//     std::pmr::unsynchronized_pool_resource pool;
+//     char* array;
+//     auto ref = MakeRefCounted<Foo, char>(length, array,
+//                                          PmrAllocator<Foo>(&pool));
+//
+// If `REFPTR_STD_PMR` is defined, which requires C++17, `MemoryResource` is
+// `std::pmr::memory_resource`. Otherwise it's a class with the same interface,
+// so that resources can be written once for both. The choice doesn't depend on
+// the language standard of the including file: all files linked together must
+// agree on `REFPTR_STD_PMR`, as it changes the types defined here.
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#ifdef REFPTR_STD_PMR
+#include <memory_resource>
+#endif
+
+namespace refptr {
+
+#ifdef REFPTR_STD_PMR
+
+using MemoryResource = std::pmr::memory_resource;
+
+inline MemoryResource* NewDeleteResource() {
+  return std::pmr::new_delete_resource();
+}
+
+#else  // REFPTR_STD_PMR
+
+// The interface of C++17 `std::pmr::memory_resource`.
+class MemoryResource {
+ public:
+  virtual ~MemoryResource() = default;
+
+  void* allocate(size_t bytes,
+                 size_t alignment = alignof(std::max_align_t)) {
+    return do_allocate(bytes, alignment);
+  }
+  void deallocate(void* ptr, size_t bytes,
+                  size_t alignment = alignof(std::max_align_t)) {
+    do_deallocate(ptr, bytes, alignment);
+  }
+  bool is_equal(const MemoryResource& other) const noexcept {
+    return do_is_equal(other);
+  }
+
+ private:
+  virtual void* do_allocate(size_t bytes, size_t alignment) = 0;
+  virtual void do_deallocate(void* ptr, size_t bytes, size_t alignment) = 0;
+  virtual bool do_is_equal(const MemoryResource& other) const noexcept = 0;
+};
+
+namespace internal {
+
+// Allocates by `::operator new`. Blocks with a larger alignment than it
+// guarantees are over-allocated, with the original pointer stored right
+// before the aligned block.
+class NewDeleteResource final : public MemoryResource {
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    if (alignment <= alignof(std::max_align_t)) {
+      return ::operator new(bytes);
+    }
+    char* raw =
+        static_cast<char*>(::operator new(bytes + alignment + sizeof(void*)));
+    const uintptr_t address =
+        reinterpret_cast<uintptr_t>(raw + sizeof(void*));
+    void** aligned = reinterpret_cast<void**>((address + alignment - 1) &
+                                              ~(uintptr_t{alignment} - 1));
+    aligned[-1] = raw;
+    return aligned;
+  }
+  void do_deallocate(void* ptr, size_t, size_t alignment) override {
+    ::operator delete(alignment <= alignof(std::max_align_t)
+                          ? ptr
+                          : static_cast<void**>(ptr)[-1]);
+  }
+  bool do_is_equal(const MemoryResource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+}  // namespace internal
+
+inline MemoryResource* NewDeleteResource() {
+  static internal::NewDeleteResource* resource =
+      new internal::NewDeleteResource();
+  return resource;
+}
+
+#endif  // REFPTR_STD_PMR
+
+// Allocates from a `MemoryResource`, which must outlive all the blocks
+// allocated from it. Can be used as `Alloc` of `Refcounted` and
+// `VarAllocator`, for example with `MakeRefCounted`.
+//
+// Unlike `std::pmr::polymorphic_allocator` it is assignable and doesn't
+// propagate itself to the constructed objects, so that it can be used with
+// any `T`. Holds just the resource pointer, which is the only overhead stored
+// in every block.
+template <typename T>
+class PmrAllocator {
+ public:
+  using value_type = T;
+
+  // Uses `NewDeleteResource()`.
+  PmrAllocator() : resource_(NewDeleteResource()) {}
+  explicit PmrAllocator(MemoryResource* resource) : resource_(resource) {
+    assert(resource != nullptr);
+  }
+
+  template <typename U>
+  PmrAllocator(const PmrAllocator<U>& other) : resource_(other.resource()) {}
+
+  MemoryResource* resource() const { return resource_; }
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T* ptr, size_t n) {
+    resource_->deallocate(ptr, n * sizeof(T), alignof(T));
+  }
+
+  template <typename U>
+  bool operator==(const PmrAllocator<U>& other) const {
+    return resource_ == other.resource() ||
+           resource_->is_equal(*other.resource());
+  }
+  template <typename U>
+  bool operator!=(const PmrAllocator<U>& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  MemoryResource* resource_;
+};
+
+}  // namespace refptr
+
+#endif  // _PMR_ALLOCATOR_H
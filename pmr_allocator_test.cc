@@ -0,0 +1,144 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Built both as C++17, with `std::pmr`, and as C++11, with the fallback
+// `MemoryResource`.
+
+#include "pmr_allocator.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct Foo {
+  explicit Foo(int value_) : value(value_) {}
+
+  int value;
+};
+
+struct alignas(64) CacheLine {
+  explicit CacheLine(int value_) : value(value_) {}
+
+  int value;
+};
+
+// Forwards to `NewDeleteResource()` and counts allocated blocks.
+class CountingResource final : public MemoryResource {
+ public:
+  int64_t live = 0;
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    live++;
+    return NewDeleteResource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    live--;
+    NewDeleteResource()->deallocate(ptr, bytes, alignment);
+  }
+  bool do_is_equal(const MemoryResource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+TEST(PmrAllocatorTest, StoresOnlyTheResource) {
+  EXPECT_EQ(sizeof(PmrAllocator<Foo>), sizeof(MemoryResource*));
+  EXPECT_EQ(sizeof(Refcounted<Foo, PmrAllocator<Foo>>),
+            sizeof(Refcounted<Foo, std::allocator<Foo>>) +
+                sizeof(MemoryResource*));
+}
+
+TEST(PmrAllocatorTest, MakeRefCountedUsesResource) {
+  CountingResource resource;
+  {
+    char* array;
+    auto ref = MakeRefCounted<Foo, char, int>(100, array, 42,
+                                              PmrAllocator<Foo>(&resource));
+    std::memset(array, 'x', 100);
+    EXPECT_EQ(ref->value, 42);
+    EXPECT_EQ(resource.live, 1);
+    Ref<const Foo, VarAllocator<char, PmrAllocator<Foo>, Foo>> shared =
+        std::move(ref).Share();
+    auto copy = shared;
+    EXPECT_EQ(resource.live, 1);
+  }
+  EXPECT_EQ(resource.live, 0);
+}
+
+TEST(PmrAllocatorTest, DefaultsToNewDeleteResource) {
+  EXPECT_EQ(PmrAllocator<Foo>().resource(), NewDeleteResource());
+  Ref<Foo, PmrAllocator<Foo>> ref(
+      Refcounted<Foo, PmrAllocator<Foo>>::New({}, 7));
+  EXPECT_EQ(ref->value, 7);
+}
+
+TEST(PmrAllocatorTest, ComparesResources) {
+  CountingResource first;
+  CountingResource second;
+  EXPECT_EQ(PmrAllocator<Foo>(&first), PmrAllocator<char>(&first));
+  EXPECT_NE(PmrAllocator<Foo>(&first), PmrAllocator<Foo>(&second));
+  PmrAllocator<Foo> assigned(&first);
+  assigned = PmrAllocator<Foo>(&second);
+  EXPECT_EQ(assigned.resource(), &second);
+}
+
+TEST(PmrAllocatorTest, AlignsOverAlignedTypes) {
+  std::vector<Ref<CacheLine, PmrAllocator<CacheLine>>> refs;
+  for (int i = 0; i < 10; i++) {
+    refs.emplace_back(Refcounted<CacheLine, PmrAllocator<CacheLine>>::New(
+        PmrAllocator<CacheLine>(), int{i}));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&*refs.back()) % 64, 0);
+  }
+}
+
+#ifdef REFPTR_STD_PMR
+TEST(PmrAllocatorTest, MonotonicBuffer) {
+  alignas(64) char buffer[4096];
+  std::pmr::monotonic_buffer_resource monotonic(
+      buffer, sizeof(buffer), std::pmr::null_memory_resource());
+  for (int i = 0; i < 10; i++) {
+    char* array;
+    auto ref = MakeRefCounted<Foo, char, int>(
+        100, array, int{i}, PmrAllocator<Foo>(&monotonic));
+    EXPECT_GE(reinterpret_cast<char*>(&*ref), buffer);
+    EXPECT_LT(reinterpret_cast<char*>(&*ref), buffer + sizeof(buffer));
+  }
+}
+
+TEST(PmrAllocatorTest, PoolReusesBlocks) {
+  std::pmr::unsynchronized_pool_resource pool;
+  const Foo* first;
+  {
+    char* array;
+    auto ref = MakeRefCounted<Foo, char, int>(100, array, 1,
+                                              PmrAllocator<Foo>(&pool));
+    first = &*ref;
+  }
+  char* array;
+  auto ref =
+      MakeRefCounted<Foo, char, int>(100, array, 2, PmrAllocator<Foo>(&pool));
+  EXPECT_EQ(&*ref, first);
+}
+#endif  // REFPTR_STD_PMR
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,102 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Creating and dropping batches of `MakeRefCounted<Msg, char>` records with
+// `std::allocator` and with `PmrAllocator` over `std::pmr` resources.
+// Requires C++17.
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "pmr_allocator.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+constexpr size_t kBatch = 1024;
+
+struct Msg {
+  explicit Msg(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+struct StdAllocator {
+  std::allocator<Msg> Get() { return {}; }
+  void Reset() {}
+};
+
+struct NewDelete {
+  PmrAllocator<Msg> Get() { return PmrAllocator<Msg>(NewDeleteResource()); }
+  void Reset() {}
+};
+
+struct Pool {
+  PmrAllocator<Msg> Get() { return PmrAllocator<Msg>(&resource); }
+  void Reset() {}
+
+  std::pmr::unsynchronized_pool_resource resource;
+};
+
+struct SynchronizedPool {
+  PmrAllocator<Msg> Get() { return PmrAllocator<Msg>(&resource); }
+  void Reset() {}
+
+  std::pmr::synchronized_pool_resource resource;
+};
+
+struct Monotonic {
+  PmrAllocator<Msg> Get() { return PmrAllocator<Msg>(&resource); }
+  // Deallocation is a no-op, memory is reclaimed only here.
+  void Reset() { resource.release(); }
+
+  std::pmr::monotonic_buffer_resource resource;
+};
+
+// Argument: The length of the payload in bytes.
+template <typename Resource>
+void BM_Batch(benchmark::State& state) {
+  using Alloc = decltype(std::declval<Resource&>().Get());
+  const size_t length = static_cast<size_t>(state.range(0));
+  Resource resource;
+  std::vector<Ref<Msg, VarAllocator<char, Alloc, Msg>>> batch;
+  batch.reserve(kBatch);
+  for (auto _ : state) {
+    for (size_t i = 0; i < kBatch; i++) {
+      char* array;
+      batch.push_back(MakeRefCounted<Msg, char, size_t>(
+          length, array, size_t{length}, resource.Get()));
+      std::memset(array, 0, length < 64 ? length : 64);
+    }
+    batch.clear();
+    resource.Reset();
+  }
+  state.SetItemsProcessed(state.iterations() * kBatch);
+}
+BENCHMARK_TEMPLATE(BM_Batch, StdAllocator)->RangeMultiplier(8)->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_Batch, NewDelete)->RangeMultiplier(8)->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_Batch, Pool)->RangeMultiplier(8)->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_Batch, SynchronizedPool)
+    ->RangeMultiplier(8)
+    ->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_Batch, Monotonic)->RangeMultiplier(8)->Range(16, 4096);
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,271 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _RECYCLING_ALLOCATOR_H
+#define _RECYCLING_ALLOCATOR_H
+
+// Allocator adapter that caches freed blocks and reuses them for the next
+// allocation of the same size, for code that creates and drops blocks of a
+// few distinct sizes at high rates, such as messages built by
+// `MakeRefCounted<Msg, char>(length, ...)`:
+//
+//     char* array;
+//     auto msg = MakeRefCounted<Msg, char>(length, array,
+//                                          RecyclingAllocator<Msg>());
+//
+// `VarAllocator` rebinds it to its allocation unit, so blocks are keyed by
+// their number of units, `VarAllocator::AllocatedUnits`, and records with
+// lengths that round to the same number of units share a cache.
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "thread_shards.h"
+
+namespace refptr {
+
+// The number of distinct block sizes cached by each thread.
+constexpr int kRecyclingSizes = 8;
+// Blocks move between a thread and the global depot in batches of this size.
+// A thread caches up to twice as many blocks of each size.
+constexpr size_t kRecyclingBatch = 32;
+// The number of batches of each size kept in the global depot.
+constexpr size_t kRecyclingDepotBatches = 64;
+// The total size of blocks kept in the global depot of each allocator type,
+// after which overflowing batches are deallocated.
+constexpr size_t kMaxRecyclingDepotBytes = size_t{64} << 20;
+// Larger blocks aren't cached.
+constexpr size_t kMaxRecycledBytes = size_t{64} << 10;
+
+namespace internal {
+
+// Free blocks of `n` elements each, linked through their first bytes.
+struct RecyclingList {
+  size_t n = 0;
+  size_t count = 0;
+  void* head = nullptr;
+};
+
+// Free blocks cached by a single thread.
+struct RecyclingShard {
+  RecyclingList lists[kRecyclingSizes];
+};
+
+// Batches of free blocks overflowing from threads, shared by all of them.
+struct RecyclingDepot {
+  struct Batches {
+    size_t n;
+    // Heads of lists of `kRecyclingBatch` blocks each.
+    std::vector<void*> heads;
+  };
+
+  std::mutex mutex;
+  size_t bytes = 0;
+  std::vector<Batches> sizes;
+};
+
+}  // namespace internal
+
+// Forwards allocations to `Alloc`, except that freed blocks of up to
+// `kMaxRecycledBytes` are kept in per-thread free lists and returned by the
+// next allocation of the same number of elements on that thread. A thread
+// caches up to `kRecyclingSizes` distinct sizes at a time, and moves
+// overflowing batches to a global depot, from which threads with empty lists
+// refill. The depot keeps up to `kRecyclingDepotBatches` of each size and
+// `kMaxRecyclingDepotBytes` in total, and overflowing batches are deallocated.
+//
+// Caches are shared by all instances of the same `RecyclingAllocator<T,
+// Alloc>` type, so instances of `Alloc` must be interchangeable, as indicated
+// by comparing equal. Cached blocks are never returned to `Alloc`. Caches of
+// finished threads are taken over by new ones.
+//
+// Can be used as the `Alloc` argument of `VarAllocator`, `Refcounted` and the
+// `Make...` functions, which rebind it to the types they actually allocate.
+template <typename T, typename Alloc = std::allocator<T>>
+class RecyclingAllocator {
+ public:
+  using value_type = T;
+
+  RecyclingAllocator() = default;
+  explicit RecyclingAllocator(Alloc allocator)
+      : allocator_(std::move(allocator)) {}
+
+  template <typename U, typename UAlloc>
+  RecyclingAllocator(const RecyclingAllocator<U, UAlloc>& other)
+      : allocator_(other.allocator_) {}
+
+  T* allocate(size_t n) {
+    internal::RecyclingList* list = Recycles(n) ? List(n) : nullptr;
+    if (list == nullptr) {
+      return std::allocator_traits<Alloc>::allocate(allocator_, n);
+    }
+    if (list->head == nullptr) {
+      Refill(*list);
+      if (list->head == nullptr) {
+        return std::allocator_traits<Alloc>::allocate(allocator_, n);
+      }
+    }
+    void* block = list->head;
+    list->head = Next(block);
+    list->count--;
+    return static_cast<T*>(block);
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    internal::RecyclingList* list = Recycles(n) ? List(n) : nullptr;
+    if (list == nullptr) {
+      std::allocator_traits<Alloc>::deallocate(allocator_, ptr, n);
+      return;
+    }
+    SetNext(ptr, list->head);
+    list->head = ptr;
+    if (++list->count == 2 * kRecyclingBatch) {
+      Flush(*list);
+    }
+  }
+
+  template <typename U>
+  struct rebind {
+    using other = RecyclingAllocator<
+        U, typename std::allocator_traits<Alloc>::template rebind_alloc<U>>;
+  };
+
+  template <typename U, typename UAlloc>
+  bool operator==(const RecyclingAllocator<U, UAlloc>& other) const {
+    return allocator_ == other.allocator_;
+  }
+  template <typename U, typename UAlloc>
+  bool operator!=(const RecyclingAllocator<U, UAlloc>& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  using Shards = internal::ThreadShards<internal::RecyclingShard,
+                                        RecyclingAllocator<T, Alloc>>;
+
+  static bool Recycles(size_t n) {
+    return n * sizeof(T) >= sizeof(void*) && n * sizeof(T) <= kMaxRecycledBytes;
+  }
+
+  // Blocks aren't necessarily aligned for a pointer, so links are copied.
+  static void* Next(void* block) {
+    void* next;
+    std::memcpy(&next, block, sizeof(next));
+    return next;
+  }
+  static void SetNext(void* block, void* next) {
+    std::memcpy(block, &next, sizeof(next));
+  }
+
+  // Returns the list of the calling thread for blocks of `n` elements. If
+  // there is none, takes over an empty one, or returns `nullptr` if all are
+  // in use.
+  static internal::RecyclingList* List(size_t n) {
+    internal::RecyclingShard& shard = Shards::Local();
+    internal::RecyclingList* empty = nullptr;
+    for (internal::RecyclingList& list : shard.lists) {
+      if (list.n == n) {
+        return &list;
+      } else if (empty == nullptr && list.count == 0) {
+        empty = &list;
+      }
+    }
+    if (empty != nullptr) {
+      empty->n = n;
+    }
+    return empty;
+  }
+
+  static internal::RecyclingDepot& Depot() {
+    // Never destroyed, as blocks can be deallocated by other static objects.
+    static internal::RecyclingDepot* depot = new internal::RecyclingDepot();
+    return *depot;
+  }
+
+  // Moves a batch from the depot to the empty `list`, if there is one.
+  static void Refill(internal::RecyclingList& list) {
+    internal::RecyclingDepot& depot = Depot();
+    std::lock_guard<std::mutex> lock(depot.mutex);
+    for (auto it = depot.sizes.begin(); it != depot.sizes.end(); ++it) {
+      if (it->n == list.n && !it->heads.empty()) {
+        list.head = it->heads.back();
+        list.count = kRecyclingBatch;
+        it->heads.pop_back();
+        depot.bytes -= BatchBytes(list.n);
+        // Keeps the number of sizes bounded by the cached batches.
+        if (it->heads.empty()) {
+          depot.sizes.erase(it);
+        }
+        return;
+      }
+    }
+  }
+
+  static size_t BatchBytes(size_t n) {
+    return kRecyclingBatch * n * sizeof(T);
+  }
+
+  // Moves a batch of `list` to the depot, or deallocates it if the depot is
+  // full, either for its size or in total.
+  void Flush(internal::RecyclingList& list) {
+    void* batch = list.head;
+    void* last = batch;
+    for (size_t i = 1; i < kRecyclingBatch; i++) {
+      last = Next(last);
+    }
+    list.head = Next(last);
+    list.count -= kRecyclingBatch;
+    SetNext(last, nullptr);
+    {
+      internal::RecyclingDepot& depot = Depot();
+      std::lock_guard<std::mutex> lock(depot.mutex);
+      internal::RecyclingDepot::Batches* batches = nullptr;
+      for (auto& size : depot.sizes) {
+        if (size.n == list.n) {
+          batches = &size;
+          break;
+        }
+      }
+      if (batches == nullptr) {
+        depot.sizes.push_back({list.n, {}});
+        batches = &depot.sizes.back();
+      }
+      if (batches->heads.size() < kRecyclingDepotBatches &&
+          depot.bytes + BatchBytes(list.n) <= kMaxRecyclingDepotBytes) {
+        batches->heads.push_back(batch);
+        depot.bytes += BatchBytes(list.n);
+        return;
+      }
+    }
+    while (batch != nullptr) {
+      void* next = Next(batch);
+      std::allocator_traits<Alloc>::deallocate(allocator_,
+                                               static_cast<T*>(batch), list.n);
+      batch = next;
+    }
+  }
+
+  Alloc allocator_;
+
+  template <typename U, typename UAlloc>
+  friend class RecyclingAllocator;
+};
+
+}  // namespace refptr
+
+#endif  // _RECYCLING_ALLOCATOR_H
@@ -0,0 +1,151 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "recycling_allocator.h"
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "counting_allocator.h"
+#include "gtest/gtest.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct Msg {
+  explicit Msg(int value_) : value(value_) {}
+
+  int value;
+};
+
+// Every test uses a separate `Tag`, so that it has its own caches.
+template <typename Tag>
+using Recycling = RecyclingAllocator<char, CountingAllocator<char, Tag>>;
+
+template <typename Tag>
+AllocationStats Since(const AllocationStats& before) {
+  return AllocationCounter<Tag>::Snapshot().Since(before);
+}
+
+TEST(RecyclingAllocatorTest, ReusesBlocksOfTheSameSize) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  Recycling<Tag> allocator;
+  char* block = allocator.allocate(100);
+  allocator.deallocate(block, 100);
+  EXPECT_EQ(allocator.allocate(100), block);
+  char* other = allocator.allocate(200);
+  EXPECT_NE(other, block);
+  EXPECT_EQ(Since<Tag>(before).allocations, 2);
+  allocator.deallocate(block, 100);
+  allocator.deallocate(other, 200);
+  EXPECT_EQ(Since<Tag>(before).deallocations, 0);
+}
+
+TEST(RecyclingAllocatorTest, MakeRefCountedChurnAllocatesOnce) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  for (int i = 0; i < 1000; i++) {
+    char* array;
+    auto msg = MakeRefCounted<Msg, char, int>(64, array, int{i},
+                                              Recycling<Tag>());
+    std::memset(array, 'x', 64);
+    EXPECT_EQ(msg->value, i);
+  }
+  EXPECT_EQ(Since<Tag>(before).allocations, 1);
+  EXPECT_EQ(Since<Tag>(before).deallocations, 0);
+}
+
+TEST(RecyclingAllocatorTest, BoundsCachedBlocks) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  Recycling<Tag> allocator;
+  std::vector<char*> blocks;
+  for (int i = 0; i < 5000; i++) {
+    blocks.push_back(allocator.allocate(16));
+  }
+  for (char* block : blocks) {
+    allocator.deallocate(block, 16);
+  }
+  EXPECT_LT(Since<Tag>(before).live_allocations(),
+            static_cast<int64_t>((kRecyclingDepotBatches + 2) *
+                                 kRecyclingBatch));
+}
+
+TEST(RecyclingAllocatorTest, BoundsDepotBytes) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  Recycling<Tag> allocator;
+  // Would fill `kRecyclingDepotBatches` without the byte limit.
+  const size_t n = kMaxRecycledBytes;
+  std::vector<char*> blocks;
+  for (size_t i = 0; i < (kRecyclingDepotBatches + 2) * kRecyclingBatch; i++) {
+    blocks.push_back(allocator.allocate(n));
+  }
+  for (char* block : blocks) {
+    allocator.deallocate(block, n);
+  }
+  EXPECT_LE(Since<Tag>(before).live_bytes(),
+            static_cast<int64_t>(kMaxRecyclingDepotBytes +
+                                 2 * kRecyclingBatch * n));
+}
+
+TEST(RecyclingAllocatorTest, OtherThreadsReuseOverflowingBlocks) {
+  struct Tag {};
+  std::thread producer([] {
+    Recycling<Tag> allocator;
+    std::vector<char*> blocks;
+    for (int i = 0; i < 1000; i++) {
+      blocks.push_back(allocator.allocate(48));
+    }
+    for (char* block : blocks) {
+      allocator.deallocate(block, 48);
+    }
+  });
+  producer.join();
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  Recycling<Tag> allocator;
+  std::vector<char*> blocks;
+  for (int i = 0; i < 900; i++) {
+    blocks.push_back(allocator.allocate(48));
+  }
+  EXPECT_EQ(Since<Tag>(before).allocations, 0);
+  for (char* block : blocks) {
+    allocator.deallocate(block, 48);
+  }
+}
+
+TEST(RecyclingAllocatorTest, PassesThroughUncachedSizes) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  Recycling<Tag> allocator;
+  // Occupies all the lists of this thread.
+  std::vector<char*> blocks;
+  for (int i = 0; i < kRecyclingSizes; i++) {
+    blocks.push_back(allocator.allocate(16 * (i + 1)));
+  }
+  for (int i = 0; i < kRecyclingSizes; i++) {
+    allocator.deallocate(blocks[i], 16 * (i + 1));
+  }
+  allocator.deallocate(allocator.allocate(1000), 1000);
+  allocator.deallocate(allocator.allocate(kMaxRecycledBytes + 1),
+                       kMaxRecycledBytes + 1);
+  allocator.deallocate(allocator.allocate(1), 1);
+  EXPECT_EQ(Since<Tag>(before).deallocations, 3);
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,72 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Churn of `MakeRefCounted<Msg, char>` blocks of a fixed length with
+// `std::allocator` and `RecyclingAllocator`: Each step replaces the oldest of
+// a window of live messages by a new one.
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "recycling_allocator.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+constexpr size_t kWindow = 256;
+
+struct Msg {
+  explicit Msg(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+// Argument: The length of the payload in bytes.
+template <typename Alloc>
+void BM_Churn(benchmark::State& state) {
+  using MsgRef = Ref<const Msg, VarAllocator<char, Alloc, Msg>>;
+  const size_t length = static_cast<size_t>(state.range(0));
+  auto make = [length]() {
+    char* array;
+    auto msg =
+        MakeRefCounted<Msg, char, size_t>(length, array, size_t{length},
+                                          Alloc());
+    std::memset(array, 0, length < 64 ? length : 64);
+    return MsgRef(std::move(msg));
+  };
+  std::vector<MsgRef> window;
+  for (size_t i = 0; i < kWindow; i++) {
+    window.push_back(make());
+  }
+  size_t oldest = 0;
+  for (auto _ : state) {
+    window[oldest] = make();
+    oldest = (oldest + 1) % kWindow;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Churn, std::allocator<Msg>)
+    ->RangeMultiplier(4)
+    ->Range(16, 4096);
+BENCHMARK_TEMPLATE(BM_Churn, RecyclingAllocator<Msg>)
+    ->RangeMultiplier(4)
+    ->Range(16, 4096);
+
+}  // namespace
+}  // namespace refptr
@@ -28,6 +28,7 @@
 #include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <new>
 #include <type_traits>
@@ -38,6 +39,11 @@
 #include "absl/utility/utility.h"
 #include "reference_counted.h"
 
+// Abseil releases before LTS 2023 lack this attribute.
+#ifndef ABSL_ATTRIBUTE_TRIVIAL_ABI
+#define ABSL_ATTRIBUTE_TRIVIAL_ABI
+#endif
+
 namespace refptr {
 
 template <typename T, typename Alloc>
@@ -67,10 +73,15 @@ class ABSL_ATTRIBUTE_TRIVIAL_ABI RefBase<T, Alloc, OwnershipTraits::shared> {
   RefBase(RefBase &&other) { (*this) = std::move(other); }
 
   inline RefBase &operator=(RefBase const &other) {
-    Clear();
-    if ((buffer_ = other.buffer_) != nullptr) {
-      buffer_->refcount.Inc();
+    // Takes the new reference before releasing the old one, so that
+    // self-assignment keeps the block alive.
+    const Refcounted<T, Alloc> *buffer = other.buffer_;
+    if (buffer != nullptr) {
+      internal::RefcountedHooks<T, Alloc>::OnShare(buffer,
+                                                   buffer->refcount.Inc() + 1);
     }
+    Clear();
+    buffer_ = buffer;
     return *this;
   }
   inline RefBase &operator=(RefBase &&other) {
@@ -91,12 +102,18 @@ class ABSL_ATTRIBUTE_TRIVIAL_ABI RefBase<T, Alloc, OwnershipTraits::shared> {
   constexpr explicit RefBase(const Refcounted<T, Alloc> *buffer)
       : buffer_(buffer) {}
 
-  // Deletes the instance pointed to `buffer_` and clears the variable.
+  // Releases the reference held by `buffer_`, deleting the instance if it was
+  // the last one, and clears the variable.
   inline void Clear() {
-    if ((buffer_ != nullptr) && buffer_->refcount.Dec()) {
-      std::move(*const_cast<Refcounted<T, Alloc> *>(buffer_)).SelfDelete();
-      buffer_ = nullptr;
+    if (buffer_ != nullptr) {
+      const int_fast32_t refcount = buffer_->refcount.DecAndGet();
+      if (refcount == 0) {
+        std::move(*const_cast<Refcounted<T, Alloc> *>(buffer_)).SelfDelete();
+      } else {
+        internal::RefcountedHooks<T, Alloc>::OnRelease(buffer_, refcount);
+      }
     }
+    buffer_ = nullptr;
   }
 
   // Clears `buffer_` and returns the original value.
@@ -189,6 +206,19 @@ class ABSL_ATTRIBUTE_TRIVIAL_ABI Ref final
   Ref &operator=(Ref const &other) = default;
   Ref &operator=(Ref &&other) = default;
 
+  // Releases the ownership of the block without modifying its reference
+  // count, for example to pass it through a lock-free queue. The result must
+  // be eventually adopted by the `Ref(Refcounted*)` constructor.
+  Refcounted<typename std::remove_const<T>::type, Alloc> *Release() && {
+    return std::move(*this).move_buffer();
+  }
+
+  // Returns the referenced block, which stays owned by this instance, for
+  // example to locate the array co-allocated with it by `MakeRefCounted`.
+  const Refcounted<typename std::remove_const<T>::type, Alloc> *block() const {
+    return Base::buffer_;
+  }
+
   bool operator==(std::nullptr_t) const { return Base::buffer_ == nullptr; }
   bool operator!=(std::nullptr_t) const { return Base::buffer_ != nullptr; }
 
@@ -0,0 +1,255 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _REF_ARRAY_H
+#define _REF_ARRAY_H
+
+// An immutable, shared array of `Ref<const T>` elements, allocated as a single
+// var-sized block by `MakeRefCounted`. Copying the array increments only its
+// own reference count, not the ones of its elements.
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/types/variant.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+
+namespace internal {
+
+// The header of the block of a `RefArray`. Its elements follow the block.
+// They are stored as raw pointers, as `VarAllocator` requires a trivially
+// destructible array type, and each holds one reference to its block.
+struct RefArrayHeader {
+  explicit RefArrayHeader(size_t size_) : size(size_) {}
+
+  size_t size;
+};
+
+// Allocates `RefArray` blocks by `Alloc`. When `Refcounted::SelfDelete`
+// offers a block to `Recycle` right before destroying it, releases its
+// elements of type `Ref<const T, TAlloc>`, which `RefArrayHeader` can't reach
+// from its destructor.
+template <typename U, typename Alloc, typename T, typename TAlloc>
+class RefArrayAllocator {
+ public:
+  using value_type = U;
+  using ElementBlock = Refcounted<T, TAlloc>;
+
+  RefArrayAllocator() = default;
+  explicit RefArrayAllocator(Alloc allocator)
+      : allocator_(std::move(allocator)) {}
+  template <typename V, typename VAlloc>
+  RefArrayAllocator(const RefArrayAllocator<V, VAlloc, T, TAlloc>& other)
+      : allocator_(other.allocator()) {}
+
+  const Alloc& allocator() const { return allocator_; }
+
+  U* allocate(size_t n) {
+    return std::allocator_traits<Alloc>::allocate(allocator_, n);
+  }
+  void deallocate(U* ptr, size_t n) {
+    std::allocator_traits<Alloc>::deallocate(allocator_, ptr, n);
+  }
+
+  // Releases the elements and lets the block be destroyed.
+  template <typename Block>
+  bool Recycle(Block* block) {
+    ElementBlock** elements = Elements(block);
+    for (size_t i = 0; i < block->nested.size; i++) {
+      Ref<const T, TAlloc> released(elements[i]);
+    }
+    return false;
+  }
+
+  // `VarAllocator` places the elements right after the block, as their
+  // alignment doesn't exceed the block's.
+  template <typename Block>
+  static ElementBlock** Elements(const Block* block) {
+    return reinterpret_cast<ElementBlock**>(const_cast<Block*>(block) + 1);
+  }
+
+  template <typename V>
+  struct rebind {
+    using other = RefArrayAllocator<
+        V, typename std::allocator_traits<Alloc>::template rebind_alloc<V>, T,
+        TAlloc>;
+  };
+
+  template <typename V, typename VAlloc>
+  bool operator==(const RefArrayAllocator<V, VAlloc, T, TAlloc>& other) const {
+    return allocator_ == other.allocator();
+  }
+  template <typename V, typename VAlloc>
+  bool operator!=(const RefArrayAllocator<V, VAlloc, T, TAlloc>& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  Alloc allocator_;
+};
+
+}  // namespace internal
+
+// Elements are `Ref<const T, Alloc>`, and the block is allocated by
+// `ArrayAlloc`.
+template <typename T, typename Alloc = std::allocator<T>,
+          typename ArrayAlloc = std::allocator<T>>
+class RefArray {
+ private:
+  using Header = internal::RefArrayHeader;
+  using BlockAlloc = internal::RefArrayAllocator<Header, ArrayAlloc, T, Alloc>;
+  using Block = typename BlockAlloc::ElementBlock;
+  using HeaderAlloc = VarAllocator<Block*, BlockAlloc, Header>;
+
+ public:
+  using value_type = T;
+  using Element = Ref<const T, Alloc>;
+
+  // Iterates over the elements as `const T&`.
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+
+    const T& operator*() const { return (*position_)->nested; }
+    const T* operator->() const { return &(*position_)->nested; }
+
+    const_iterator& operator++() {
+      ++position_;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator copy = *this;
+      ++position_;
+      return copy;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return position_ == other.position_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return position_ != other.position_;
+    }
+
+   private:
+    explicit const_iterator(Block* const* position) : position_(position) {}
+
+    Block* const* position_;
+
+    friend class RefArray;
+  };
+
+  // Takes over the references of `elements`, which must be non-null, with a
+  // single allocation from `alloc`. Pass `elements` by `std::move` to avoid
+  // incrementing their reference counts.
+  explicit RefArray(std::vector<Element> elements,
+                    ArrayAlloc alloc = ArrayAlloc())
+      : header_(Make(std::move(elements), std::move(alloc))) {}
+
+  // A moved-from array is empty and holds no block.
+  RefArray(const RefArray&) = default;
+  RefArray(RefArray&&) = default;
+  RefArray& operator=(const RefArray&) = default;
+  RefArray& operator=(RefArray&&) = default;
+
+  size_t size() const { return header_ == nullptr ? 0 : header_->size; }
+  bool empty() const { return size() == 0; }
+
+  const T& operator[](size_t i) const {
+    assert(i < size());
+    return elements()[i]->nested;
+  }
+
+  // Returns a new reference to element `i`.
+  Element Get(size_t i) const {
+    assert(i < size());
+    return Share(elements()[i]);
+  }
+
+  const_iterator begin() const { return const_iterator(elements()); }
+  const_iterator end() const { return const_iterator(elements() + size()); }
+
+  // Consumes the array and returns its elements. If this was the last
+  // reference to the array, its references to the elements are moved to the
+  // result without touching their reference counts. Otherwise they are
+  // copied.
+  std::vector<Element> ToVector() && {
+    std::vector<Element> result;
+    if (header_ == nullptr) {
+      return result;
+    }
+    result.reserve(size());
+    auto claimed = std::move(header_).AttemptToClaim();
+    if (auto* unique = absl::get_if<Ref<Header, HeaderAlloc>>(&claimed)) {
+      Block** elements = BlockAlloc::Elements(unique->block());
+      for (size_t i = 0; i < (*unique)->size; i++) {
+        result.emplace_back(elements[i]);
+      }
+      (*unique)->size = 0;
+    } else {
+      RefArray shared(absl::get<Ref<const Header, HeaderAlloc>>(
+          std::move(claimed)));
+      for (size_t i = 0; i < shared.size(); i++) {
+        result.push_back(shared.Get(i));
+      }
+    }
+    return result;
+  }
+
+ private:
+  explicit RefArray(Ref<const Header, HeaderAlloc> header)
+      : header_(std::move(header)) {}
+
+  Block* const* elements() const {
+    return header_ == nullptr ? nullptr : BlockAlloc::Elements(header_.block());
+  }
+
+  // Returns a new reference to `block`, which stays referenced by the array.
+  static Element Share(Block* block) {
+    internal::RefcountedHooks<T, Alloc>::OnShare(block,
+                                                 block->refcount.Inc() + 1);
+    return Element(block);
+  }
+
+  static Ref<const Header, HeaderAlloc> Make(std::vector<Element> elements,
+                                             ArrayAlloc alloc) {
+    Block** array;
+    Ref<Header, HeaderAlloc> header =
+        MakeRefCounted<Header, Block*, size_t>(
+            elements.size(), array, elements.size(),
+            BlockAlloc(std::move(alloc)));
+    assert(array == BlockAlloc::Elements(header.block()));
+    for (size_t i = 0; i < elements.size(); i++) {
+      assert(elements[i] != nullptr);
+      array[i] = std::move(elements[i]).Release();
+    }
+    return std::move(header).Share();
+  }
+
+  Ref<const Header, HeaderAlloc> header_;
+};
+
+}  // namespace refptr
+
+#endif  // _REF_ARRAY_H
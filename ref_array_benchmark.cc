@@ -0,0 +1,80 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copying and dropping collections of `Ref<const T>`: A `std::vector`, which
+// allocates and increments and decrements every element, and a `RefArray`,
+// which only increments and decrements its own reference count.
+
+#include <cstdint>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "ref.h"
+#include "ref_array.h"
+
+namespace refptr {
+namespace {
+
+struct Payload {
+  explicit Payload(int64_t value_) : value(value_) {}
+
+  int64_t value;
+};
+
+std::vector<Ref<const Payload>> MakeElements(int64_t count) {
+  std::vector<Ref<const Payload>> elements;
+  for (int64_t i = 0; i < count; i++) {
+    elements.push_back(New<Payload>(i).Share());
+  }
+  return elements;
+}
+
+// Argument: The number of elements.
+void BM_CopyVector(benchmark::State& state) {
+  const std::vector<Ref<const Payload>> elements = MakeElements(state.range(0));
+  for (auto _ : state) {
+    std::vector<Ref<const Payload>> copy = elements;
+    benchmark::DoNotOptimize(copy.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CopyVector)->RangeMultiplier(10)->Range(1, 10000);
+
+// Argument: The number of elements.
+void BM_CopyRefArray(benchmark::State& state) {
+  const RefArray<Payload> elements(MakeElements(state.range(0)));
+  for (auto _ : state) {
+    RefArray<Payload> copy = elements;
+    benchmark::DoNotOptimize(&copy);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CopyRefArray)->RangeMultiplier(10)->Range(1, 10000);
+
+// Argument: The number of elements.
+void BM_IterateRefArray(benchmark::State& state) {
+  const RefArray<Payload> elements(MakeElements(state.range(0)));
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const Payload& payload : elements) {
+      sum += payload.value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_IterateRefArray)->RangeMultiplier(10)->Range(1, 10000);
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,141 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ref_array.h"
+
+#include <utility>
+#include <vector>
+
+#include "counting_allocator.h"
+#include "gtest/gtest.h"
+
+namespace refptr {
+namespace {
+
+struct Foo {
+  Foo(int& counter, int value_) : counter_(counter), value(value_) {
+    counter_++;
+  }
+  ~Foo() { counter_--; }
+
+  int& counter_;
+  int value;
+};
+
+class RefArrayTest : public testing::Test {
+ protected:
+  RefArrayTest() : counter_(0) {}
+
+  void TearDown() override { EXPECT_EQ(counter_, 0); }
+
+  std::vector<Ref<const Foo>> MakeElements(int count) {
+    std::vector<Ref<const Foo>> elements;
+    for (int i = 0; i < count; i++) {
+      elements.push_back(New<Foo>(counter_, i).Share());
+    }
+    return elements;
+  }
+
+  int counter_;
+};
+
+TEST_F(RefArrayTest, HoldsElements) {
+  RefArray<Foo> array(MakeElements(5));
+  EXPECT_EQ(counter_, 5);
+  ASSERT_EQ(array.size(), 5);
+  EXPECT_FALSE(array.empty());
+  int expected = 0;
+  for (const Foo& foo : array) {
+    EXPECT_EQ(foo.value, expected++);
+  }
+  EXPECT_EQ(array[3].value, 3);
+  Ref<const Foo> element = array.Get(2);
+  EXPECT_EQ(element->value, 2);
+}
+
+TEST_F(RefArrayTest, Empty) {
+  RefArray<Foo> array(MakeElements(0));
+  EXPECT_TRUE(array.empty());
+  EXPECT_EQ(array.begin(), array.end());
+}
+
+TEST_F(RefArrayTest, CopiesShareTheBlock) {
+  std::vector<Ref<const Foo>> elements = MakeElements(3);
+  RefArray<Foo> array(elements);
+  {
+    RefArray<Foo> copy = array;
+    EXPECT_EQ(&copy[1], &array[1]);
+  }
+  elements.clear();
+  EXPECT_EQ(counter_, 3);
+  {
+    RefArray<Foo> moved = std::move(array);
+    EXPECT_EQ(moved[2].value, 2);
+  }
+  EXPECT_EQ(counter_, 0);
+}
+
+TEST_F(RefArrayTest, MovedFromIsEmpty) {
+  RefArray<Foo> array(MakeElements(2));
+  RefArray<Foo> moved = std::move(array);
+  EXPECT_TRUE(array.empty());
+  EXPECT_EQ(array.begin(), array.end());
+  EXPECT_TRUE(std::move(array).ToVector().empty());
+  EXPECT_EQ(moved.size(), 2);
+}
+
+TEST_F(RefArrayTest, ElementsOutliveTheArray) {
+  Ref<const Foo> element = RefArray<Foo>(MakeElements(3)).Get(1);
+  EXPECT_EQ(counter_, 1);
+  EXPECT_EQ(element->value, 1);
+}
+
+TEST_F(RefArrayTest, ToVectorOfUniqueArrayAdoptsElements) {
+  RefArray<Foo> array(MakeElements(4));
+  const Foo* first = &array[0];
+  std::vector<Ref<const Foo>> elements = std::move(array).ToVector();
+  ASSERT_EQ(elements.size(), 4);
+  EXPECT_EQ(&*elements[0], first);
+  // The elements are unique again.
+  auto claimed = std::move(elements[0]).AttemptToClaim();
+  EXPECT_TRUE(absl::holds_alternative<Ref<Foo>>(claimed));
+  EXPECT_EQ(counter_, 4);
+}
+
+TEST_F(RefArrayTest, ToVectorOfSharedArrayCopiesElements) {
+  RefArray<Foo> array(MakeElements(4));
+  RefArray<Foo> copy = array;
+  std::vector<Ref<const Foo>> elements = std::move(copy).ToVector();
+  ASSERT_EQ(elements.size(), 4);
+  EXPECT_EQ(&*elements[3], &array[3]);
+  auto claimed = std::move(elements[0]).AttemptToClaim();
+  EXPECT_TRUE(absl::holds_alternative<Ref<const Foo>>(claimed));
+}
+
+TEST_F(RefArrayTest, AllocatesOnceWithAllocator) {
+  struct Tag {};
+  const AllocationStats before = AllocationCounter<Tag>::Snapshot();
+  {
+    RefArray<Foo, std::allocator<Foo>, CountingAllocator<Foo, Tag>> array(
+        MakeElements(100), CountingAllocator<Foo, Tag>());
+    const AllocationStats stats =
+        AllocationCounter<Tag>::Snapshot().Since(before);
+    EXPECT_EQ(stats.allocations, 1);
+    EXPECT_GE(stats.allocated_bytes, 100 * sizeof(void*));
+  }
+  EXPECT_EQ(AllocationCounter<Tag>::Snapshot().Since(before).live_bytes(), 0);
+}
+
+}  // namespace
+}  // namespace refptr
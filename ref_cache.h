@@ -0,0 +1,215 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _REF_CACHE_H
+#define _REF_CACHE_H
+
+// A thread-safe cache of immutable `Ref<const V>` values with a capacity in
+// bytes, evicting the least recently used entries. Each entry is charged the
+// bytes actually allocated for its block, so var-sized values created by
+// `MakeRefCounted` are charged their full length:
+//
+//     RefCache<std::string, Record, VarAllocator<char, ...>> cache(1 << 20);
+//     char* array;
+//     cache.Insert("key", MakeRefCounted<Record, char>(length, array).Share());
+//     absl::optional<Ref<const Record, ...>> hit = cache.Find("key");
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/types/optional.h"
+#include "absl/types/variant.h"
+#include "ref.h"
+#include "reference_counted.h"
+
+namespace refptr {
+
+// The number of independently locked shards of a `RefCache`.
+constexpr size_t kRefCacheShards = 16;
+
+// Maps keys `K` to values `Ref<const V, Alloc>`. Lookups return new
+// references to the cached blocks, never copies of the values. All methods
+// are thread-safe.
+//
+// Keys are distributed by their hash into `kRefCacheShards` shards, each with
+// its own lock, recency list and an equal part of the capacity. An entry is
+// charged `AllocatedBytes` of its block's allocator, which is the whole block
+// for `VarAllocator` and `sizeof(Refcounted<V, Alloc>)` for others. The
+// bookkeeping of entries isn't charged.
+//
+// If constructed with `keep_referenced`, an entry isn't evicted while any
+// reference to its value exists outside of the cache. Such entries are
+// skipped, and a shard can exceed its capacity if all its entries are
+// referenced.
+template <typename K, typename V, typename Alloc = std::allocator<V>,
+          typename Hash = absl::Hash<K>, typename Eq = std::equal_to<K>>
+class RefCache {
+ public:
+  using Value = Ref<const V, Alloc>;
+
+  explicit RefCache(size_t capacity_bytes, bool keep_referenced = false)
+      : shard_capacity_(capacity_bytes / kRefCacheShards),
+        keep_referenced_(keep_referenced) {}
+
+  RefCache(const RefCache&) = delete;
+  RefCache& operator=(const RefCache&) = delete;
+
+  // Returns the value of `key` and marks it as the most recently used, or
+  // `absl::nullopt` if it isn't cached.
+  absl::optional<Value> Find(const K& key) {
+    Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      return absl::nullopt;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return it->second->value;
+  }
+
+  // Caches `value`, which must be non-null, under `key`, replacing any
+  // previous value, and evicts least recently used entries of its shard until
+  // it fits its capacity. Evicted values are released after unlocking the
+  // shard.
+  void Insert(K key, Value value) {
+    assert(value != nullptr);
+    const size_t bytes = ChargedBytes(value);
+    Shard& shard = ShardOf(key);
+    std::vector<Value> evicted;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      Entry& entry = *it->second;
+      Charge(shard, -static_cast<ptrdiff_t>(entry.bytes));
+      evicted.push_back(std::move(entry.value));
+      entry.value = std::move(value);
+      entry.bytes = bytes;
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    } else {
+      shard.entries.push_front(Entry{key, std::move(value), bytes});
+      shard.index.emplace(std::move(key), shard.entries.begin());
+    }
+    Charge(shard, static_cast<ptrdiff_t>(bytes));
+    Evict(shard, evicted);
+  }
+
+  // Removes `key`, if cached, and returns whether it was.
+  bool Erase(const K& key) {
+    Shard& shard = ShardOf(key);
+    absl::optional<Value> erased;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      return false;
+    }
+    Charge(shard, -static_cast<ptrdiff_t>(it->second->bytes));
+    erased = std::move(it->second->value);
+    shard.entries.erase(it->second);
+    shard.index.erase(it);
+    shard.size.store(shard.index.size(), std::memory_order_relaxed);
+    return true;
+  }
+
+  // The sum of bytes charged to all cached entries.
+  size_t charged_bytes() const {
+    size_t bytes = 0;
+    for (const Shard& shard : shards_) {
+      bytes += shard.bytes.load(std::memory_order_relaxed);
+    }
+    return bytes;
+  }
+
+  size_t size() const {
+    size_t size = 0;
+    for (const Shard& shard : shards_) {
+      size += shard.size.load(std::memory_order_relaxed);
+    }
+    return size;
+  }
+
+  // Returns the bytes an entry with `value` is charged.
+  static size_t ChargedBytes(const Value& value) {
+    return internal::AllocatedBytes(value.block()->Allocator(), 1);
+  }
+
+ private:
+  struct Entry {
+    K key;
+    Value value;
+    size_t bytes;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    // Ordered from the most to the least recently used.
+    std::list<Entry> entries;
+    absl::flat_hash_map<K, typename std::list<Entry>::iterator, Hash, Eq>
+        index;
+    // Updated under `mutex`, read without it.
+    std::atomic<size_t> bytes{0};
+    std::atomic<size_t> size{0};
+  };
+
+  Shard& ShardOf(const K& key) {
+    // Uses the high bits, as `absl::flat_hash_map` uses the low ones.
+    const size_t hash = Hash()(key);
+    return shards_[(hash >> (8 * sizeof(size_t) - 8)) % kRefCacheShards];
+  }
+
+  static void Charge(Shard& shard, ptrdiff_t bytes) {
+    shard.bytes.store(shard.bytes.load(std::memory_order_relaxed) + bytes,
+                      std::memory_order_relaxed);
+  }
+
+  // Evicts entries from the back of `shard.entries` until it fits
+  // `shard_capacity_`, except for the most recently used one, moving their
+  // values to `evicted`.
+  void Evict(Shard& shard, std::vector<Value>& evicted) {
+    auto it = shard.entries.end();
+    while (shard.bytes.load(std::memory_order_relaxed) > shard_capacity_ &&
+           --it != shard.entries.begin()) {
+      if (keep_referenced_) {
+        // The cache's reference is the only one iff it can be claimed.
+        auto claimed = std::move(it->value).AttemptToClaim();
+        if (auto* shared = absl::get_if<Value>(&claimed)) {
+          it->value = std::move(*shared);
+          continue;
+        }
+        it->value = Value(absl::get<Ref<V, Alloc>>(std::move(claimed)));
+      }
+      Charge(shard, -static_cast<ptrdiff_t>(it->bytes));
+      evicted.push_back(std::move(it->value));
+      shard.index.erase(it->key);
+      it = shard.entries.erase(it);
+    }
+    shard.size.store(shard.index.size(), std::memory_order_relaxed);
+  }
+
+  const size_t shard_capacity_;
+  const bool keep_referenced_;
+  Shard shards_[kRefCacheShards];
+};
+
+}  // namespace refptr
+
+#endif  // _REF_CACHE_H
@@ -0,0 +1,189 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput of cache hits by 1 to 16 threads, comparing `RefCache` to an LRU
+// cache of `std::shared_ptr` behind a single mutex, and the accuracy of the
+// bytes `RefCache` charges compared to the bytes actually allocated.
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "counting_allocator.h"
+#include "ref_cache.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+constexpr int kKeys = 4096;
+constexpr int kLookupsPerThread = 4096;
+
+struct Record {
+  explicit Record(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+struct CacheTag {};
+
+using RecordAlloc = VarAllocator<char, CountingAllocator<Record, CacheTag>,
+                                 Record>;
+
+class RefCacheBackend {
+ public:
+  using Value = RefCache<int, Record, RecordAlloc>::Value;
+
+  RefCacheBackend() : cache_(size_t{1} << 30) {
+    for (int i = 0; i < kKeys; i++) {
+      char* array;
+      cache_.Insert(i, MakeRefCounted<Record, char, size_t>(
+                           64, array, 64, CountingAllocator<Record, CacheTag>())
+                           .Share());
+    }
+  }
+
+  bool Find(int key) {
+    absl::optional<Value> value = cache_.Find(key);
+    return value.has_value() && (*value)->length > 0;
+  }
+
+ private:
+  RefCache<int, Record, RecordAlloc> cache_;
+};
+
+// An LRU cache bounded by the number of entries, with a single lock.
+class MutexLruBackend {
+ public:
+  using Value = std::shared_ptr<const std::string>;
+
+  MutexLruBackend() {
+    for (int i = 0; i < kKeys; i++) {
+      entries_.emplace_front(i, std::make_shared<const std::string>(64, 'x'));
+      index_.emplace(i, entries_.begin());
+    }
+  }
+
+  bool Find(int key) {
+    Value value;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = index_.find(key);
+      if (it == index_.end()) {
+        return false;
+      }
+      entries_.splice(entries_.begin(), entries_, it->second);
+      value = it->second->second;
+    }
+    return !value->empty();
+  }
+
+ private:
+  using Entry = std::pair<int, Value>;
+
+  std::mutex mutex_;
+  std::list<Entry> entries_;
+  std::unordered_map<int, std::list<Entry>::iterator> index_;
+};
+
+template <typename B>
+void BM_Hit(benchmark::State& state) {
+  static B* backend;
+  if (state.thread_index() == 0) {
+    backend = new B();
+  }
+  std::mt19937 random(static_cast<unsigned>(state.thread_index()));
+  std::uniform_int_distribution<int> distribution(0, kKeys - 1);
+  std::vector<int> keys;
+  for (int i = 0; i < kLookupsPerThread; i++) {
+    keys.push_back(distribution(random));
+  }
+  for (auto _ : state) {
+    int hits = 0;
+    for (int key : keys) {
+      hits += backend->Find(key);
+    }
+    benchmark::DoNotOptimize(hits);
+  }
+  state.SetItemsProcessed(state.iterations() * kLookupsPerThread);
+  if (state.thread_index() == 0) {
+    delete backend;
+  }
+}
+BENCHMARK_TEMPLATE(BM_Hit, RefCacheBackend)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Hit, MutexLruBackend)->ThreadRange(1, 16)->UseRealTime();
+
+// Fills a cache of `range(0)` bytes with records of 1 to `range(1)` bytes.
+// Reports the bytes charged by the cache, the bytes live in its allocator,
+// and the relative error of estimating entries as `sizeof(Record)` plus their
+// length, which ignores the `Refcounted` header and the padding.
+void BM_Accounting(benchmark::State& state) {
+  const size_t capacity = static_cast<size_t>(state.range(0));
+  std::uniform_int_distribution<size_t> lengths(
+      1, static_cast<size_t>(state.range(1)));
+  double charged = 0;
+  double allocated = 0;
+  double estimated = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::mt19937 random(42);
+    const AllocationStats before = AllocationCounter<CacheTag>::Snapshot();
+    state.ResumeTiming();
+    RefCache<int, Record, RecordAlloc> cache(capacity);
+    size_t total_length = 0;
+    for (int i = 0; i < kKeys; i++) {
+      const size_t length = lengths(random);
+      char* array;
+      cache.Insert(i, MakeRefCounted<Record, char, const size_t&>(
+                          length, array, length,
+                          CountingAllocator<Record, CacheTag>())
+                          .Share());
+      total_length += length;
+    }
+    state.PauseTiming();
+    charged = static_cast<double>(cache.charged_bytes());
+    allocated = static_cast<double>(
+        AllocationCounter<CacheTag>::Snapshot().Since(before).live_bytes());
+    estimated = 0;
+    for (int i = 0; i < kKeys; i++) {
+      absl::optional<RefCache<int, Record, RecordAlloc>::Value> value =
+          cache.Find(i);
+      if (value.has_value()) {
+        estimated += sizeof(Record) + (*value)->length;
+      }
+    }
+    state.ResumeTiming();
+  }
+  state.counters["charged_bytes"] = charged;
+  state.counters["allocated_bytes"] = allocated;
+  state.counters["charged_error_pct"] =
+      100 * (charged - allocated) / allocated;
+  state.counters["estimate_error_pct"] =
+      100 * (estimated - allocated) / allocated;
+  state.SetItemsProcessed(state.iterations() * kKeys);
+}
+BENCHMARK(BM_Accounting)
+    ->Args({1 << 16, 16})
+    ->Args({1 << 16, 256})
+    ->Args({1 << 20, 1024});
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,142 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ref_cache.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "counting_allocator.h"
+#include "gtest/gtest.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+struct Record {
+  explicit Record(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+struct CacheTag {};
+
+using RecordAlloc = VarAllocator<char, CountingAllocator<Record, CacheTag>,
+                                 Record>;
+using Cache = RefCache<int, Record, RecordAlloc>;
+
+Cache::Value MakeRecord(size_t length) {
+  char* array;
+  return MakeRefCounted<Record, char, const size_t&>(
+             length, array, length, CountingAllocator<Record, CacheTag>())
+      .Share();
+}
+
+TEST(RefCacheTest, FindsInsertedValues) {
+  Cache cache(1 << 20);
+  Cache::Value value = MakeRecord(10);
+  const Record* address = &*value;
+  cache.Insert(1, std::move(value));
+  EXPECT_EQ(cache.size(), 1);
+  absl::optional<Cache::Value> hit = cache.Find(1);
+  ASSERT_TRUE(hit.has_value());
+  EXPECT_EQ(&**hit, address) << "Must not copy the value";
+  EXPECT_EQ(cache.Find(2), absl::nullopt);
+}
+
+TEST(RefCacheTest, ChargesAllocatedBytes) {
+  const AllocationStats before = AllocationCounter<CacheTag>::Snapshot();
+  {
+    Cache cache(1 << 20);
+    for (int i = 0; i < 100; i++) {
+      cache.Insert(i, MakeRecord(static_cast<size_t>(i) * 10));
+    }
+    const AllocationStats stats =
+        AllocationCounter<CacheTag>::Snapshot().Since(before);
+    EXPECT_EQ(cache.charged_bytes(), stats.live_bytes());
+    EXPECT_GE(cache.charged_bytes(), 100 * sizeof(Record) + 49500);
+    cache.Insert(0, MakeRecord(1000));
+    EXPECT_EQ(cache.charged_bytes(),
+              AllocationCounter<CacheTag>::Snapshot().Since(before)
+                  .live_bytes());
+    EXPECT_TRUE(cache.Erase(0));
+    EXPECT_FALSE(cache.Erase(0));
+    EXPECT_EQ(cache.size(), 99);
+    EXPECT_EQ(cache.charged_bytes(),
+              AllocationCounter<CacheTag>::Snapshot().Since(before)
+                  .live_bytes());
+  }
+  EXPECT_EQ(AllocationCounter<CacheTag>::Snapshot().Since(before).live_bytes(),
+            0);
+}
+
+// Keeps small keys in a single shard.
+struct IdentityHash {
+  size_t operator()(int key) const { return static_cast<size_t>(key); }
+};
+
+using SingleShardCache = RefCache<int, Record, RecordAlloc, IdentityHash>;
+
+// Returns a capacity for which each shard fits 3 records of `length`.
+size_t CapacityForThree(size_t length) {
+  return kRefCacheShards * 7 * Cache::ChargedBytes(MakeRecord(length)) / 2;
+}
+
+TEST(RefCacheTest, EvictsLeastRecentlyUsed) {
+  SingleShardCache cache(CapacityForThree(100));
+  cache.Insert(1, MakeRecord(100));
+  cache.Insert(2, MakeRecord(100));
+  cache.Insert(3, MakeRecord(100));
+  ASSERT_TRUE(cache.Find(1).has_value());
+  cache.Insert(4, MakeRecord(100));
+  EXPECT_EQ(cache.size(), 3);
+  EXPECT_TRUE(cache.Find(1).has_value());
+  EXPECT_FALSE(cache.Find(2).has_value());
+  EXPECT_TRUE(cache.Find(3).has_value());
+  EXPECT_TRUE(cache.Find(4).has_value());
+  // A large value evicts more entries.
+  cache.Insert(5, MakeRecord(400));
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_TRUE(cache.Find(5).has_value());
+}
+
+TEST(RefCacheTest, KeepsReferencedEntries) {
+  SingleShardCache cache(CapacityForThree(100), /*keep_referenced=*/true);
+  cache.Insert(1, MakeRecord(100));
+  cache.Insert(2, MakeRecord(100));
+  cache.Insert(3, MakeRecord(100));
+  absl::optional<Cache::Value> reader = cache.Find(1);
+  cache.Insert(4, MakeRecord(100));
+  cache.Insert(5, MakeRecord(100));
+  // Entries 2 and 3 are evicted instead of the referenced 1.
+  EXPECT_EQ(cache.size(), 3);
+  EXPECT_TRUE(cache.Find(1).has_value());
+  EXPECT_FALSE(cache.Find(2).has_value());
+  EXPECT_FALSE(cache.Find(3).has_value());
+  // With all entries referenced, the cache exceeds its capacity.
+  absl::optional<Cache::Value> reader4 = cache.Find(4);
+  absl::optional<Cache::Value> reader5 = cache.Find(5);
+  cache.Insert(6, MakeRecord(100));
+  EXPECT_EQ(cache.size(), 4);
+  // Once released, entries are evicted again.
+  reader.reset();
+  cache.Insert(7, MakeRecord(100));
+  EXPECT_EQ(cache.size(), 3);
+  EXPECT_FALSE(cache.Find(1).has_value());
+  EXPECT_FALSE(cache.Find(6).has_value());
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,239 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _REF_POOL_H
+#define _REF_POOL_H
+
+// A pool of var-sized `Refcounted` blocks, for objects that are expensive to
+// construct, such as buffers with large trailing arrays. When the last
+// reference to a block is released, the block returns to the pool instead of
+// being destroyed, and is handed out again by the next `Acquire`:
+//
+//     RefPool<Buffer, char> pool(1 << 20);
+//     char* array;
+//     Ref<const Buffer, ...> buffer = pool.Acquire(array).Share();
+//     ...
+//     buffer = ...;  // Returns the block to `pool`.
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "ref.h"
+#include "reference_counted.h"
+#include "thread_shards.h"
+#include "var_sized.h"
+
+namespace refptr {
+
+// The number of distinct lengths of blocks cached by each thread.
+constexpr int kRefPoolLengths = 4;
+// The number of blocks of each length cached by each thread.
+constexpr size_t kRefPoolThreadBlocks = 4;
+// The total size of blocks of each pool type kept in the global list, after
+// which released blocks are destroyed.
+constexpr size_t kMaxPooledBytes = size_t{64} << 20;
+
+// Leaves pooled objects as they are.
+struct NoPoolReset {
+  template <typename U>
+  void operator()(U&) const {}
+};
+
+namespace internal {
+
+// Allocates by `std::allocator` and lets `Pool` recycle blocks released by
+// `Refcounted::SelfDelete`.
+template <typename T, typename Pool>
+class RefPoolAllocator {
+ public:
+  using value_type = T;
+
+  RefPoolAllocator() = default;
+  template <typename U>
+  RefPoolAllocator(const RefPoolAllocator<U, Pool>&) {}
+
+  T* allocate(size_t n) { return std::allocator<T>().allocate(n); }
+  void deallocate(T* ptr, size_t n) { std::allocator<T>().deallocate(ptr, n); }
+
+  template <typename Block>
+  bool Recycle(Block* block) {
+    return Pool::Recycle(block);
+  }
+
+  template <typename U>
+  struct rebind {
+    using other = RefPoolAllocator<U, Pool>;
+  };
+
+  template <typename U>
+  bool operator==(const RefPoolAllocator<U, Pool>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const RefPoolAllocator<U, Pool>&) const {
+    return false;
+  }
+};
+
+}  // namespace internal
+
+// Hands out blocks of `U` followed by `length()` elements of `B`, as created
+// by `MakeRefCounted<U, B>`. Once a block's reference count drops to zero, its
+// object is passed to `Reset()(U&)` and the block is kept for reuse instead of
+// being destroyed. Objects are constructed only when no block of the same
+// length is available, and destroyed only when the pool is full.
+//
+// Released blocks are first cached by the releasing thread, up to
+// `kRefPoolThreadBlocks` for each of `kRefPoolLengths` lengths, and then in a
+// global list of up to `kMaxPooledBytes`, from which threads with empty caches
+// take blocks. Blocks can be released by any thread.
+//
+// The caches are shared by all instances of the same `RefPool` type, keyed by
+// length, and pooled blocks are never deallocated.
+template <typename U, typename B, typename Reset = NoPoolReset>
+class RefPool {
+ public:
+  using Allocator = VarAllocator<B, internal::RefPoolAllocator<U, RefPool>, U>;
+
+  explicit RefPool(size_t length) : length_(length) {}
+
+  size_t length() const { return length_; }
+
+  // Returns a block with an array of `length()` elements, which is stored in
+  // `array`. Reuses a released block, if available, whose object was reset
+  // by `Reset`. Otherwise constructs a new one from `args`.
+  template <typename... Arg>
+  Ref<U, Allocator> Acquire(B*& array, Arg&&... args) {
+    Block* block = Take(length_);
+    if (block == nullptr) {
+      return MakeRefCounted<U, B, Arg...>(
+          length_, array, std::forward<Arg>(args)...,
+          internal::RefPoolAllocator<U, RefPool>());
+    }
+    block->refcount.Reset();
+    array = block->Allocator().Array(block, 1);
+    return Ref<U, Allocator>(block);
+  }
+
+ private:
+  using Block = Refcounted<U, Allocator>;
+
+  struct List {
+    size_t length = 0;
+    size_t count = 0;
+    Block* blocks[kRefPoolThreadBlocks];
+  };
+
+  struct Shard {
+    List lists[kRefPoolLengths];
+  };
+
+  struct Depot {
+    struct Blocks {
+      size_t length;
+      std::vector<Block*> blocks;
+    };
+
+    std::mutex mutex;
+    size_t bytes = 0;
+    std::vector<Blocks> lengths;
+  };
+
+  using Shards = internal::ThreadShards<Shard, RefPool>;
+
+  // Returns the list of the calling thread for blocks of `length`. If there
+  // is none, takes over an empty one, or returns `nullptr` if all are in use.
+  static List* LocalList(size_t length) {
+    Shard& shard = Shards::Local();
+    List* empty = nullptr;
+    for (List& list : shard.lists) {
+      if (list.length == length) {
+        return &list;
+      } else if (empty == nullptr && list.count == 0) {
+        empty = &list;
+      }
+    }
+    if (empty != nullptr) {
+      empty->length = length;
+    }
+    return empty;
+  }
+
+  static Depot& GlobalDepot() {
+    // Never destroyed, as blocks can be released by other static objects.
+    static Depot* depot = new Depot();
+    return *depot;
+  }
+
+  static typename Depot::Blocks& DepotBlocks(Depot& depot, size_t length) {
+    for (auto& blocks : depot.lengths) {
+      if (blocks.length == length) {
+        return blocks;
+      }
+    }
+    depot.lengths.push_back({length, {}});
+    return depot.lengths.back();
+  }
+
+  // Returns a released block of `length`, or `nullptr` if there is none.
+  static Block* Take(size_t length) {
+    List* list = LocalList(length);
+    if (list != nullptr && list->count > 0) {
+      return list->blocks[--list->count];
+    }
+    Depot& depot = GlobalDepot();
+    std::lock_guard<std::mutex> lock(depot.mutex);
+    auto& blocks = DepotBlocks(depot, length).blocks;
+    if (blocks.empty()) {
+      return nullptr;
+    }
+    Block* block = blocks.back();
+    blocks.pop_back();
+    depot.bytes -= internal::AllocatedBytes(block->Allocator(), 1);
+    return block;
+  }
+
+  // Called by `Refcounted::SelfDelete` through `RefPoolAllocator`. Returns
+  // `false` if the pool is full and `block` is to be destroyed.
+  static bool Recycle(Block* block) {
+    Reset()(block->nested);
+    const size_t length = block->Allocator().GetSize();
+    List* list = LocalList(length);
+    if (list != nullptr && list->count < kRefPoolThreadBlocks) {
+      list->blocks[list->count++] = block;
+      return true;
+    }
+    const size_t bytes = internal::AllocatedBytes(block->Allocator(), 1);
+    Depot& depot = GlobalDepot();
+    std::lock_guard<std::mutex> lock(depot.mutex);
+    if (depot.bytes + bytes > kMaxPooledBytes) {
+      return false;
+    }
+    DepotBlocks(depot, length).blocks.push_back(block);
+    depot.bytes += bytes;
+    return true;
+  }
+
+  size_t length_;
+
+  template <typename T, typename Pool>
+  friend class internal::RefPoolAllocator;
+};
+
+}  // namespace refptr
+
+#endif  // _REF_POOL_H
@@ -0,0 +1,86 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cycles of acquiring a var-sized buffer, writing to each of its pages,
+// sharing and releasing it, comparing `RefPool` to a fresh `MakeRefCounted`
+// in every cycle.
+
+#include <cstddef>
+#include <utility>
+
+#include "benchmark/benchmark.h"
+#include "ref.h"
+#include "ref_pool.h"
+#include "var_sized.h"
+
+namespace refptr {
+namespace {
+
+constexpr size_t kPageSize = 4096;
+
+struct Buffer {
+  explicit Buffer(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+// Writes a byte to each page of `array`, as filling the buffer would.
+void Touch(char* array, size_t length) {
+  for (size_t i = 0; i < length; i += kPageSize) {
+    array[i] = static_cast<char>(i);
+  }
+  benchmark::DoNotOptimize(array);
+}
+
+// Argument: The length of buffers in bytes.
+void BM_FreshBuffer(benchmark::State& state) {
+  const size_t length = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    char* array;
+    Ref<const Buffer, VarAllocator<char, std::allocator<Buffer>, Buffer>>
+        buffer = MakeRefCounted<Buffer, char, const size_t&>(length, array,
+                                                            length)
+                     .Share();
+    Touch(array, length);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FreshBuffer)
+    ->RangeMultiplier(16)
+    ->Range(4 << 10, 1 << 20)
+    ->ThreadRange(1, 4)
+    ->UseRealTime();
+
+// Argument: The length of buffers in bytes.
+void BM_PooledBuffer(benchmark::State& state) {
+  const size_t length = static_cast<size_t>(state.range(0));
+  RefPool<Buffer, char> pool(length);
+  for (auto _ : state) {
+    char* array;
+    Ref<const Buffer, RefPool<Buffer, char>::Allocator> buffer =
+        pool.Acquire(array, length).Share();
+    Touch(array, length);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PooledBuffer)
+    ->RangeMultiplier(16)
+    ->Range(4 << 10, 1 << 20)
+    ->ThreadRange(1, 4)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace refptr
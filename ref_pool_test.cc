@@ -0,0 +1,137 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ref_pool.h"
+
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace refptr {
+namespace {
+
+// Each test uses a different `Id`, so that they don't share pooled blocks.
+template <int Id>
+struct Buffer {
+  explicit Buffer(int value_) : value(value_) { constructed++; }
+  ~Buffer() { destroyed++; }
+
+  static std::atomic<int> constructed;
+  static std::atomic<int> destroyed;
+
+  int value;
+  size_t used = 0;
+};
+template <int Id>
+std::atomic<int> Buffer<Id>::constructed{0};
+template <int Id>
+std::atomic<int> Buffer<Id>::destroyed{0};
+
+struct ResetUsed {
+  template <typename U>
+  void operator()(U& buffer) const {
+    buffer.used = 0;
+  }
+};
+
+TEST(RefPoolTest, ReusesReleasedBlocks) {
+  using Buf = Buffer<0>;
+  RefPool<Buf, char, ResetUsed> pool(100);
+  char* array;
+  auto buffer = pool.Acquire(array, 42);
+  const Buf* address = &*buffer;
+  array[0] = 'x';
+  buffer->used = 1;
+  {
+    auto shared = std::move(buffer).Share();
+    auto copy = shared;
+  }
+  EXPECT_EQ(Buf::constructed, 1);
+  EXPECT_EQ(Buf::destroyed, 0);
+
+  char* reused_array;
+  auto reused = pool.Acquire(reused_array, 0);
+  EXPECT_EQ(&*reused, address);
+  EXPECT_EQ(reused_array, array);
+  EXPECT_EQ(reused_array[0], 'x');
+  EXPECT_EQ(reused->value, 42) << "Must not be constructed again";
+  EXPECT_EQ(reused->used, 0) << "Must be reset";
+  EXPECT_EQ(Buf::constructed, 1);
+}
+
+TEST(RefPoolTest, KeepsLengthsApart) {
+  using Buf = Buffer<1>;
+  RefPool<Buf, char> short_pool(10);
+  RefPool<Buf, char> long_pool(1000);
+  char* array;
+  const Buf* address;
+  {
+    auto buffer = short_pool.Acquire(array, 1);
+    address = &*buffer;
+  }
+  auto long_buffer = long_pool.Acquire(array, 2);
+  EXPECT_NE(&*long_buffer, address);
+  EXPECT_EQ(long_buffer->value, 2);
+  auto short_buffer = short_pool.Acquire(array, 3);
+  EXPECT_EQ(&*short_buffer, address);
+}
+
+TEST(RefPoolTest, DestroysBlocksWhenFull) {
+  using Buf = Buffer<2>;
+  // Fills the global list in as few blocks as possible.
+  const size_t length = kMaxPooledBytes / 8;
+  RefPool<Buf, char> pool(length);
+  std::vector<Ref<Buf, RefPool<Buf, char>::Allocator>> buffers;
+  char* array;
+  const int count = static_cast<int>(kRefPoolThreadBlocks) + 10;
+  for (int i = 0; i < count; i++) {
+    buffers.push_back(pool.Acquire(array, i));
+  }
+  buffers.clear();
+  EXPECT_EQ(Buf::constructed, count);
+  EXPECT_GT(Buf::destroyed, 0);
+  EXPECT_LT(Buf::destroyed, count);
+}
+
+TEST(RefPoolTest, RecyclesAcrossThreads) {
+  using Buf = Buffer<3>;
+  constexpr int kThreads = 4;
+  constexpr int kRounds = 1000;
+  RefPool<Buf, char> pool(256);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&pool, t] {
+      std::vector<Ref<const Buf, RefPool<Buf, char>::Allocator>> kept;
+      for (int i = 0; i < kRounds; i++) {
+        char* array;
+        auto buffer = pool.Acquire(array, t);
+        array[255] = static_cast<char>(i);
+        kept.push_back(std::move(buffer).Share());
+        if (kept.size() > 8) {
+          kept.erase(kept.begin());
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_LT(Buf::constructed, kThreads * kRounds / 10);
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,181 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _REF_QUEUE_H
+#define _REF_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "absl/types/optional.h"
+#include "ref.h"
+
+namespace refptr {
+
+// Bounded, lock-free, multi-producer multi-consumer FIFO queue of `Ref<T>`,
+// based on
+// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+//
+// The queue stores just the `Refcounted` blocks. Ownership of a reference is
+// transferred through it without modifying the reference count, and without
+// allocating memory per element. For non-`const` `T` this preserves the
+// unique ownership of `Ref<T>` across threads.
+//
+// All operations are non-blocking: They fail rather than wait if the queue is
+// full or empty.
+template <typename T,
+          typename Alloc = std::allocator<typename std::remove_const<T>::type>>
+class RefQueue {
+ public:
+  using value_type = Ref<T, Alloc>;
+
+  // `capacity` must be a power of two.
+  explicit RefQueue(size_t capacity)
+      : mask_(capacity - 1), slots_(new Slot[capacity]) {
+    assert(capacity >= 1 && (capacity & mask_) == 0);
+    for (size_t i = 0; i < capacity; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  RefQueue(const RefQueue&) = delete;
+  RefQueue& operator=(const RefQueue&) = delete;
+
+  // Releases all the remaining elements.
+  ~RefQueue() {
+    while (TryPop()) {
+    }
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // If the queue isn't full, moves `ref` to the queue and returns `true`.
+  // Otherwise returns `false` and leaves `ref` unchanged.
+  bool TryPush(value_type&& ref) {
+    value_type* first = &ref;
+    return TryPushBatch(first, first + 1) != first;
+  }
+
+  // Moves as many elements from the beginning of [first, last) to the queue
+  // as there is space for, claiming their slots at once. Returns the end of
+  // the pushed range, elements starting from it are left unchanged.
+  template <typename It>
+  It TryPushBatch(It first, It last) {
+    const size_t wanted = static_cast<size_t>(std::distance(first, last));
+    size_t pos;
+    const size_t count = Claim(enqueue_pos_, wanted, /*offset=*/0, pos);
+    for (size_t i = 0; i < count; i++, ++first) {
+      Slot& slot = slots_[(pos + i) & mask_];
+      slot.block = std::move(*first).Release();
+      slot.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return first;
+  }
+
+  // Returns the oldest element, if the queue isn't empty.
+  absl::optional<value_type> TryPop() {
+    size_t pos;
+    if (Claim(dequeue_pos_, 1, /*offset=*/1, pos) == 0) {
+      return absl::nullopt;
+    }
+    return value_type(Take(pos));
+  }
+
+  // Moves up to `max` oldest elements to `out`, claiming their slots at once.
+  // Returns the number of moved elements.
+  template <typename OutIt>
+  size_t TryPopBatch(size_t max, OutIt out) {
+    size_t pos;
+    const size_t count = Claim(dequeue_pos_, max, /*offset=*/1, pos);
+    for (size_t i = 0; i < count; i++, ++out) {
+      *out = value_type(Take(pos + i));
+    }
+    return count;
+  }
+
+ private:
+  using Block = Refcounted<typename std::remove_const<T>::type, Alloc>;
+
+  struct Slot {
+    // A slot at position `pos` is ready to be pushed into if `sequence ==
+    // pos`, and popped from if `sequence == pos + 1`.
+    std::atomic<size_t> sequence;
+    Block* block;
+  };
+
+  // Claims up to `max` consecutive slots that are ready, that is whose
+  // `sequence` equals their position plus `offset`, by advancing `position`.
+  // Stores the first claimed position in `first` and returns their number.
+  size_t Claim(std::atomic<size_t>& position, size_t max, size_t offset,
+               size_t& first) {
+    if (max == 0) {
+      return 0;
+    }
+    size_t pos = position.load(std::memory_order_relaxed);
+    while (true) {
+      size_t ready = 0;
+      bool stale = false;
+      for (; ready < max && ready <= mask_; ready++) {
+        const size_t sequence = slots_[(pos + ready) & mask_].sequence.load(
+            std::memory_order_acquire);
+        const intptr_t diff = static_cast<intptr_t>(sequence) -
+                              static_cast<intptr_t>(pos + ready + offset);
+        if (diff != 0) {
+          // Another thread has claimed `pos` in the meantime.
+          stale = ready == 0 && diff > 0;
+          break;
+        }
+      }
+      if (stale) {
+        pos = position.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (ready == 0) {
+        // Full or empty.
+        return 0;
+      }
+      // Slots seen as ready can't change until `position` is advanced past
+      // them, which this exchange prevents.
+      if (position.compare_exchange_weak(pos, pos + ready,
+                                         std::memory_order_relaxed)) {
+        first = pos;
+        return ready;
+      }
+    }
+  }
+
+  // Takes the block from a slot claimed for popping at `pos`, and releases
+  // the slot for a push one lap later.
+  Block* Take(size_t pos) {
+    Slot& slot = slots_[pos & mask_];
+    Block* block = slot.block;
+    slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return block;
+  }
+
+  const size_t mask_;
+  const std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+};
+
+}  // namespace refptr
+
+#endif  // _REF_QUEUE_H
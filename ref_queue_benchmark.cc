@@ -0,0 +1,138 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput of handing off `Ref<const T>` between threads through `RefQueue`
+// compared to a mutex-protected `std::deque`.
+//
+// Each thread is both a producer and a consumer: It pushes a batch of
+// references and then pops the same number of (usually other threads')
+// references, so that all threads contend on both ends of the queue.
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "ref.h"
+#include "ref_queue.h"
+
+namespace refptr {
+namespace {
+
+struct Payload {
+  explicit Payload(int64_t value) {
+    for (auto& v : values) {
+      v = value++;
+    }
+  }
+
+  int64_t values[8];
+};
+
+using Pointer = Ref<const Payload>;
+
+// Large enough for a full batch of every thread.
+constexpr size_t kCapacity = 1024;
+
+class RefQueueBackend {
+ public:
+  void PushAll(std::vector<Pointer>& items) {
+    auto it = items.begin();
+    while ((it = queue_.TryPushBatch(it, items.end())) != items.end()) {
+      std::this_thread::yield();
+    }
+    items.clear();
+  }
+
+  size_t PopSome(size_t max, std::vector<Pointer>& out) {
+    return queue_.TryPopBatch(max, std::back_inserter(out));
+  }
+
+ private:
+  RefQueue<const Payload> queue_{kCapacity};
+};
+
+class MutexDequeBackend {
+ public:
+  void PushAll(std::vector<Pointer>& items) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (Pointer& item : items) {
+        queue_.push_back(std::move(item));
+      }
+    }
+    items.clear();
+  }
+
+  size_t PopSome(size_t max, std::vector<Pointer>& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = 0;
+    for (; count < max && !queue_.empty(); count++) {
+      out.push_back(std::move(queue_.front()));
+      queue_.pop_front();
+    }
+    return count;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::deque<Pointer> queue_;
+};
+
+// Argument: The number of references pushed and popped at once.
+template <typename B>
+void BM_Handoff(benchmark::State& state) {
+  static B* backend;
+  if (state.thread_index() == 0) {
+    backend = new B();
+  }
+  const size_t batch = static_cast<size_t>(state.range(0));
+  std::vector<Pointer> items;
+  items.reserve(batch);
+  for (size_t i = 0; i < batch; i++) {
+    items.push_back(New<Payload>(static_cast<int64_t>(i)).Share());
+  }
+  for (auto _ : state) {
+    backend->PushAll(items);
+    while (items.size() < batch) {
+      if (backend->PopSome(batch - items.size(), items) == 0) {
+        std::this_thread::yield();
+      }
+    }
+    benchmark::DoNotOptimize(items.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  items.clear();
+  if (state.thread_index() == 0) {
+    delete backend;
+  }
+}
+BENCHMARK_TEMPLATE(BM_Handoff, RefQueueBackend)
+    ->Arg(1)
+    ->Arg(16)
+    ->ThreadRange(1, 32)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Handoff, MutexDequeBackend)
+    ->Arg(1)
+    ->Arg(16)
+    ->ThreadRange(1, 32)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,145 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ref_queue.h"
+
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "ref.h"
+
+namespace refptr {
+namespace {
+
+struct Foo {
+  Foo(std::atomic<int>& counter, int value) : counter_(counter), value_(value) {
+    counter_++;
+  }
+  ~Foo() { counter_--; }
+
+  std::atomic<int>& counter_;
+  int value_;
+};
+
+class RefQueueTest : public testing::Test {
+ protected:
+  Ref<Foo> Make(int value) {
+    return New<Foo, std::atomic<int>&, int>(counter_, int{value});
+  }
+
+  void TearDown() override { EXPECT_EQ(counter_.load(), 0); }
+
+  std::atomic<int> counter_{0};
+};
+
+TEST_F(RefQueueTest, FifoUntilFull) {
+  RefQueue<Foo> queue(4);
+  EXPECT_FALSE(queue.TryPop());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.TryPush(Make(i)));
+  }
+  Ref<Foo> rejected = Make(4);
+  EXPECT_FALSE(queue.TryPush(std::move(rejected)));
+  EXPECT_EQ(rejected->value_, 4);
+  for (int i = 0; i < 4; i++) {
+    auto popped = queue.TryPop();
+    ASSERT_TRUE(popped);
+    EXPECT_EQ((*popped)->value_, i);
+  }
+  EXPECT_FALSE(queue.TryPop());
+}
+
+TEST_F(RefQueueTest, TransfersReferencesWithoutCounting) {
+  RefQueue<const Foo> queue(2);
+  Ref<const Foo> shared = Make(1).Share();
+  EXPECT_TRUE(queue.TryPush(Ref<const Foo>(shared)));
+  shared = Make(2).Share();
+  EXPECT_EQ(counter_.load(), 2);
+  auto popped = queue.TryPop();
+  ASSERT_TRUE(popped);
+  // The popped reference is the only one left, so it can be claimed.
+  auto claimed = std::move(*popped).AttemptToClaim();
+  ASSERT_TRUE(absl::holds_alternative<Ref<Foo>>(claimed));
+  EXPECT_EQ(absl::get<Ref<Foo>>(claimed)->value_, 1);
+}
+
+TEST_F(RefQueueTest, Batches) {
+  RefQueue<Foo> queue(8);
+  std::vector<Ref<Foo>> input;
+  for (int i = 0; i < 10; i++) {
+    input.push_back(Make(i));
+  }
+  auto pushed_end = queue.TryPushBatch(input.begin(), input.end());
+  EXPECT_EQ(pushed_end - input.begin(), 8);
+  EXPECT_EQ((*pushed_end)->value_, 8);
+
+  std::vector<Ref<Foo>> output;
+  EXPECT_EQ(queue.TryPopBatch(3, std::back_inserter(output)), 3);
+  EXPECT_EQ(queue.TryPopBatch(10, std::back_inserter(output)), 5);
+  EXPECT_EQ(queue.TryPopBatch(10, std::back_inserter(output)), 0);
+  ASSERT_EQ(output.size(), 8);
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(output[i]->value_, i);
+  }
+}
+
+TEST_F(RefQueueTest, ReleasesRemainingElements) {
+  RefQueue<const Foo> queue(4);
+  EXPECT_TRUE(queue.TryPush(Make(1).Share()));
+  EXPECT_TRUE(queue.TryPush(Make(2).Share()));
+  EXPECT_EQ(counter_.load(), 2);
+}
+
+TEST_F(RefQueueTest, ManyProducersAndConsumers) {
+  constexpr int kThreads = 4;
+  constexpr int kPerThread = 10000;
+  RefQueue<Foo> queue(64);
+  std::atomic<int64_t> sum{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kPerThread; i++) {
+        Ref<Foo> ref = Make(t * kPerThread + i);
+        while (!queue.TryPush(std::move(ref))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+    threads.emplace_back([&] {
+      std::vector<Ref<Foo>> batch;
+      for (int received = 0; received < kPerThread;) {
+        batch.clear();
+        received += queue.TryPopBatch(kPerThread - received,
+                                      std::back_inserter(batch));
+        for (Ref<Foo>& ref : batch) {
+          sum += ref->value_;
+        }
+        std::this_thread::yield();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const int64_t n = kThreads * kPerThread;
+  EXPECT_EQ(sum.load(), n * (n - 1) / 2);
+  EXPECT_FALSE(queue.TryPop());
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,171 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _REF_STRING_H
+#define _REF_STRING_H
+
+// An immutable, reference-counted string. Its characters, length and hash are
+// kept in a single block created by `MakeRefCounted<Header, char>`, and
+// copying it only increments the reference count.
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+#include "ref.h"
+#include "var_sized.h"
+
+namespace refptr {
+
+namespace internal {
+
+// The header of the block of a `RefString`. The characters follow the block.
+struct RefStringHeader {
+  explicit RefStringHeader(size_t size_) : size(size_) {}
+
+  size_t size;
+  size_t hash = 0;
+  bool nul_terminated = false;
+};
+
+}  // namespace internal
+
+class RefString {
+ private:
+  using HeaderAlloc =
+      VarAllocator<char, std::allocator<internal::RefStringHeader>,
+                   internal::RefStringHeader>;
+  using Block = Refcounted<internal::RefStringHeader, HeaderAlloc>;
+
+ public:
+  // Hashes `RefString`s by their cached hash, and `absl::string_view`s to the
+  // same values. Together with `Eq` allows heterogeneous lookups in hash
+  // containers such as `absl::flat_hash_map<RefString, V, RefString::Hash,
+  // RefString::Eq>`.
+  struct Hash {
+    using is_transparent = void;
+
+    size_t operator()(const RefString& value) const { return value.hash(); }
+    size_t operator()(absl::string_view value) const {
+      return absl::Hash<absl::string_view>()(value);
+    }
+  };
+
+  struct Eq {
+    using is_transparent = void;
+
+    bool operator()(const RefString& a, const RefString& b) const {
+      return a == b;
+    }
+    bool operator()(const RefString& a, absl::string_view b) const {
+      return a.view() == b;
+    }
+    bool operator()(absl::string_view a, const RefString& b) const {
+      return a == b.view();
+    }
+  };
+
+  // The empty string. Shares a single block, allocated on first use.
+  RefString() : RefString(Empty()) {}
+
+  // Copies `value`, followed by a NUL character if `nul_terminated`.
+  explicit RefString(absl::string_view value, bool nul_terminated = true)
+      : header_(Make(value, nul_terminated)) {}
+
+  // A moved-from string is empty. Moving doesn't touch any reference count.
+  RefString(const RefString&) = default;
+  RefString(RefString&&) = default;
+  RefString& operator=(const RefString&) = default;
+  RefString& operator=(RefString&&) = default;
+
+  const char* data() const { return Characters(block()); }
+  size_t size() const { return block().nested.size; }
+  bool empty() const { return size() == 0; }
+  // The value of `absl::Hash<absl::string_view>` of the string, computed once
+  // on construction.
+  size_t hash() const { return block().nested.hash; }
+
+  bool nul_terminated() const { return block().nested.nul_terminated; }
+  // Requires `nul_terminated()`.
+  const char* c_str() const {
+    assert(nul_terminated());
+    return data();
+  }
+
+  absl::string_view view() const { return absl::string_view(data(), size()); }
+  operator absl::string_view() const { return view(); }
+
+  // Compares the cached hashes before the characters.
+  friend bool operator==(const RefString& a, const RefString& b) {
+    return &a.block() == &b.block() ||
+           (a.hash() == b.hash() && a.view() == b.view());
+  }
+  friend bool operator!=(const RefString& a, const RefString& b) {
+    return !(a == b);
+  }
+  friend bool operator<(const RefString& a, const RefString& b) {
+    return a.view() < b.view();
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H state, const RefString& value) {
+    return H::combine(std::move(state), value.view());
+  }
+
+ private:
+  static Ref<const internal::RefStringHeader, HeaderAlloc> Make(
+      absl::string_view value, bool nul_terminated) {
+    char* array;
+    Ref<internal::RefStringHeader, HeaderAlloc> header =
+        MakeRefCounted<internal::RefStringHeader, char, size_t>(
+            value.size() + nul_terminated, array, value.size());
+    assert(array == Characters(*header.block()));
+    if (!value.empty()) {
+      std::memcpy(array, value.data(), value.size());
+    }
+    if (nul_terminated) {
+      array[value.size()] = '\0';
+    }
+    header->hash = Hash()(value);
+    header->nul_terminated = nul_terminated;
+    return std::move(header).Share();
+  }
+
+  // `VarAllocator` places the characters right after the block, as their
+  // alignment doesn't exceed the block's.
+  static const char* Characters(const Block& block) {
+    return reinterpret_cast<const char*>(&block + 1);
+  }
+
+  // The block of the string, or of `Empty()` if moved from.
+  const Block& block() const {
+    return header_ != nullptr ? *header_.block() : *Empty().header_.block();
+  }
+
+  static const RefString& Empty() {
+    // Never destroyed, so that it can be copied by other static objects.
+    static const RefString* empty = new RefString(absl::string_view());
+    return *empty;
+  }
+
+  Ref<const internal::RefStringHeader, HeaderAlloc> header_;
+};
+
+}  // namespace refptr
+
+#endif  // _REF_STRING_H
@@ -0,0 +1,142 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares `RefString` to `std::string` and `std::shared_ptr<std::string>`:
+// Creation, copying, hashing and lookups in a hash map keyed by the same type.
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+#include "benchmark/benchmark.h"
+#include "ref_string.h"
+
+namespace refptr {
+namespace {
+
+constexpr int kKeys = 1024;
+
+std::string Text(size_t length, int i) {
+  std::string text = std::to_string(i);
+  text.resize(length, 'x');
+  return text;
+}
+
+struct StdStringBackend {
+  using Type = std::string;
+  using Hash = absl::Hash<std::string>;
+  using Eq = std::equal_to<std::string>;
+
+  static Type Make(absl::string_view text) { return std::string(text); }
+};
+
+struct SharedStringBackend {
+  using Type = std::shared_ptr<const std::string>;
+  struct Hash {
+    size_t operator()(const Type& value) const {
+      return absl::Hash<std::string>()(*value);
+    }
+  };
+  struct Eq {
+    bool operator()(const Type& a, const Type& b) const { return *a == *b; }
+  };
+
+  static Type Make(absl::string_view text) {
+    return std::make_shared<const std::string>(text);
+  }
+};
+
+struct RefStringBackend {
+  using Type = RefString;
+  using Hash = RefString::Hash;
+  using Eq = RefString::Eq;
+
+  static Type Make(absl::string_view text) { return RefString(text); }
+};
+
+// Argument: The length of the strings.
+template <typename B>
+void BM_Create(benchmark::State& state) {
+  const std::string text = Text(static_cast<size_t>(state.range(0)), 42);
+  for (auto _ : state) {
+    typename B::Type value = B::Make(text);
+    benchmark::DoNotOptimize(value);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Create, StdStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_Create, SharedStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_Create, RefStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+
+// Argument: The length of the strings.
+template <typename B>
+void BM_Copy(benchmark::State& state) {
+  const typename B::Type value =
+      B::Make(Text(static_cast<size_t>(state.range(0)), 42));
+  for (auto _ : state) {
+    typename B::Type copy = value;
+    benchmark::DoNotOptimize(copy);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Copy, StdStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_Copy, SharedStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_Copy, RefStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+
+// Argument: The length of the strings.
+template <typename B>
+void BM_Hash(benchmark::State& state) {
+  const typename B::Type value =
+      B::Make(Text(static_cast<size_t>(state.range(0)), 42));
+  const typename B::Hash hash;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash(value));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Hash, StdStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_Hash, SharedStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_Hash, RefStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+
+// Looks up `kKeys` distinct keys of the map's key type, which all hit.
+// Argument: The length of the strings.
+template <typename B>
+void BM_Lookup(benchmark::State& state) {
+  const size_t length = static_cast<size_t>(state.range(0));
+  absl::flat_hash_map<typename B::Type, int, typename B::Hash, typename B::Eq>
+      map;
+  std::vector<typename B::Type> keys;
+  for (int i = 0; i < kKeys; i++) {
+    map.emplace(B::Make(Text(length, i)), i);
+    keys.push_back(B::Make(Text(length, i)));
+  }
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const typename B::Type& key : keys) {
+      sum += map.find(key)->second;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kKeys);
+}
+BENCHMARK_TEMPLATE(BM_Lookup, StdStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_Lookup, SharedStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_Lookup, RefStringBackend)->Arg(8)->Arg(64)->Arg(1024);
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,107 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ref_string.h"
+
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+
+namespace refptr {
+namespace {
+
+TEST(RefStringTest, HoldsValue) {
+  RefString value("Lorem ipsum");
+  EXPECT_EQ(value.size(), 11);
+  EXPECT_FALSE(value.empty());
+  EXPECT_EQ(value.view(), "Lorem ipsum");
+  EXPECT_TRUE(value.nul_terminated());
+  EXPECT_EQ(std::strlen(value.c_str()), 11);
+  absl::string_view view = value;
+  EXPECT_EQ(view.data(), value.data());
+}
+
+TEST(RefStringTest, WithoutNulTerminator) {
+  RefString value("Lorem ipsum", /*nul_terminated=*/false);
+  EXPECT_FALSE(value.nul_terminated());
+  EXPECT_EQ(value.view(), "Lorem ipsum");
+}
+
+TEST(RefStringTest, Empty) {
+  RefString empty;
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.view(), "");
+  EXPECT_STREQ(empty.c_str(), "");
+  EXPECT_EQ(RefString().data(), empty.data()) << "Must share a single block";
+  EXPECT_EQ(empty, RefString(""));
+}
+
+TEST(RefStringTest, CopiesShareCharacters) {
+  RefString value("Lorem ipsum");
+  RefString copy = value;
+  EXPECT_EQ(copy.data(), value.data());
+  RefString moved = std::move(copy);
+  EXPECT_EQ(moved.data(), value.data());
+  copy = moved;
+  EXPECT_EQ(copy, value);
+}
+
+TEST(RefStringTest, MovedFromIsEmpty) {
+  RefString value("Lorem ipsum");
+  RefString moved = std::move(value);
+  EXPECT_TRUE(value.empty());
+  EXPECT_EQ(value.view(), "");
+  EXPECT_STREQ(value.c_str(), "");
+  EXPECT_EQ(value.hash(), RefString().hash());
+  EXPECT_EQ(value, RefString());
+  EXPECT_EQ(moved.view(), "Lorem ipsum");
+}
+
+TEST(RefStringTest, CachesHash) {
+  RefString value("Lorem ipsum");
+  EXPECT_EQ(value.hash(), absl::Hash<absl::string_view>()("Lorem ipsum"));
+  EXPECT_EQ(RefString::Hash()(value), RefString::Hash()("Lorem ipsum"));
+  EXPECT_EQ(absl::Hash<RefString>()(value),
+            absl::Hash<absl::string_view>()("Lorem ipsum"));
+}
+
+TEST(RefStringTest, Compares) {
+  RefString a("Lorem");
+  RefString b("ipsum");
+  EXPECT_EQ(a, RefString("Lorem"));
+  EXPECT_NE(a, b);
+  EXPECT_LT(a, b);
+  EXPECT_TRUE(RefString::Eq()(a, absl::string_view("Lorem")));
+  EXPECT_FALSE(RefString::Eq()(absl::string_view("Lorem"), b));
+}
+
+TEST(RefStringTest, HeterogeneousLookup) {
+  absl::flat_hash_map<RefString, int, RefString::Hash, RefString::Eq> map;
+  map.emplace(RefString("Lorem"), 1);
+  map.emplace(RefString("ipsum"), 2);
+  EXPECT_EQ(map.at(RefString("ipsum")), 2);
+  const std::string key = "Lorem";
+  auto it = map.find(absl::string_view(key));
+  ASSERT_NE(it, map.end());
+  EXPECT_EQ(it->second, 1);
+  EXPECT_EQ(map.find(absl::string_view("dolor")), map.end());
+}
+
+}  // namespace
+}  // namespace refptr
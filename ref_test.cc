@@ -14,6 +14,9 @@
 
 #include "ref.h"
 
+#include <cstddef>
+#include <cstdint>
+
 #include "gtest/gtest.h"
 
 namespace refptr {
@@ -90,5 +93,75 @@ TEST_F(RefTest, AttemptToClaimFails) {
   EXPECT_EQ(absl::get<Ref<const Foo>>(owned_var)->value_, 42);
 }
 
+TEST_F(RefTest, MoveAssignmentOverSharedValue) {
+  Ref<const Foo> shared = New<Foo, int&, int>(counter_, 1).Share();
+  Ref<const Foo> shared2 = shared;
+  shared = New<Foo, int&, int>(counter_, 2).Share();
+  EXPECT_EQ(counter_, 2);
+  EXPECT_EQ(shared->value_, 2);
+  EXPECT_EQ(shared2->value_, 1);
+}
+
+TEST_F(RefTest, SelfCopyAssignment) {
+  Ref<const Foo> shared = New<Foo, int&, int>(counter_, 1).Share();
+  {
+    Ref<const Foo> shared2 = shared;
+    Ref<const Foo>& alias = shared;
+    shared = alias;
+    ASSERT_TRUE(shared != nullptr);
+    EXPECT_EQ(shared->value_, 1);
+  }
+  EXPECT_EQ(counter_, 1);
+  // Exactly one reference remains, so it can be claimed back.
+  auto owned_var = std::move(shared).AttemptToClaim();
+  EXPECT_TRUE(absl::holds_alternative<Ref<Foo>>(owned_var));
+}
+
+TEST_F(RefTest, ReleaseAndAdopt) {
+  Ref<const Foo> shared = New<Foo, int&, int>(counter_, 42).Share();
+  Ref<const Foo> shared2 = shared;
+  auto* block = std::move(shared).Release();
+  EXPECT_TRUE(shared == nullptr);
+  EXPECT_EQ(counter_, 1);
+  Ref<const Foo> adopted(block);
+  EXPECT_EQ(adopted->value_, 42);
+  // Both references are still counted.
+  auto owned_var = std::move(adopted).AttemptToClaim();
+  ASSERT_TRUE(absl::holds_alternative<Ref<const Foo>>(owned_var));
+}
+
+struct ReadMostly {
+  explicit ReadMostly(int value_) : value(value_) {}
+
+  int value;
+};
+
+}  // namespace
+
+template <>
+struct IsolateRefcount<ReadMostly> : std::true_type {};
+
+namespace {
+
+TEST_F(RefTest, IsolatesRefcountFromNested) {
+  Ref<const ReadMostly> ref = New<ReadMostly>(42);
+  Ref<const ReadMostly> copy = ref;
+  EXPECT_EQ(copy->value, 42);
+  const Refcounted<ReadMostly>* block = std::move(copy).Release();
+  EXPECT_GE(reinterpret_cast<const char*>(&block->nested) -
+                reinterpret_cast<const char*>(&block->refcount),
+            static_cast<ptrdiff_t>(kCacheLineSize));
+  Ref<const ReadMostly> adopted(const_cast<Refcounted<ReadMostly>*>(block));
+}
+
+TEST_F(RefTest, DoesNotPadRefcountByDefault) {
+  Ref<int64_t> ref = New<int64_t>(42);
+  Refcounted<int64_t>* block = std::move(ref).Release();
+  EXPECT_EQ(reinterpret_cast<const char*>(&block->nested) -
+                reinterpret_cast<const char*>(&block->refcount),
+            static_cast<ptrdiff_t>(sizeof(Refcount)));
+  ref = Ref<int64_t>(block);
+}
+
 }  // namespace
 }  // namespace refptr
@@ -18,19 +18,38 @@
 #include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <type_traits>
 #include <utility>
 
 #include "absl/base/attributes.h"
 
+#ifdef REFPTR_CONTENTION_PROFILING
+#include <typeinfo>
+
+#include "contention_profiler.h"
+#endif
+#ifdef REFPTR_HEAP_SAMPLING
+#include "absl/meta/type_traits.h"
+#include "heap_sampler.h"
+#endif
+#ifdef REFPTR_TELEMETRY
+#include "telemetry.h"
+#endif
+
 namespace refptr {
 
 class Refcount {
  public:
   constexpr Refcount() : count_{1} {}
 
-  // Increments the reference count. Imposes no memory ordering.
-  inline void Inc() {
+  // Increments the reference count and returns its previous value. Imposes no
+  // memory ordering.
+  inline int_fast32_t Inc() {
+#ifdef REFPTR_CONTENTION_PROFILING
+    contention_.OnAccess();
+#endif
     // Similarly to
     // https://chromium.googlesource.com/chromium/src/third_party/abseil-cpp/+/6d2ed7db891d53d83c5202a9368e4b19e4ca61f0/absl/strings/internal/cord_internal.h#155
     // this can be just _relaxed_:
@@ -39,9 +58,13 @@ class Refcount {
     // this operation immediately. And if the added reference count is passed
     // to a different thread, that operation needs to ensure proper
     // synchronization barriers on its own.
-    count_.fetch_add(1, std::memory_order_relaxed);
+    return count_.fetch_add(1, std::memory_order_relaxed);
   }
 
+  // Resets the counter to 1 after `Dec` returned `true`, so that the object
+  // can be reused instead of destroyed.
+  inline void Reset() { count_.store(1, std::memory_order_relaxed); }
+
   // Returns whether the atomic integer is 1.
   inline bool IsOne() const {
     // This thread must observe the correct value, including any prior
@@ -57,6 +80,14 @@ class Refcount {
   // that there is only a single reference to the object. This allows slight
   // performane optimization when reqesting the appropriate memory barriers.
   inline bool Dec(bool expect_one = false) {
+    return DecAndGet(expect_one) == 0;
+  }
+
+  // Like `Dec`, but returns the counter's value after the decrement.
+  inline int_fast32_t DecAndGet(bool expect_one = false) {
+#ifdef REFPTR_CONTENTION_PROFILING
+    contention_.OnAccess();
+#endif
     // This thread must observe the correct value if `refcount` reaches zero,
     // including any prior modifications by other threads. All other threads
     // must observe the result of the operation.
@@ -64,23 +95,196 @@ class Refcount {
       // Knowing the object will be destructed, we don't decrement the counter.
       // This way, we save the _release operation_ that would be needed for
       // decrementing it below.
-      return true;
+      return 0;
     }
     int_fast32_t refcount = count_.fetch_sub(1, std::memory_order_acq_rel);
     assert(refcount > 0);
-    return refcount == 1;
+    return refcount - 1;
   }
 
+#ifdef REFPTR_CONTENTION_PROFILING
+  internal::ContentionStats& contention() { return contention_; }
+#endif
+
  private:
   std::atomic<int_fast32_t> count_;
+#ifdef REFPTR_CONTENTION_PROFILING
+  internal::ContentionStats contention_;
+#endif
+};
+
+template <typename T, class Alloc>
+struct Refcounted;
+
+// Specialize to `std::true_type` to allow destroying blocks of `T` in parallel
+// by a `TeardownPool`, see parallel_teardown.h. Meant for types that own large
+// graphs of other such blocks.
+template <typename T>
+struct EnableParallelTeardown : std::false_type {};
+
+// Specialize to `std::true_type` to place the reference count of blocks of `T`
+// on its own cache line, so that copying and releasing `Ref`s on one core
+// doesn't invalidate the cache line that other cores read `T` from. Meant for
+// large, read-mostly objects shared by many threads, as it costs up to
+// `kCacheLineSize` bytes per block.
+template <typename T>
+struct IsolateRefcount : std::false_type {};
+
+// The size of a cache line on common CPUs.
+constexpr size_t kCacheLineSize = 64;
+
+namespace internal {
+
+// Defers the deletion of blocks, whose type enables parallel teardown, on
+// threads of a `TeardownPool`.
+class TeardownQueue {
+ public:
+  // Schedules `deleter(block)` instead of deleting `block` immediately.
+  virtual void Push(void (*deleter)(void*), void* block) = 0;
+
+  // The queue of the current thread, or `nullptr` outside of `TeardownPool`.
+  static TeardownQueue*& Current() {
+    static thread_local TeardownQueue* current = nullptr;
+    return current;
+  }
+
+ protected:
+  ~TeardownQueue() = default;
+};
+
+template <typename Alloc>
+auto AllocatedBytesImpl(const Alloc& allocator, size_t n, int)
+    -> decltype(allocator.AllocatedBytes(n)) {
+  return allocator.AllocatedBytes(n);
+}
+template <typename Alloc>
+size_t AllocatedBytesImpl(const Alloc&, size_t n, long) {
+  return n * sizeof(typename std::allocator_traits<Alloc>::value_type);
+}
+
+// Returns the number of bytes allocated by `allocator.allocate(n)`. Allocators
+// that allocate more than `n` times the size of their `value_type`, such as
+// `VarAllocator`, report it by an `AllocatedBytes(n)` method.
+template <typename Alloc>
+size_t AllocatedBytes(const Alloc& allocator, size_t n) {
+  return AllocatedBytesImpl(allocator, n, 0);
+}
+
+template <typename Alloc, typename Block>
+auto RecycleImpl(Alloc& allocator, Block* block, int)
+    -> decltype(allocator.Recycle(block)) {
+  return allocator.Recycle(block);
+}
+template <typename Alloc, typename Block>
+bool RecycleImpl(Alloc&, Block*, long) {
+  return false;
+}
+
+// Offers `block`, whose reference count dropped to zero, to
+// `allocator.Recycle(block)`, if the allocator has such a method, such as the
+// one of `RefPool`. Returns `true` if the allocator took over the block, which
+// then must not be destroyed.
+template <typename Alloc, typename Block>
+bool Recycle(Alloc& allocator, Block* block) {
+  return RecycleImpl(allocator, block, 0);
+}
+
+#ifdef REFPTR_HEAP_SAMPLING
+// Allocators that report their allocations to `HeapSampler` on their own, such
+// as `VarAllocator`, define a `samples_heap` member type.
+template <typename Alloc, typename = void>
+struct SamplesHeap : std::false_type {};
+template <typename Alloc>
+struct SamplesHeap<Alloc, absl::void_t<typename Alloc::samples_heap>>
+    : std::true_type {};
+#endif
+
+// Holds the reference count of a `Refcounted` block.
+template <bool Isolated>
+struct RefcountStorage {
+  mutable Refcount refcount;
+};
+
+// Pads the reference count to a whole cache line. Blocks aren't necessarily
+// aligned to cache lines, but since they start with `refcount`, it never
+// shares a cache line with the following members.
+template <>
+struct RefcountStorage<true> {
+  mutable Refcount refcount;
+  char padding[kCacheLineSize - sizeof(Refcount) % kCacheLineSize];
 };
 
+// Called on life-cycle events of `Refcounted<T, Alloc>` blocks. Compiles to
+// no-op unless enabled by a compile-time switch.
+template <typename T, typename Alloc>
+struct RefcountedHooks {
+  // After `block` of `bytes` has been allocated and constructed.
+  static void OnNew(const Refcounted<T, Alloc>* block, size_t bytes) {
+    // Unused unless some of the switches are on.
+    (void)block;
+    (void)bytes;
+#ifdef REFPTR_CONTENTION_PROFILING
+    block->refcount.contention().SetBlock(block, typeid(T));
+#endif
+#ifdef REFPTR_TELEMETRY
+    TypeTelemetryCounters<T>::OnNew(bytes);
+#endif
+#ifdef REFPTR_HEAP_SAMPLING
+    if (!SamplesHeap<Alloc>::value) {
+      HeapSampler::OnAllocate(block, bytes);
+    }
+#endif
+  }
+  // Before `block` of `bytes` is destroyed and deallocated.
+  static void OnDelete(const Refcounted<T, Alloc>* block, size_t bytes) {
+    (void)block;
+    (void)bytes;
+#ifdef REFPTR_CONTENTION_PROFILING
+    block->refcount.contention().OnDestroy();
+#endif
+#ifdef REFPTR_TELEMETRY
+    TypeTelemetryCounters<T>::OnDelete(bytes);
+#endif
+#ifdef REFPTR_HEAP_SAMPLING
+    if (!SamplesHeap<Alloc>::value) {
+      HeapSampler::OnDeallocate(block);
+    }
+#endif
+  }
+  // After a new reference to `block` has been created, increasing its
+  // reference count to `refcount`.
+  static void OnShare(const Refcounted<T, Alloc>* block,
+                      int_fast32_t refcount) {
+    (void)block;
+    (void)refcount;
+#ifdef REFPTR_TELEMETRY
+    TypeTelemetryCounters<T>::OnShare(refcount);
+#endif
+  }
+  // After a reference to `block` has been dropped, decreasing its reference
+  // count to `refcount > 0`. Dropping the last one calls `OnDelete` instead,
+  // unless the allocator recycles the block.
+  static void OnRelease(const Refcounted<T, Alloc>* block,
+                        int_fast32_t refcount) {
+    (void)block;
+    (void)refcount;
+#ifdef REFPTR_TELEMETRY
+    TypeTelemetryCounters<T>::OnRelease(refcount);
+#endif
+  }
+};
+
+}  // namespace internal
+
 // Keeps a `Refcount`-ed instance of `T`.
 //
 // When a caller requests deletion of an instance via `SelfDelete`, `Alloc`
 // is used to destroy and delete the memory block.
+//
+// The `refcount` member is inherited, so that `IsolateRefcount<T>` can pad it.
 template <typename T, class Alloc = std::allocator<T>>
-struct Refcounted {
+struct Refcounted
+    : public internal::RefcountStorage<IsolateRefcount<T>::value> {
  public:
   using SelfAlloc =
       typename std::allocator_traits<Alloc>::template rebind_alloc<Refcounted>;
@@ -91,7 +295,7 @@ struct Refcounted {
       "just so that it's possible to use `construct` of an allocator to "
       "construct new instances.")
   Refcounted(Alloc allocator_, Arg&&... args_)
-      : refcount(),
+      : internal::RefcountStorage<IsolateRefcount<T>::value>(),
         nested(std::forward<Arg>(args_)...),
         allocator(std::move(allocator_)) {}
 
@@ -108,20 +312,51 @@ struct Refcounted {
       std::allocator_traits<SelfAlloc>::deallocate(self_allocator, ptr, 1);
       throw;
     }
+    internal::RefcountedHooks<T, Alloc>::OnNew(
+        ptr, internal::AllocatedBytes(self_allocator, 1));
     return ptr;
   }
 
+  // Destroys and deallocates this block, or defers it to the current
+  // `TeardownQueue` if `EnableParallelTeardown<T>`. Allocators can take over
+  // the block instead, see `internal::Recycle`.
   void SelfDelete() && {
+    if (std::move(*this).Recycle()) {
+      return;
+    }
+    if (EnableParallelTeardown<T>::value) {
+      internal::TeardownQueue* queue = internal::TeardownQueue::Current();
+      if (queue != nullptr) {
+        queue->Push(&DeleteBlock, this);
+        return;
+      }
+    }
+    std::move(*this).DeleteNow();
+  }
+
+  // Offers this block, whose reference count dropped to zero, to its
+  // allocator, see `internal::Recycle`. Returns `true` if the allocator took
+  // it over, and then the block must not be destroyed.
+  bool Recycle() && { return internal::Recycle(allocator, this); }
+
+  // Like `SelfDelete`, but never defers.
+  void DeleteNow() && {
     // Move out the allocator to a local variable so that `this` can be
     // destroyed.
     SelfAlloc allocator_copy = std::move(allocator);
+    internal::RefcountedHooks<T, Alloc>::OnDelete(
+        this, internal::AllocatedBytes(allocator_copy, 1));
     std::allocator_traits<SelfAlloc>::destroy(allocator_copy, this);
     std::allocator_traits<SelfAlloc>::deallocate(allocator_copy, this, 1);
   }
 
-  SelfAlloc Allocator() { return SelfAlloc(allocator); }
+  SelfAlloc Allocator() const { return SelfAlloc(allocator); }
+
+  // Type-erased `DeleteNow`.
+  static void DeleteBlock(void* block) {
+    std::move(*static_cast<Refcounted*>(block)).DeleteNow();
+  }
 
-  mutable Refcount refcount;
   T nested;
 
  private:
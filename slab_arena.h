@@ -0,0 +1,217 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _SLAB_ARENA_H
+#define _SLAB_ARENA_H
+
+// Linux-only memory arena shared by `NumaAllocator` and `HugePageAllocator`.
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#include "absl/numeric/bits.h"
+#include "absl/utility/utility.h"
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace refptr {
+namespace internal {
+
+#if defined(__linux__)
+// Small blocks are carved from slabs of `kSlabBytes`, each dedicated to a
+// single size class, and recycled through per-class free lists. Slabs are
+// never returned to the system. Larger blocks are mapped and unmapped
+// individually.
+//
+// Size classes are multiples of 16 bytes: 16, 32, and then 1.5 times and 2
+// times every power of two from 32 to 32 KiB. Blocks are aligned to 16 bytes,
+// and blocks with a larger alignment are rounded up to powers of two, to which
+// they are naturally aligned within a slab.
+//
+// Each arena has its own lock, but blocks can be deallocated from any thread,
+// as every slab points to its arena.
+class SlabArena {
+ public:
+  static constexpr size_t kSlabBytes = size_t{2} << 20;
+  static constexpr size_t kMaxClassBytes = size_t{64} << 10;
+
+  // Places memory on NUMA `node`, unless it's negative. Advises the kernel to
+  // back slabs by transparent huge pages if `huge_pages`.
+  SlabArena(int node, bool huge_pages)
+      : node_(node), huge_pages_(huge_pages) {}
+
+  SlabArena(const SlabArena&) = delete;
+  SlabArena& operator=(const SlabArena&) = delete;
+
+  void* Allocate(size_t bytes, size_t alignment) {
+    bytes = ClassifiedBytes(bytes, alignment);
+    if (bytes > kMaxClassBytes) {
+      return Map(bytes, alignment, /*prepare=*/true);
+    }
+    const int size_class = SizeClass(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    FreeBlock*& head = free_[size_class];
+    if (head != nullptr) {
+      return absl::exchange(head, head->next);
+    }
+    Slab*& slab = slabs_[size_class];
+    const size_t class_bytes = ClassBytes(size_class);
+    if (slab == nullptr || slab->used + class_bytes > kSlabBytes) {
+      slab = NewSlab(class_bytes);
+    }
+    void* block = reinterpret_cast<char*>(slab) + slab->used;
+    slab->used += class_bytes;
+    return block;
+  }
+
+  // Deallocates `ptr` allocated by `Allocate(bytes, alignment)` of any arena.
+  static void Deallocate(void* ptr, size_t bytes, size_t alignment) {
+    bytes = ClassifiedBytes(bytes, alignment);
+    if (bytes > kMaxClassBytes) {
+      munmap(ptr, bytes);
+      return;
+    }
+    SlabArena& arena = *SlabOf(ptr)->arena;
+    std::lock_guard<std::mutex> lock(arena.mutex_);
+    FreeBlock*& head = arena.free_[SizeClass(bytes)];
+    head = new (ptr) FreeBlock{head};
+  }
+
+  // Returns the number of bytes actually used by `Allocate(bytes, alignment)`.
+  static size_t AllocatedBytes(size_t bytes, size_t alignment) {
+    bytes = ClassifiedBytes(bytes, alignment);
+    return bytes > kMaxClassBytes ? bytes : ClassBytes(SizeClass(bytes));
+  }
+
+ private:
+  static constexpr int kClasses = 24;
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+  // Header at the start of every slab.
+  struct Slab {
+    SlabArena* arena;
+    // Offset of the next unused block.
+    size_t used;
+  };
+
+  // Rounds `bytes` up to a power of two if `alignment` exceeds 16, or to whole
+  // pages for large blocks.
+  static size_t ClassifiedBytes(size_t bytes, size_t alignment) {
+    if (alignment > 16) {
+      bytes = absl::bit_ceil(bytes < alignment ? alignment : bytes);
+    }
+    if (bytes > kMaxClassBytes) {
+      const size_t page = 4096;
+      bytes = (bytes + page - 1) & ~(page - 1);
+    }
+    return bytes;
+  }
+
+  static int SizeClass(size_t bytes) {
+    if (bytes <= 32) {
+      return bytes <= 16 ? 0 : 1;
+    }
+    // 2^(power - 1) < bytes <= 2^power, power >= 6.
+    const int power = absl::bit_width(bytes - 1);
+    const bool fits_lower = bytes <= (size_t{3} << (power - 2));
+    return 2 * (power - 6) + (fits_lower ? 2 : 3);
+  }
+  static size_t ClassBytes(int size_class) {
+    if (size_class < 2) {
+      return size_t{16} << size_class;
+    }
+    const int power = (size_class - 2) / 2 + 6;
+    return size_class % 2 == 0 ? size_t{3} << (power - 2) : size_t{1} << power;
+  }
+  static_assert(kMaxClassBytes == (size_t{1} << 16) &&
+                    2 * (16 - 6) + 3 == kClasses - 1,
+                "kClasses must cover classes up to kMaxClassBytes");
+
+  static Slab* SlabOf(void* ptr) {
+    return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) &
+                                   ~(kSlabBytes - 1));
+  }
+
+  // Allocates a slab aligned to `kSlabBytes`, so that `SlabOf` can find it
+  // and so that it can be backed by a single huge page. Its first block holds
+  // the header, which keeps the other blocks aligned.
+  Slab* NewSlab(size_t class_bytes) {
+    void* aligned = Map(kSlabBytes, kSlabBytes, /*prepare=*/true);
+    const size_t header =
+        class_bytes < sizeof(Slab) ? sizeof(Slab) : class_bytes;
+    return new (aligned) Slab{this, header};
+  }
+
+  // Maps `bytes` aligned to `alignment`. As `mmap` only aligns to pages,
+  // larger alignments are over-mapped and the excess is unmapped.
+  void* Map(size_t bytes, size_t alignment, bool prepare) {
+    const size_t page = 4096;
+    const size_t excess = alignment > page ? alignment : 0;
+    void* mapped = mmap(nullptr, bytes + excess, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    char* aligned = static_cast<char*>(mapped);
+    if (excess > 0) {
+      const uintptr_t address = reinterpret_cast<uintptr_t>(mapped);
+      aligned = reinterpret_cast<char*>((address + alignment - 1) &
+                                        ~(uintptr_t{alignment} - 1));
+      const size_t before = aligned - static_cast<char*>(mapped);
+      if (before > 0) {
+        munmap(mapped, before);
+      }
+      munmap(aligned + bytes, excess - before);
+    }
+    if (prepare) {
+      Prepare(aligned, bytes);
+    }
+    return aligned;
+  }
+
+  // Applies the memory policy of the arena to fresh, untouched memory. Only
+  // advisory: Failures, for example if `node_` doesn't exist or huge pages
+  // are disabled, are ignored.
+  void Prepare(void* ptr, size_t bytes) {
+    if (huge_pages_ && bytes >= kSlabBytes) {
+      madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+    if (node_ >= 0) {
+      const uint64_t mask = uint64_t{1} << node_;
+      syscall(SYS_mbind, ptr, bytes, MPOL_PREFERRED, &mask, 64 + 1, 0);
+    }
+  }
+
+  const int node_;
+  const bool huge_pages_;
+  std::mutex mutex_;
+  FreeBlock* free_[kClasses] = {};
+  // The slab of each class with unused blocks.
+  Slab* slabs_[kClasses] = {};
+};
+#endif  // defined(__linux__)
+
+}  // namespace internal
+}  // namespace refptr
+
+#endif  // _SLAB_ARENA_H
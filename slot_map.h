@@ -0,0 +1,224 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _SLOT_MAP_H
+#define _SLOT_MAP_H
+
+// A container of many small objects, stored contiguously without a
+// `Refcounted` header or an allocation for each. Elements are addressed by
+// generational `SlotHandle`s, which detect access to erased elements, and the
+// whole container can be shared as `Ref<const SlotMap<T>>`, from which
+// `SlotRef<T>` provides `Ref<const T>`-like access to single elements:
+//
+//     Ref<SlotMap<Entity>> entities = New<SlotMap<Entity>>();
+//     SlotHandle handle = entities->Insert(...);
+//     Ref<const SlotMap<Entity>> shared = std::move(entities).Share();
+//     absl::optional<SlotRef<Entity>> entity = SlotRef<Entity>::Make(shared,
+//                                                                    handle);
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "ref.h"
+
+namespace refptr {
+
+// Identifies an element of a `SlotMap`. Remains invalid after the element is
+// erased, even if its slot is reused by a new element. The default value is
+// never valid.
+struct SlotHandle {
+  SlotHandle() = default;
+  constexpr SlotHandle(uint32_t index_, uint32_t generation_)
+      : index(index_), generation(generation_) {}
+
+  uint32_t index = 0;
+  // Odd while the slot is occupied.
+  uint32_t generation = 0;
+
+  friend bool operator==(const SlotHandle& a, const SlotHandle& b) {
+    return a.index == b.index && a.generation == b.generation;
+  }
+  friend bool operator!=(const SlotHandle& a, const SlotHandle& b) {
+    return !(a == b);
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H state, const SlotHandle& handle) {
+    return H::combine(std::move(state), handle.index, handle.generation);
+  }
+};
+
+// Stores elements densely in a `std::vector<T>`, so that iterating over them
+// is a linear scan, and maps handles to their positions by an array of slots.
+// Lookups, insertions and erasures take constant time. Erasing moves the last
+// element into the erased position, so iteration order is unspecified and
+// pointers to elements are invalidated by any modification, while handles
+// remain valid.
+//
+// A slot is reused after its element is erased, with its generation
+// incremented. After 2^31 reuses of a single slot generations wrap around, and
+// a stale handle could match again.
+template <typename T>
+class SlotMap {
+ public:
+  using value_type = T;
+  using iterator = typename std::vector<T>::iterator;
+  using const_iterator = typename std::vector<T>::const_iterator;
+
+  SlotMap() = default;
+  SlotMap(SlotMap&&) = default;
+  SlotMap(const SlotMap&) = default;
+  SlotMap& operator=(SlotMap&&) = default;
+  SlotMap& operator=(const SlotMap&) = default;
+
+  // Constructs a new element from `args` and returns its handle.
+  template <typename... Arg>
+  SlotHandle Insert(Arg&&... args) {
+    if (free_ == kNoSlot) {
+      assert(slots_.size() < kNoSlot);
+      slots_.push_back(Slot{kNoSlot, 0});
+      free_ = static_cast<uint32_t>(slots_.size() - 1);
+    }
+    const uint32_t index = free_;
+    Slot& slot = slots_[index];
+    value_slots_.push_back(index);
+    try {
+      values_.emplace_back(std::forward<Arg>(args)...);
+    } catch (...) {
+      value_slots_.pop_back();
+      throw;
+    }
+    free_ = slot.position;
+    slot.position = static_cast<uint32_t>(values_.size() - 1);
+    slot.generation++;
+    return SlotHandle{index, slot.generation};
+  }
+
+  // Erases the element of `handle` and returns `true`, or returns `false` if
+  // `handle` isn't valid.
+  bool Erase(SlotHandle handle) {
+    if (!Contains(handle)) {
+      return false;
+    }
+    Slot& slot = slots_[handle.index];
+    const uint32_t last = static_cast<uint32_t>(values_.size() - 1);
+    if (slot.position != last) {
+      values_[slot.position] = std::move(values_.back());
+      value_slots_[slot.position] = value_slots_.back();
+      slots_[value_slots_.back()].position = slot.position;
+    }
+    values_.pop_back();
+    value_slots_.pop_back();
+    slot.generation++;
+    slot.position = free_;
+    free_ = handle.index;
+    return true;
+  }
+
+  bool Contains(SlotHandle handle) const {
+    return handle.index < slots_.size() && (handle.generation & 1) &&
+           slots_[handle.index].generation == handle.generation;
+  }
+
+  // Returns the element of `handle`, or `nullptr` if `handle` isn't valid.
+  T* Get(SlotHandle handle) {
+    return Contains(handle) ? &values_[slots_[handle.index].position]
+                            : nullptr;
+  }
+  const T* Get(SlotHandle handle) const {
+    return Contains(handle) ? &values_[slots_[handle.index].position]
+                            : nullptr;
+  }
+
+  // Returns the handle of the element at `position` of the iteration order.
+  SlotHandle HandleAt(size_t position) const {
+    const uint32_t index = value_slots_[position];
+    return SlotHandle{index, slots_[index].generation};
+  }
+
+  size_t size() const { return values_.size(); }
+  bool empty() const { return values_.empty(); }
+  void reserve(size_t n) {
+    values_.reserve(n);
+    value_slots_.reserve(n);
+    slots_.reserve(n);
+  }
+
+  // Iterate over the elements in an unspecified order.
+  iterator begin() { return values_.begin(); }
+  iterator end() { return values_.end(); }
+  const_iterator begin() const { return values_.begin(); }
+  const_iterator end() const { return values_.end(); }
+  T* data() { return values_.data(); }
+  const T* data() const { return values_.data(); }
+
+ private:
+  static constexpr uint32_t kNoSlot = std::numeric_limits<uint32_t>::max();
+
+  struct Slot {
+    // The position in `values_` if occupied, otherwise the next free slot.
+    uint32_t position;
+    uint32_t generation;
+  };
+
+  std::vector<T> values_;
+  // The slot of each element of `values_`.
+  std::vector<uint32_t> value_slots_;
+  std::vector<Slot> slots_;
+  // The head of the list of free slots.
+  uint32_t free_ = kNoSlot;
+};
+
+// Provides access to a single element of a shared `SlotMap`, similarly to
+// `Ref<const T>`. Holds a reference to the whole map, so that it isn't
+// destroyed and, being shared, not modified, while any `SlotRef` exists.
+// Elements thus carry no reference count of their own.
+template <typename T, typename Alloc = std::allocator<SlotMap<T>>>
+class SlotRef {
+ public:
+  using Map = Ref<const SlotMap<T>, Alloc>;
+
+  // Returns a reference to the element of `handle` in `map`, or
+  // `absl::nullopt` if `handle` isn't valid.
+  static absl::optional<SlotRef> Make(Map map, SlotHandle handle) {
+    const T* value = map->Get(handle);
+    if (value == nullptr) {
+      return absl::nullopt;
+    }
+    return SlotRef(std::move(map), handle, value);
+  }
+
+  const T& operator*() const { return *value_; }
+  const T* operator->() const { return value_; }
+
+  SlotHandle handle() const { return handle_; }
+  const Map& map() const { return map_; }
+
+ private:
+  SlotRef(Map map, SlotHandle handle, const T* value)
+      : map_(std::move(map)), handle_(handle), value_(value) {}
+
+  Map map_;
+  SlotHandle handle_;
+  const T* value_;
+};
+
+}  // namespace refptr
+
+#endif  // _SLOT_MAP_H
@@ -0,0 +1,145 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Iteration over and random access to small entities, stored in a `SlotMap`
+// or each in its own `Refcounted` block referenced from a
+// `std::vector<Ref<const T>>`.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "ref.h"
+#include "slot_map.h"
+
+namespace refptr {
+namespace {
+
+struct Entity {
+  explicit Entity(int64_t i) : x(i), y(2 * i), z(3 * i) {}
+
+  int64_t x;
+  int64_t y;
+  int64_t z;
+};
+
+// Returns a random permutation of [0, n).
+std::vector<size_t> Shuffled(size_t n) {
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), std::mt19937(42));
+  return order;
+}
+
+struct RefVectorBackend {
+  explicit RefVectorBackend(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      refs.push_back(New<Entity>(static_cast<int64_t>(i)).Share());
+    }
+  }
+
+  template <typename F>
+  void ForEach(F&& f) const {
+    for (const Ref<const Entity>& ref : refs) {
+      f(*ref);
+    }
+  }
+  // Returns references in the order of `order`.
+  std::vector<Ref<const Entity>> Handles(const std::vector<size_t>& order) {
+    std::vector<Ref<const Entity>> result;
+    for (size_t i : order) {
+      result.push_back(refs[i]);
+    }
+    return result;
+  }
+  static const Entity& Get(const Ref<const Entity>& ref) { return *ref; }
+
+  std::vector<Ref<const Entity>> refs;
+};
+
+struct SlotMapBackend {
+  explicit SlotMapBackend(size_t n) {
+    map.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      handles.push_back(map.Insert(static_cast<int64_t>(i)));
+    }
+  }
+
+  template <typename F>
+  void ForEach(F&& f) const {
+    for (const Entity& entity : map) {
+      f(entity);
+    }
+  }
+  // Returns handles in the order of `order`.
+  std::vector<SlotHandle> Handles(const std::vector<size_t>& order) {
+    std::vector<SlotHandle> result;
+    for (size_t i : order) {
+      result.push_back(handles[i]);
+    }
+    return result;
+  }
+  const Entity& Get(SlotHandle handle) const { return *map.Get(handle); }
+
+  SlotMap<Entity> map;
+  std::vector<SlotHandle> handles;
+};
+
+// Argument: The number of entities.
+template <typename B>
+void BM_Iterate(benchmark::State& state) {
+  const B backend(static_cast<size_t>(state.range(0)));
+  for (auto _ : state) {
+    int64_t sum = 0;
+    backend.ForEach([&sum](const Entity& entity) { sum += entity.y; });
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_Iterate, RefVectorBackend)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_Iterate, SlotMapBackend)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 20);
+
+// Reads all entities through a list of their handles in a random order.
+// Argument: The number of entities.
+template <typename B>
+void BM_RandomAccess(benchmark::State& state) {
+  const size_t n = static_cast<size_t>(state.range(0));
+  B backend(n);
+  const auto handles = backend.Handles(Shuffled(n));
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const auto& handle : handles) {
+      sum += backend.Get(handle).y;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_RandomAccess, RefVectorBackend)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_RandomAccess, SlotMapBackend)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 20);
+
+}  // namespace
+}  // namespace refptr
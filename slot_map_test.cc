@@ -0,0 +1,105 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "slot_map.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/hash/hash.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace refptr {
+namespace {
+
+using ::testing::UnorderedElementsAre;
+
+TEST(SlotMapTest, InsertsAndGets) {
+  SlotMap<int> map;
+  SlotHandle a = map.Insert(1);
+  SlotHandle b = map.Insert(2);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(map.size(), 2);
+  ASSERT_NE(map.Get(a), nullptr);
+  EXPECT_EQ(*map.Get(a), 1);
+  EXPECT_EQ(*map.Get(b), 2);
+  *map.Get(b) = 3;
+  EXPECT_EQ(*map.Get(b), 3);
+  EXPECT_FALSE(map.Contains(SlotHandle()));
+  EXPECT_EQ(map.Get(SlotHandle()), nullptr);
+}
+
+TEST(SlotMapTest, ErasedHandlesStayInvalid) {
+  SlotMap<int> map;
+  SlotHandle a = map.Insert(1);
+  SlotHandle b = map.Insert(2);
+  EXPECT_TRUE(map.Erase(a));
+  EXPECT_FALSE(map.Erase(a));
+  EXPECT_FALSE(map.Contains(a));
+  EXPECT_EQ(*map.Get(b), 2) << "Moved element must stay reachable";
+  SlotHandle c = map.Insert(3);
+  EXPECT_EQ(c.index, a.index) << "Must reuse the free slot";
+  EXPECT_NE(c, a);
+  EXPECT_FALSE(map.Contains(a));
+  EXPECT_EQ(*map.Get(c), 3);
+  EXPECT_NE(absl::Hash<SlotHandle>()(a), absl::Hash<SlotHandle>()(c));
+}
+
+TEST(SlotMapTest, IteratesDensely) {
+  SlotMap<int> map;
+  std::vector<SlotHandle> handles;
+  for (int i = 0; i < 10; i++) {
+    handles.push_back(map.Insert(i));
+  }
+  for (int i = 0; i < 10; i += 3) {
+    map.Erase(handles[i]);
+  }
+  std::vector<int> values(map.begin(), map.end());
+  EXPECT_THAT(values, UnorderedElementsAre(1, 2, 4, 5, 7, 8));
+  for (size_t i = 0; i < map.size(); i++) {
+    EXPECT_EQ(map.Get(map.HandleAt(i)), map.data() + i);
+  }
+}
+
+TEST(SlotMapTest, HoldsMoveOnlyValues) {
+  SlotMap<std::unique_ptr<int>> map;
+  SlotHandle a = map.Insert(new int(1));
+  SlotHandle b = map.Insert(new int(2));
+  map.Erase(a);
+  EXPECT_EQ(**map.Get(b), 2);
+}
+
+TEST(SlotRefTest, AccessesSharedMap) {
+  Ref<SlotMap<int>> map = New<SlotMap<int>>();
+  SlotHandle a = map->Insert(1);
+  SlotHandle b = map->Insert(2);
+  map->Erase(b);
+  Ref<const SlotMap<int>> shared = std::move(map).Share();
+  absl::optional<SlotRef<int>> value = SlotRef<int>::Make(shared, a);
+  ASSERT_TRUE(value.has_value());
+  EXPECT_EQ(**value, 1);
+  EXPECT_EQ(value->handle(), a);
+  EXPECT_EQ(SlotRef<int>::Make(shared, b), absl::nullopt);
+  // Keeps the map alive.
+  const int* address = &**value;
+  { Ref<const SlotMap<int>> dropped = std::move(shared); }
+  EXPECT_EQ(&**value, address);
+  EXPECT_EQ(value->map()->size(), 1);
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,263 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _STRING_INTERNER_H
+#define _STRING_INTERNER_H
+
+// A concurrent string interner. Interned strings are `RefString`s, and the
+// returned `Symbol`s are a single word, in the style of `IntOrRef`: Either
+// the number of a symbol registered up front, or a reference to the string.
+//
+//     StringInterner interner({"if", "else", "while"});
+//     Symbol keyword = interner.Intern("else");   // Number 1.
+//     Symbol name = interner.Intern("counter");  // Reference to "counter".
+//     assert(interner.View(name) == "counter");
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "int_or_ptr.h"
+#include "ref_string.h"
+
+namespace refptr {
+
+// The number of independently locked shards of a `StringInterner`.
+constexpr size_t kInternerShards = 16;
+
+// A string interned by a `StringInterner`. Either the number of a symbol
+// registered by its constructor, or a reference to the interned string. Has
+// the size of a single pointer, and is cheaply copyable.
+//
+// Symbols interned by the same `StringInterner` are equal iff their strings
+// are equal. Referenced strings remain valid after the interner is destroyed.
+class Symbol {
+ public:
+  // Constructs the registered symbol number 0.
+  Symbol() = default;
+  explicit Symbol(intptr_t number) : value_(number) {}
+  explicit Symbol(RefString string)
+      : value_(absl::in_place, std::move(string)) {}
+
+  bool has_number() const { return value_.has_number(); }
+  bool has_string() const { return value_.has_value(); }
+  absl::optional<intptr_t> number() const { return value_.number(); }
+  // If `this` references a string, returns a pointer to it. Otherwise returns
+  // `nullptr`.
+  const RefString* string() const { return value_.value(); }
+
+  // Interned strings are compared by their addresses.
+  friend bool operator==(const Symbol& a, const Symbol& b) {
+    const RefString* a_string = a.string();
+    const RefString* b_string = b.string();
+    if (a_string == nullptr || b_string == nullptr) {
+      return a_string == b_string && a.number() == b.number();
+    }
+    return a_string->data() == b_string->data();
+  }
+  friend bool operator!=(const Symbol& a, const Symbol& b) {
+    return !(a == b);
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H state, const Symbol& value) {
+    const RefString* string = value.string();
+    if (string == nullptr) {
+      return H::combine(std::move(state), *value.number());
+    }
+    return H::combine(std::move(state), string->hash());
+  }
+
+ private:
+  internal::IntOrValue<RefString> value_;
+};
+
+// Maps strings to `Symbol`s. All methods are thread-safe.
+//
+// Strings are interned into one of `kInternerShards` hash tables, selected by
+// their hash. Strings already present are found without any locking; only
+// interning a new string locks its shard. Strings registered by the
+// constructor are stored in the same tables, together with their numbers, and
+// their symbols involve no reference counting.
+//
+// Tables are open-addressed arrays of pointers that are replaced by twice as
+// large ones as they fill up. Replaced tables are kept until the interner is
+// destroyed, as concurrent lookups can still be reading them, which at most
+// doubles the memory used by the tables.
+class StringInterner {
+ public:
+  // Registers `symbols` as numbers 0 to `symbols.size() - 1`. Duplicates get
+  // the number of their first occurrence.
+  explicit StringInterner(absl::Span<const absl::string_view> symbols = {}) {
+    names_.reserve(symbols.size());
+    for (absl::string_view symbol : symbols) {
+      const size_t hash = RefString::Hash()(symbol);
+      const Entry* entry = Insert(shards_[ShardIndex(hash)], symbol, hash,
+                                  static_cast<intptr_t>(names_.size()));
+      names_.push_back(&entry->string);
+    }
+  }
+  StringInterner(std::initializer_list<absl::string_view> symbols)
+      : StringInterner(absl::MakeConstSpan(symbols.begin(), symbols.size())) {}
+
+  StringInterner(const StringInterner&) = delete;
+  StringInterner& operator=(const StringInterner&) = delete;
+
+  // Returns the symbol of `value`, interning it if it isn't already.
+  Symbol Intern(absl::string_view value) {
+    const size_t hash = RefString::Hash()(value);
+    Shard& shard = shards_[ShardIndex(hash)];
+    const Entry* found =
+        Find(shard.table.load(std::memory_order_acquire), value, hash);
+    if (found == nullptr) {
+      found = Insert(shard, value, hash, kUnregistered);
+    }
+    if (found->number != kUnregistered) {
+      return Symbol(found->number);
+    }
+    return Symbol(found->string);
+  }
+
+  // Returns the string of `symbol`, which must have been returned by this
+  // interner.
+  absl::string_view View(const Symbol& symbol) const {
+    const RefString* string = symbol.string();
+    if (string != nullptr) {
+      return string->view();
+    }
+    const intptr_t number = *symbol.number();
+    assert(number >= 0 && static_cast<size_t>(number) < names_.size());
+    return names_[static_cast<size_t>(number)]->view();
+  }
+
+  // The number of distinct strings interned, including the registered ones.
+  size_t size() const {
+    size_t size = 0;
+    for (const Shard& shard : shards_) {
+      size += shard.size.load(std::memory_order_relaxed);
+    }
+    return size;
+  }
+
+ private:
+  static constexpr intptr_t kUnregistered = -1;
+
+  struct Entry {
+    Entry(absl::string_view value, intptr_t number_)
+        : string(value), number(number_) {}
+
+    RefString string;
+    intptr_t number;
+  };
+
+  struct Table {
+    explicit Table(size_t capacity)
+        : mask(capacity - 1),
+          slots(new std::atomic<const Entry*>[capacity]) {
+      for (size_t i = 0; i < capacity; i++) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    size_t mask;
+    std::unique_ptr<std::atomic<const Entry*>[]> slots;
+  };
+
+  struct Shard {
+    Shard() : table(nullptr), size(0) {
+      tables.emplace_back(new Table(16));
+      table.store(tables.back().get(), std::memory_order_relaxed);
+    }
+
+    std::atomic<const Table*> table;
+    std::atomic<size_t> size;
+    // Guards the members below and inserting into `table`.
+    std::mutex mutex;
+    // The current table is the last one.
+    std::vector<std::unique_ptr<Table>> tables;
+    // Elements never move, so that tables can point to them.
+    std::deque<Entry> entries;
+  };
+
+  // Selects shards by the high bits of hashes, as tables are indexed by the
+  // low ones.
+  static size_t ShardIndex(size_t hash) {
+    return (hash >> (8 * sizeof(size_t) - 8)) % kInternerShards;
+  }
+
+  static const Entry* Find(const Table* table, absl::string_view value,
+                           size_t hash) {
+    for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+      const Entry* entry = table->slots[i].load(std::memory_order_acquire);
+      if (entry == nullptr) {
+        return nullptr;
+      } else if (entry->string.hash() == hash &&
+                 entry->string.view() == value) {
+        return entry;
+      }
+    }
+  }
+
+  // Stores `entry` into the first free slot for `hash`.
+  static void Store(Table& table, const Entry* entry, size_t hash) {
+    size_t i = hash & table.mask;
+    while (table.slots[i].load(std::memory_order_relaxed) != nullptr) {
+      i = (i + 1) & table.mask;
+    }
+    table.slots[i].store(entry, std::memory_order_release);
+  }
+
+  // Returns the entry of `value`, adding it with `number` if it's missing.
+  static const Entry* Insert(Shard& shard, absl::string_view value,
+                             size_t hash, intptr_t number) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Table* table = shard.tables.back().get();
+    // Another thread could have inserted it since the unlocked lookup.
+    const Entry* found = Find(table, value, hash);
+    if (found != nullptr) {
+      return found;
+    }
+    const size_t size = shard.entries.size() + 1;
+    if (2 * size > table->mask + 1) {
+      shard.tables.emplace_back(new Table(2 * (table->mask + 1)));
+      table = shard.tables.back().get();
+      for (const Entry& entry : shard.entries) {
+        Store(*table, &entry, entry.string.hash());
+      }
+      shard.table.store(table, std::memory_order_release);
+    }
+    shard.entries.emplace_back(value, number);
+    Store(*table, &shard.entries.back(), hash);
+    shard.size.store(size, std::memory_order_relaxed);
+    return &shard.entries.back();
+  }
+
+  Shard shards_[kInternerShards];
+  // Registered strings, indexed by their numbers.
+  std::vector<const RefString*> names_;
+};
+
+}  // namespace refptr
+
+#endif  // _STRING_INTERNER_H
@@ -0,0 +1,148 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput of interning words drawn from a Zipf-distributed vocabulary by
+// 1 to 64 threads, comparing `StringInterner` to a map of
+// `Ref<const std::string>` guarded by a single mutex.
+
+#include <cstddef>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "benchmark/benchmark.h"
+#include "ref.h"
+#include "string_interner.h"
+
+namespace refptr {
+namespace {
+
+constexpr int kVocabulary = 1 << 16;
+// The number of the most frequent words registered up front.
+constexpr int kRegistered = 256;
+// The number of words interned by each thread, repeatedly.
+constexpr int kWordsPerThread = 4096;
+
+const std::vector<std::string>& Vocabulary() {
+  static const std::vector<std::string>* vocabulary = [] {
+    auto* words = new std::vector<std::string>();
+    for (int i = 0; i < kVocabulary; i++) {
+      words->push_back("identifier_" + std::to_string(i));
+    }
+    return words;
+  }();
+  return *vocabulary;
+}
+
+// Returns `kWordsPerThread` words, where word `i` of the vocabulary has
+// probability proportional to `1 / (i + 1)`.
+std::vector<absl::string_view> ZipfWords(int seed) {
+  static const std::discrete_distribution<int>* zipf = [] {
+    std::vector<double> weights;
+    for (int i = 0; i < kVocabulary; i++) {
+      weights.push_back(1.0 / (i + 1));
+    }
+    return new std::discrete_distribution<int>(weights.begin(),
+                                               weights.end());
+  }();
+  std::mt19937 random(seed);
+  std::discrete_distribution<int> distribution(*zipf);
+  std::vector<absl::string_view> words;
+  for (int i = 0; i < kWordsPerThread; i++) {
+    words.push_back(Vocabulary()[distribution(random)]);
+  }
+  return words;
+}
+
+class MutexMapBackend {
+ public:
+  using Handle = Ref<const std::string>;
+
+  Handle Intern(absl::string_view value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(value);
+    if (it == map_.end()) {
+      it = map_.emplace(std::string(value),
+                        New<std::string>(value.data(), value.size()).Share())
+               .first;
+    }
+    return it->second;
+  }
+
+ private:
+  std::mutex mutex_;
+  absl::flat_hash_map<std::string, Ref<const std::string>> map_;
+};
+
+class InternerBackend {
+ public:
+  using Handle = Symbol;
+
+  Handle Intern(absl::string_view value) { return interner_.Intern(value); }
+
+ private:
+  StringInterner interner_;
+};
+
+// Registers the `kRegistered` most frequent words, which become numbers.
+class RegisteredInternerBackend {
+ public:
+  using Handle = Symbol;
+
+  RegisteredInternerBackend() : interner_(Registered()) {}
+
+  Handle Intern(absl::string_view value) { return interner_.Intern(value); }
+
+ private:
+  static std::vector<absl::string_view> Registered() {
+    return std::vector<absl::string_view>(Vocabulary().begin(),
+                                          Vocabulary().begin() + kRegistered);
+  }
+
+  StringInterner interner_;
+};
+
+template <typename B>
+void BM_Intern(benchmark::State& state) {
+  static B* backend;
+  if (state.thread_index() == 0) {
+    backend = new B();
+  }
+  const std::vector<absl::string_view> words = ZipfWords(state.thread_index());
+  for (auto _ : state) {
+    for (absl::string_view word : words) {
+      typename B::Handle handle = backend->Intern(word);
+      benchmark::DoNotOptimize(handle);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kWordsPerThread);
+  if (state.thread_index() == 0) {
+    delete backend;
+  }
+}
+BENCHMARK_TEMPLATE(BM_Intern, MutexMapBackend)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Intern, InternerBackend)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Intern, RegisteredInternerBackend)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace refptr
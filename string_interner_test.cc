@@ -0,0 +1,120 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "string_interner.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/hash/hash.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace refptr {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Optional;
+
+TEST(SymbolTest, HasSizeOfPointer) {
+  EXPECT_EQ(sizeof(Symbol), sizeof(void*));
+}
+
+TEST(SymbolTest, HoldsNumberOrString) {
+  Symbol number(42);
+  EXPECT_TRUE(number.has_number());
+  EXPECT_THAT(number.number(), Optional(42));
+  EXPECT_THAT(number.string(), Eq(nullptr));
+
+  Symbol string{RefString("Lorem")};
+  EXPECT_TRUE(string.has_string());
+  EXPECT_EQ(string.number(), absl::nullopt);
+  ASSERT_NE(string.string(), nullptr);
+  EXPECT_EQ(string.string()->view(), "Lorem");
+  EXPECT_NE(number, string);
+  EXPECT_EQ(Symbol(), Symbol(0));
+}
+
+TEST(StringInternerTest, NumbersRegisteredSymbols) {
+  StringInterner interner({"if", "else", "while", "else"});
+  EXPECT_THAT(interner.Intern("if").number(), Optional(0));
+  EXPECT_THAT(interner.Intern("else").number(), Optional(1));
+  EXPECT_THAT(interner.Intern("while").number(), Optional(2));
+  EXPECT_EQ(interner.View(Symbol(2)), "while");
+  EXPECT_EQ(interner.View(Symbol(3)), "else");
+  EXPECT_EQ(interner.size(), 3);
+}
+
+TEST(StringInternerTest, InternsStrings) {
+  StringInterner interner({"if"});
+  const std::string name = "counter";
+  Symbol symbol = interner.Intern(name);
+  ASSERT_TRUE(symbol.has_string());
+  EXPECT_EQ(interner.View(symbol), "counter");
+  Symbol again = interner.Intern("counter");
+  EXPECT_EQ(again, symbol);
+  EXPECT_EQ(again.string()->data(), symbol.string()->data());
+  EXPECT_EQ(absl::Hash<Symbol>()(again), absl::Hash<Symbol>()(symbol));
+  EXPECT_NE(interner.Intern("index"), symbol);
+  EXPECT_EQ(interner.size(), 3);
+}
+
+TEST(StringInternerTest, SymbolsOutliveInterner) {
+  Symbol symbol;
+  {
+    StringInterner interner;
+    symbol = interner.Intern("Lorem ipsum");
+  }
+  ASSERT_TRUE(symbol.has_string());
+  EXPECT_EQ(symbol.string()->view(), "Lorem ipsum");
+}
+
+TEST(StringInternerTest, GrowsTables) {
+  StringInterner interner;
+  std::vector<Symbol> symbols;
+  for (int i = 0; i < 10000; i++) {
+    symbols.push_back(interner.Intern(std::to_string(i)));
+  }
+  EXPECT_EQ(interner.size(), 10000);
+  for (int i = 0; i < 10000; i++) {
+    EXPECT_EQ(interner.Intern(std::to_string(i)), symbols[i]);
+    EXPECT_EQ(interner.View(symbols[i]), std::to_string(i));
+  }
+}
+
+TEST(StringInternerTest, InternsConcurrently) {
+  constexpr int kThreads = 4;
+  constexpr int kStrings = 2000;
+  StringInterner interner;
+  std::vector<std::vector<Symbol>> symbols(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&interner, &symbols, t] {
+      for (int i = 0; i < kStrings; i++) {
+        symbols[t].push_back(interner.Intern(std::to_string(i)));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(interner.size(), kStrings);
+  for (int t = 1; t < kThreads; t++) {
+    EXPECT_EQ(symbols[t], symbols[0]);
+  }
+}
+
+}  // namespace
+}  // namespace refptr
@@ -0,0 +1,205 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+// Telemetry of live `Refcounted<T>` blocks per type `T`: Their number, total
+// bytes and the distribution of their current reference counts.
+//
+// Collected only if `REFPTR_TELEMETRY` is defined, for example by linking the
+// `ref_telemetry` CMake target. It must be defined consistently in all
+// translation units of a program. Otherwise `TelemetrySnapshot()` returns an
+// empty vector.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/numeric/bits.h"
+#include "demangle.h"
+#include "thread_shards.h"
+
+namespace refptr {
+
+// Telemetry of a single type, as returned by `TelemetrySnapshot()`.
+struct TypeTelemetry {
+  // Reference counts are bucketed by powers of two: Bucket 0 counts
+  // reference count 1, bucket `i > 0` counts those in (2^(i-1), 2^i].
+  static constexpr int kRefcountBuckets = 32;
+
+  static int RefcountBucket(int64_t refcount) {
+    const int bucket =
+        static_cast<int>(absl::bit_width(static_cast<uint64_t>(refcount - 1)));
+    return bucket < kRefcountBuckets ? bucket : kRefcountBuckets - 1;
+  }
+
+  int64_t live_blocks() const { return created - destroyed; }
+  int64_t live_bytes() const { return created_bytes - destroyed_bytes; }
+
+  // Demangled, if possible.
+  std::string type_name;
+  int64_t created = 0;
+  int64_t destroyed = 0;
+  int64_t created_bytes = 0;
+  int64_t destroyed_bytes = 0;
+  // The number of live blocks by their current reference count, including
+  // blocks that were never shared.
+  int64_t refcount_histogram[kRefcountBuckets] = {};
+};
+
+namespace internal {
+
+// Counters of a single type and thread. Histogram buckets of a single shard
+// can be negative, when a block moves between buckets on different threads.
+struct TelemetryShard {
+  std::atomic<int64_t> created{0};
+  std::atomic<int64_t> destroyed{0};
+  std::atomic<int64_t> created_bytes{0};
+  std::atomic<int64_t> destroyed_bytes{0};
+  std::atomic<int64_t> refcount_histogram[TypeTelemetry::kRefcountBuckets] =
+      {};
+};
+
+// A type registered for telemetry.
+struct TelemetryType {
+  const std::type_info& type;
+  // Adds the counters of the type to `telemetry`.
+  void (*collect)(TypeTelemetry& telemetry);
+  TelemetryType* next;
+};
+
+// Lock-free, append-only list of types that had at least one block created.
+inline std::atomic<TelemetryType*>& TelemetryTypes() {
+  static std::atomic<TelemetryType*> head{nullptr};
+  return head;
+}
+
+template <typename T>
+class TypeTelemetryCounters {
+ public:
+  static void OnNew(size_t bytes) {
+    static TelemetryType* const type = Register();
+    (void)type;
+    TelemetryShard& shard = Shards::Local();
+    AddToShardCounter(shard.created, 1);
+    AddToShardCounter(shard.created_bytes, bytes);
+    AddToShardCounter(shard.refcount_histogram[0], 1);
+  }
+
+  static void OnDelete(size_t bytes) {
+    TelemetryShard& shard = Shards::Local();
+    AddToShardCounter(shard.destroyed, 1);
+    AddToShardCounter(shard.destroyed_bytes, bytes);
+    // Blocks are deleted after their last reference is dropped.
+    AddToShardCounter(shard.refcount_histogram[0], -1);
+  }
+
+  // The reference count of a block increased to `refcount`.
+  static void OnShare(int64_t refcount) { Move(refcount - 1, refcount); }
+  // The reference count of a block decreased to `refcount`.
+  static void OnRelease(int64_t refcount) { Move(refcount + 1, refcount); }
+
+ private:
+  using Shards = ThreadShards<TelemetryShard, T>;
+
+  // Moves a block between the histogram buckets of the reference counts, which
+  // only changes at powers of two.
+  static void Move(int64_t from, int64_t to) {
+    const int from_bucket = TypeTelemetry::RefcountBucket(from);
+    const int to_bucket = TypeTelemetry::RefcountBucket(to);
+    if (ABSL_PREDICT_TRUE(from_bucket == to_bucket)) {
+      return;
+    }
+    TelemetryShard& shard = Shards::Local();
+    AddToShardCounter(shard.refcount_histogram[from_bucket], -1);
+    AddToShardCounter(shard.refcount_histogram[to_bucket], 1);
+  }
+
+  static TelemetryType* Register() {
+    auto* type = new TelemetryType{typeid(T), &Collect, nullptr};
+    std::atomic<TelemetryType*>& head = TelemetryTypes();
+    type->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(type->next, type,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    }
+    return type;
+  }
+
+  static void Collect(TypeTelemetry& telemetry) {
+    Shards::ForEach([&telemetry](const TelemetryShard& shard) {
+      telemetry.created += shard.created.load(std::memory_order_relaxed);
+      telemetry.destroyed += shard.destroyed.load(std::memory_order_relaxed);
+      telemetry.created_bytes +=
+          shard.created_bytes.load(std::memory_order_relaxed);
+      telemetry.destroyed_bytes +=
+          shard.destroyed_bytes.load(std::memory_order_relaxed);
+      for (int i = 0; i < TypeTelemetry::kRefcountBuckets; i++) {
+        telemetry.refcount_histogram[i] +=
+            shard.refcount_histogram[i].load(std::memory_order_relaxed);
+      }
+    });
+  }
+};
+
+}  // namespace internal
+
+// Returns the telemetry of all types that had at least one block created,
+// ordered by their live bytes, largest first. Counters modified concurrently
+// might be observed in an inconsistent state with each other.
+inline std::vector<TypeTelemetry> TelemetrySnapshot() {
+  std::vector<TypeTelemetry> result;
+  for (const internal::TelemetryType* type =
+           internal::TelemetryTypes().load(std::memory_order_acquire);
+       type != nullptr; type = type->next) {
+    result.emplace_back();
+    result.back().type_name = internal::Demangle(type->type.name());
+    type->collect(result.back());
+  }
+  std::stable_sort(result.begin(), result.end(),
+                   [](const TypeTelemetry& a, const TypeTelemetry& b) {
+                     return a.live_bytes() > b.live_bytes();
+                   });
+  return result;
+}
+
+// Writes `TelemetrySnapshot()` to `out` in a human-readable form, one line
+// per type.
+inline void DumpTelemetry(std::ostream& out) {
+  for (const TypeTelemetry& type : TelemetrySnapshot()) {
+    out << type.type_name << ": live_blocks=" << type.live_blocks()
+        << " live_bytes=" << type.live_bytes() << " created=" << type.created
+        << " refcounts=[";
+    int last = TypeTelemetry::kRefcountBuckets - 1;
+    while (last > 0 && type.refcount_histogram[last] == 0) {
+      last--;
+    }
+    for (int i = 0; i <= last; i++) {
+      out << (i > 0 ? " " : "") << "<=" << (int64_t{1} << i) << ":"
+          << type.refcount_histogram[i];
+    }
+    out << "]\n";
+  }
+}
+
+}  // namespace refptr
+
+#endif  // _TELEMETRY_H
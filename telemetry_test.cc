@@ -0,0 +1,104 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "telemetry.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "ref.h"
+#include "var_sized.h"
+
+#ifndef REFPTR_TELEMETRY
+#error "This test must be compiled with REFPTR_TELEMETRY defined"
+#endif
+
+namespace refptr {
+namespace {
+
+using ::testing::HasSubstr;
+
+struct TrackedFoo {
+  int value;
+};
+
+struct TrackedBar {
+  int value;
+};
+
+TypeTelemetry Find(const std::string& type_name) {
+  for (TypeTelemetry& type : TelemetrySnapshot()) {
+    if (type.type_name.find(type_name) != std::string::npos) {
+      return type;
+    }
+  }
+  return TypeTelemetry();
+}
+
+TEST(TelemetryTest, CountsLiveBlocksAndBytes) {
+  {
+    Ref<const TrackedFoo> foo = New<TrackedFoo>(TrackedFoo{1}).Share();
+    char* array;
+    auto bar = MakeRefCounted<TrackedBar, char, TrackedBar>(100, array,
+                                                              TrackedBar{2});
+    const TypeTelemetry foo_telemetry = Find("TrackedFoo");
+    EXPECT_EQ(foo_telemetry.live_blocks(), 1);
+    EXPECT_EQ(foo_telemetry.live_bytes(),
+              sizeof(Refcounted<TrackedFoo, std::allocator<TrackedFoo>>));
+    const TypeTelemetry bar_telemetry = Find("TrackedBar");
+    EXPECT_EQ(bar_telemetry.live_blocks(), 1);
+    EXPECT_GE(bar_telemetry.live_bytes(), sizeof(TrackedBar) + 100);
+    // Ordered by live bytes.
+    EXPECT_EQ(TelemetrySnapshot().front().type_name, bar_telemetry.type_name);
+  }
+  EXPECT_EQ(Find("TrackedFoo").live_blocks(), 0);
+  EXPECT_EQ(Find("TrackedFoo").live_bytes(), 0);
+  EXPECT_EQ(Find("TrackedBar").live_blocks(), 0);
+  EXPECT_EQ(Find("TrackedBar").live_bytes(), 0);
+}
+
+TEST(TelemetryTest, RecordsLiveRefcountDistribution) {
+  struct Shared {};
+  auto bucket = [](int64_t refcount) {
+    return Find("Shared").refcount_histogram[TypeTelemetry::RefcountBucket(
+        refcount)];
+  };
+  {
+    Ref<const Shared> unshared = New<Shared>().Share();
+    Ref<const Shared> original = New<Shared>().Share();
+    std::vector<Ref<const Shared>> copies(5, original);
+    EXPECT_EQ(bucket(1), 1);
+    EXPECT_EQ(bucket(6), 1);
+    EXPECT_EQ(bucket(2), 0);
+    copies.erase(copies.begin() + 1, copies.end());
+    EXPECT_EQ(bucket(2), 1);
+    EXPECT_EQ(bucket(6), 0);
+  }
+  for (int i = 0; i < TypeTelemetry::kRefcountBuckets; i++) {
+    EXPECT_EQ(Find("Shared").refcount_histogram[i], 0) << i;
+  }
+}
+
+TEST(TelemetryTest, Dumps) {
+  Ref<TrackedFoo> foo = New<TrackedFoo>(TrackedFoo{1});
+  std::ostringstream out;
+  DumpTelemetry(out);
+  EXPECT_THAT(out.str(), HasSubstr("TrackedFoo: live_blocks=1"));
+}
+
+}  // namespace
+}  // namespace refptr
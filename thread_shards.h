@@ -0,0 +1,129 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _THREAD_SHARDS_H
+#define _THREAD_SHARDS_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "absl/base/optimization.h"
+
+namespace refptr {
+namespace internal {
+
+// Adds `value` to a counter that is modified only by a single thread. Avoids
+// the cost of an atomic read-modify-write operation, while still allowing
+// other threads to read the counter.
+inline void AddToShardCounter(std::atomic<int64_t>& counter, int64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+// Provides a separate, default-constructed instance of `Shard` to every thread
+// for collecting statistics without contention. Only the owning thread should
+// modify its shard, any thread can read all of them with `ForEach`.
+//
+// Shards are never deleted. A shard of a finished thread is reused by a new
+// one, retaining its values. Different `Tag` types have separate shards.
+// If destructors of other thread-local variables use `Local()` after the
+// thread released its shard, it gets a new one that is never released.
+template <typename Shard, typename Tag = Shard>
+class ThreadShards {
+ public:
+  static Shard& Local() {
+    // Kept separately from `owner` so that it remains usable by destructors of
+    // other thread-local variables.
+    static thread_local Node* node = nullptr;
+    if (ABSL_PREDICT_FALSE(node == nullptr)) {
+      static thread_local bool released = false;
+      if (ABSL_PREDICT_FALSE(released)) {
+        // A destructor of another thread-local variable runs after `owner`
+        // released the shard, which a new thread might have taken over
+        // meanwhile. Takes another shard, which stays in use for good, as
+        // there is no later point to release it.
+        node = Acquire();
+      } else {
+        static thread_local NodeOwner owner;
+        owner.cache = &node;
+        owner.released = &released;
+        owner.node = node = Acquire();
+      }
+    }
+    return node->shard;
+  }
+
+  // Calls `f(shard)` on the shards of all threads, including finished ones.
+  template <typename F>
+  static void ForEach(F&& f) {
+    for (Node* node = Head().load(std::memory_order_acquire); node != nullptr;
+         node = node->next) {
+      f(node->shard);
+    }
+  }
+
+ private:
+  struct Node {
+    Shard shard;
+    // Set while a thread owns this shard.
+    std::atomic<bool> in_use{true};
+    // Forms a lock-free, append-only list.
+    Node* next = nullptr;
+  };
+
+  // Releases the shard of a thread when it finishes. Clears the cached
+  // pointer first, so that the thread doesn't modify the shard afterwards.
+  struct NodeOwner {
+    ~NodeOwner() {
+      if (node != nullptr) {
+        *cache = nullptr;
+        *released = true;
+        node->in_use.store(false, std::memory_order_release);
+      }
+    }
+
+    Node* node = nullptr;
+    Node** cache = nullptr;
+    bool* released = nullptr;
+  };
+
+  static std::atomic<Node*>& Head() {
+    static std::atomic<Node*> head{nullptr};
+    return head;
+  }
+
+  static Node* Acquire() {
+    std::atomic<Node*>& head = Head();
+    for (Node* node = head.load(std::memory_order_acquire); node != nullptr;
+         node = node->next) {
+      bool in_use = false;
+      if (node->in_use.compare_exchange_strong(in_use, true,
+                                               std::memory_order_acq_rel)) {
+        return node;
+      }
+    }
+    Node* node = new Node();
+    node->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(node->next, node,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    }
+    return node;
+  }
+};
+
+}  // namespace internal
+}  // namespace refptr
+
+#endif  // _THREAD_SHARDS_H
@@ -0,0 +1,270 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Multi-threaded benchmarks comparing the atomic reference counting of
+// `Ref<const T>` and `CopyOnWrite<T>` to `std::shared_ptr<const T>`.
+//
+// The reported time is the real time per operation of a single thread, so
+// scaling curves can be read directly from the `/threads:N` variants.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/utility/utility.h"
+#include "benchmark/benchmark.h"
+#include "benchmark_channel.h"
+#include "copy_on_write.h"
+#include "ref.h"
+
+namespace refptr {
+namespace {
+
+// A cache-line sized value so that reading it has a realistic cost.
+struct Payload {
+  // Required by `CopyOnWrite`.
+  Payload() : Payload(0) {}
+  explicit Payload(int64_t value) {
+    for (auto& v : values) {
+      v = value++;
+    }
+  }
+
+  int64_t values[8];
+};
+
+struct RefBackend {
+  using Pointer = Ref<const Payload>;
+  static Pointer Make(int64_t value) { return New<Payload>(value).Share(); }
+};
+
+struct SharedPtrBackend {
+  using Pointer = std::shared_ptr<const Payload>;
+  static Pointer Make(int64_t value) {
+    return std::make_shared<const Payload>(value);
+  }
+};
+
+struct CopyOnWriteBackend {
+  using Pointer = CopyOnWrite<Payload>;
+  static Pointer Make(int64_t value) {
+    return CopyOnWrite<Payload>(absl::in_place, value);
+  }
+};
+
+void SetOpsProcessed(benchmark::State& state) {
+  state.SetItemsProcessed(state.iterations());
+}
+
+// All threads repeatedly copy and release a single shared pointer, contending
+// on its reference count.
+template <typename B>
+void BM_ManyReaders(benchmark::State& state) {
+  static typename B::Pointer* shared;
+  if (state.thread_index() == 0) {
+    shared = new typename B::Pointer(B::Make(42));
+  }
+  for (auto _ : state) {
+    typename B::Pointer copy(*shared);
+    benchmark::DoNotOptimize(copy->values[state.thread_index() % 8]);
+  }
+  if (state.thread_index() == 0) {
+    delete shared;
+  }
+  SetOpsProcessed(state);
+}
+BENCHMARK_TEMPLATE(BM_ManyReaders, RefBackend)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ManyReaders, SharedPtrBackend)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ManyReaders, CopyOnWriteBackend)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+// Every thread reads its own copy of a shared pointer, which should scale
+// linearly as there is no contention on the reference count.
+template <typename B>
+void BM_PrivateReaders(benchmark::State& state) {
+  const typename B::Pointer local = B::Make(state.thread_index());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(local->values[0]);
+    benchmark::ClobberMemory();
+  }
+  SetOpsProcessed(state);
+}
+BENCHMARK_TEMPLATE(BM_PrivateReaders, RefBackend)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PrivateReaders, SharedPtrBackend)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+// Same as `Payload`, but with its reference count on a separate cache line.
+struct IsolatedPayload : public Payload {
+  using Payload::Payload;
+};
+
+}  // namespace
+
+template <>
+struct IsolateRefcount<IsolatedPayload> : std::true_type {};
+
+namespace {
+
+// Thread 0 repeatedly copies and releases a shared `Ref`, while the other
+// threads only read its value. Unless the reference count is isolated, each
+// copy invalidates the cache line of the value in the readers' caches.
+// Reports the total `reads` and `shares` per second.
+template <typename P>
+void BM_ReadWhileSharing(benchmark::State& state) {
+  static Ref<const P>* shared;
+  if (state.thread_index() == 0) {
+    shared = new Ref<const P>(New<P>(42));
+  }
+  int64_t sum = 0;
+  for (auto _ : state) {
+    if (state.thread_index() == 0) {
+      Ref<const P> copy(*shared);
+      benchmark::DoNotOptimize(copy);
+    } else {
+      for (int64_t v : (*shared)->values) {
+        sum += v;
+      }
+      benchmark::ClobberMemory();
+    }
+  }
+  benchmark::DoNotOptimize(sum);
+  const bool sharing = state.thread_index() == 0;
+  state.counters["reads"] = benchmark::Counter(
+      sharing ? 0 : static_cast<double>(state.iterations()),
+      benchmark::Counter::kIsRate);
+  state.counters["shares"] = benchmark::Counter(
+      sharing ? static_cast<double>(state.iterations()) : 0,
+      benchmark::Counter::kIsRate);
+  if (state.thread_index() == 0) {
+    delete shared;
+  }
+}
+BENCHMARK_TEMPLATE(BM_ReadWhileSharing, Payload)
+    ->ThreadRange(2, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReadWhileSharing, IsolatedPayload)
+    ->ThreadRange(2, 16)
+    ->UseRealTime();
+
+// Channels shared by the threads of a single producer/consumer benchmark run.
+// Even threads produce into the channel of their pair, odd threads consume.
+template <typename B>
+struct PairChannels {
+  static Channel<typename B::Pointer>& SetUp(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+      channels =
+          new std::vector<Channel<typename B::Pointer>>(state.threads() / 2);
+      ready.store(true, std::memory_order_release);
+    } else {
+      // The start barrier of the benchmark loop is too late, as we need the
+      // address of the channel before that.
+      while (!ready.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+    }
+    return (*channels)[state.thread_index() / 2];
+  }
+
+  static void TearDown(benchmark::State& state) {
+    // The last thread to finish deletes the channels.
+    if (done.fetch_add(1, std::memory_order_acq_rel) + 1 == state.threads()) {
+      delete channels;
+      done.store(0, std::memory_order_relaxed);
+      ready.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  static std::vector<Channel<typename B::Pointer>>* channels;
+  static std::atomic<bool> ready;
+  static std::atomic<int> done;
+};
+
+template <typename B>
+std::vector<Channel<typename B::Pointer>>* PairChannels<B>::channels;
+template <typename B>
+std::atomic<bool> PairChannels<B>::ready{false};
+template <typename B>
+std::atomic<int> PairChannels<B>::done{0};
+
+// Producers allocate new values and hand them over to consumers, which read
+// and release them. Every value is therefore freed on a different thread than
+// the one that allocated it.
+template <typename B>
+void BM_ProducerConsumerHandoff(benchmark::State& state) {
+  auto& channel = PairChannels<B>::SetUp(state);
+  const bool producer = (state.thread_index() % 2) == 0;
+  int64_t i = 0;
+  for (auto _ : state) {
+    if (producer) {
+      channel.Push(B::Make(i++));
+    } else {
+      auto value = channel.Pop();
+      benchmark::DoNotOptimize(value->values[7]);
+    }
+  }
+  PairChannels<B>::TearDown(state);
+  SetOpsProcessed(state);
+}
+
+// Producers release their own copy of each value only after handing over
+// another one, so both threads race on the final decrement and the value is
+// freed by whichever thread releases it last.
+template <typename B>
+void BM_CrossThreadRelease(benchmark::State& state) {
+  auto& channel = PairChannels<B>::SetUp(state);
+  const bool producer = (state.thread_index() % 2) == 0;
+  int64_t i = 0;
+  for (auto _ : state) {
+    if (producer) {
+      typename B::Pointer value = B::Make(i++);
+      channel.Push(value);
+      benchmark::DoNotOptimize(value->values[0]);
+    } else {
+      auto value = channel.Pop();
+      benchmark::DoNotOptimize(value->values[7]);
+    }
+  }
+  PairChannels<B>::TearDown(state);
+  SetOpsProcessed(state);
+}
+
+#define PAIRED_THREADS(b) \
+  b->Threads(2)->Threads(4)->Threads(8)->Threads(16)->UseRealTime()
+
+PAIRED_THREADS(BENCHMARK_TEMPLATE(BM_ProducerConsumerHandoff, RefBackend));
+PAIRED_THREADS(
+    BENCHMARK_TEMPLATE(BM_ProducerConsumerHandoff, SharedPtrBackend));
+PAIRED_THREADS(
+    BENCHMARK_TEMPLATE(BM_ProducerConsumerHandoff, CopyOnWriteBackend));
+
+PAIRED_THREADS(BENCHMARK_TEMPLATE(BM_CrossThreadRelease, RefBackend));
+PAIRED_THREADS(BENCHMARK_TEMPLATE(BM_CrossThreadRelease, SharedPtrBackend));
+PAIRED_THREADS(BENCHMARK_TEMPLATE(BM_CrossThreadRelease, CopyOnWriteBackend));
+
+#undef PAIRED_THREADS
+
+}  // namespace
+}  // namespace refptr
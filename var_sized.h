@@ -15,10 +15,13 @@
 #ifndef _VAR_SIZED_H
 #define _VAR_SIZED_H
 
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <new>
 #include <type_traits>
+#include <utility>
 
 #include "ref.h"
 
@@ -29,11 +32,26 @@ namespace refptr {
 
 // Allocates a given additional number of elements of type `A` to every
 // allocated instance(s) of `T`.
-template <typename A, typename Alloc, typename T>
+//
+// The array is aligned to `ArrayAlignment`, which can exceed `alignof(A)`, for
+// example 32 or 64 to let SIMD code use aligned loads. In that case its length
+// is also padded to a multiple of `ArrayAlignment` bytes, see `PaddedSize`.
+// Over-aligned allocation requires `Alloc` to honor the alignment of its
+// value type, which `std::allocator` does with C++17 or `-faligned-new`.
+template <typename A, typename Alloc, typename T,
+          size_t ArrayAlignment = alignof(A)>
 class VarAllocator {
   static_assert(!std::is_destructible<A>::value ||
                     std::is_trivially_destructible<A>::value,
                 "The array type must be primitive or trivially destructible");
+  static_assert(ArrayAlignment >= alignof(A) &&
+                    (ArrayAlignment & (ArrayAlignment - 1)) == 0,
+                "The array alignment must be a power of two of at least the "
+                "alignment of its type");
+  static_assert(ArrayAlignment == alignof(A) ||
+                    ArrayAlignment % sizeof(A) == 0,
+                "A larger array alignment must be a multiple of the size of "
+                "the array type");
 
  public:
   using value_type = T;
@@ -45,34 +63,47 @@ class VarAllocator {
   }
 
   template <typename RebindAlloc, typename U>
-  VarAllocator(const VarAllocator<A, RebindAlloc, U>& other)
+  VarAllocator(const VarAllocator<A, RebindAlloc, U, ArrayAlignment>& other)
       : allocator_(other.allocator_), size_(other.size_) {}
   template <typename RebindAlloc, typename U>
-  VarAllocator(VarAllocator<A, RebindAlloc, U>&& other)
+  VarAllocator(VarAllocator<A, RebindAlloc, U, ArrayAlignment>&& other)
       : allocator_(std::move(other.allocator_)), size_(other.size_) {}
 
   template <typename RebindAlloc, typename U>
-  VarAllocator& operator=(const VarAllocator<A, RebindAlloc, U>& other) {
+  VarAllocator& operator=(
+      const VarAllocator<A, RebindAlloc, U, ArrayAlignment>& other) {
     allocator_ = other.allocator_;
     size_ = other.size_;
     return *this;
   }
   template <typename RebindAlloc, typename U>
-  VarAllocator& operator=(VarAllocator<A, RebindAlloc, U>&& other) {
+  VarAllocator& operator=(
+      VarAllocator<A, RebindAlloc, U, ArrayAlignment>&& other) {
     allocator_ = std::move(other.allocator_);
     size_ = other.size_;
     return *this;
   }
 
+  // Allocations are reported to `HeapSampler` here and not by `Refcounted`,
+  // so that `MakeUnique` and `MakeShared` are sampled as well.
+  using samples_heap = std::true_type;
+
   T* allocate(size_t length) {
     static_assert(offsetof(Placeholder, node) == 0,
                   "POD first member must be at the 0 offset");
     auto* result =
         reinterpret_cast<T*>(std::allocator_traits<UnitAlloc>::allocate(
             allocator_, AllocatedUnits(/*t_elements=*/length)));
+    assert(reinterpret_cast<uintptr_t>(result) % alignof(Unit) == 0);
+#ifdef REFPTR_HEAP_SAMPLING
+    HeapSampler::OnAllocate(result, AllocatedBytes(length));
+#endif
     return result;
   }
   void deallocate(T* ptr, size_t length) {
+#ifdef REFPTR_HEAP_SAMPLING
+    HeapSampler::OnDeallocate(ptr);
+#endif
     std::allocator_traits<UnitAlloc>::deallocate(
         allocator_, reinterpret_cast<Unit*>(ptr),
         AllocatedUnits(/*t_elements=*/length));
@@ -95,26 +126,57 @@ class VarAllocator {
   }
 
   // Returns an uninitialized area of memory co-allocated by a previous call to
-  // `allocate(length)`, that is suitable for holding `GetSize()` elements of
-  // type `A`.
+  // `allocate(length)`, that is suitable for holding `PaddedSize()` elements
+  // of type `A`, aligned to `ArrayAlignment`.
   A* Array(T* ptr, size_t length) const {
+    const uintptr_t end = reinterpret_cast<uintptr_t>(ptr + length);
+    // Blocks are aligned to `alignof(T)` and so is `end` then.
     return reinterpret_cast<A*>(
-        &reinterpret_cast<Placeholder*>(ptr + (length - 1))->array);
+        ArrayAlignment <= alignof(T)
+            ? end
+            : (end + ArrayAlignment - 1) & ~uintptr_t{ArrayAlignment - 1});
   }
 
   size_t GetSize() const { return size_; }
 
+  // Returns `GetSize()` rounded up to a multiple of `ArrayAlignment` bytes, if
+  // it exceeds `alignof(A)`. Then code processing the array in vectors of that
+  // size doesn't need to handle a remainder.
+  size_t PaddedSize() const { return PaddedSize(size_); }
+  static constexpr size_t PaddedSize(size_t a_elements) {
+    return ArrayAlignment == alignof(A)
+               ? a_elements
+               : (a_elements + kVectorElements - 1) / kVectorElements *
+                     kVectorElements;
+  }
+
+  // Returns the number of bytes allocated by `allocate(length)`.
+  size_t AllocatedBytes(size_t length) const {
+    return AllocatedUnits(length) * sizeof(Unit);
+  }
+
   template <typename U>
   struct rebind {
-    using other = VarAllocator<A, Alloc, U>;
+    using other = VarAllocator<A, Alloc, U, ArrayAlignment>;
   };
 
+  // Forwards to `Alloc::Recycle`, if it exists, so that it can take over
+  // blocks instead of them being destroyed, see `RefPool`.
+  template <typename Block, typename BlockAlloc = Alloc>
+  auto Recycle(Block* block)
+      -> decltype(std::declval<BlockAlloc&>().Recycle(block)) {
+    BlockAlloc allocator(allocator_);
+    return allocator.Recycle(block);
+  }
+
  private:
+  static constexpr size_t kVectorElements = ArrayAlignment / sizeof(A);
+
   // Holds a properly aligned instance of `T` and an array of length 1 of `A`.
   struct Placeholder {
     typename std::aligned_storage<sizeof(T), alignof(T)>::type node;
     // The array type must be the last one in the struct.
-    typename std::aligned_storage<sizeof(A[1]), alignof(A[1])>::type array;
+    typename std::aligned_storage<sizeof(A[1]), ArrayAlignment>::type array;
   };
   // Properly aligned unit used for the actual allocation.
   // It can occupy more than 1 byte, therefore we need to properly compute
@@ -125,8 +187,8 @@ class VarAllocator {
 
   // The number of additional bytes necessary to allocate.
   static constexpr size_t AdditionalBytes(size_t a_elements) {
-    return sizeof(Placeholder) - sizeof(T) + (a_elements - 1) * sizeof(A) +
-           sizeof(Unit) - 1l;
+    return sizeof(Placeholder) - sizeof(T) +
+           (PaddedSize(a_elements) - 1) * sizeof(A) + sizeof(Unit) - 1l;
   }
 
   static constexpr size_t AllocatedUnits(size_t a_elements, size_t t_elements) {
@@ -141,7 +203,7 @@ class VarAllocator {
   UnitAlloc allocator_;
   size_t size_;
 
-  template <typename B, typename BAlloc, typename U>
+  template <typename B, typename BAlloc, typename U, size_t BAlignment>
   friend class VarAllocator;
 };
 
@@ -158,56 +220,107 @@ struct AllocDeleter {
   }
 };
 
+namespace internal {
+
+// Default-initializes `length` elements at `array`, like `new B[length]`, and
+// value-initializes the padding that follows up to `padded`, so that SIMD code
+// processing whole vectors reads zeros there.
+template <typename B>
+inline B* NewPaddedArray(B* array, size_t length, size_t padded) {
+  B* result = new (array) B[length];
+  if (padded > length) {
+    new (array + length) B[padded - length]();
+  }
+  return result;
+}
+
+}  // namespace internal
+
 // Constructs a new instance of `U` in-place using the given arguments, with an
 // additional block of memory of `B[length]`, with a single memory allocation.
 // A `B*` pointer to this buffer and its `size_t` length are passed as the
 // first two arguments to the constructor of `U`.
-template <typename U, typename B, typename... Arg,
+//
+// `MakeUnique<U, B, ArrayAlignment, Arg...>(...)` and similarly `MakeShared`
+// and `MakeRefCounted` below align the buffer to `ArrayAlignment` and pad it
+// with zeros to `VarAllocator::PaddedSize`:
+//
+//     float* array;
+//     auto ref = MakeRefCounted<Foo, float, 64, int>(length, array, 42);
+template <typename U, typename B, size_t ArrayAlignment, typename... Arg,
           typename Alloc = std::allocator<B>>
-inline std::unique_ptr<U, AllocDeleter<VarAllocator<B, Alloc, U>>> MakeUnique(
-    size_t length, B*& varsized, Arg&&... args, Alloc alloc = {}) {
-  VarAllocator<B, Alloc, U> var_alloc(std::move(alloc), length);
-  U* node =
-      std::allocator_traits<VarAllocator<B, Alloc, U>>::allocate(var_alloc, 1);
+inline std::unique_ptr<U,
+                       AllocDeleter<VarAllocator<B, Alloc, U, ArrayAlignment>>>
+MakeUnique(size_t length, B*& varsized, Arg&&... args, Alloc alloc = {}) {
+  using VarAlloc = VarAllocator<B, Alloc, U, ArrayAlignment>;
+  VarAlloc var_alloc(std::move(alloc), length);
+  U* node = std::allocator_traits<VarAlloc>::allocate(var_alloc, 1);
   try {
-    std::allocator_traits<VarAllocator<B, Alloc, U>>::construct(
-        var_alloc, node, std::forward<Arg>(args)...);
-    varsized = new (var_alloc.Array(node, 1)) B[length];
+    std::allocator_traits<VarAlloc>::construct(var_alloc, node,
+                                               std::forward<Arg>(args)...);
+    varsized = internal::NewPaddedArray(var_alloc.Array(node, 1), length,
+                                        var_alloc.PaddedSize());
   } catch (...) {
-    std::allocator_traits<VarAllocator<B, Alloc, U>>::deallocate(var_alloc,
-                                                                 node, 1);
+    std::allocator_traits<VarAlloc>::deallocate(var_alloc, node, 1);
     throw;
   }
-  return std::unique_ptr<U, AllocDeleter<VarAllocator<B, Alloc, U>>>(
+  return std::unique_ptr<U, AllocDeleter<VarAlloc>>(
       node, {.allocator = std::move(var_alloc)});
 }
 
 template <typename U, typename B, typename... Arg,
           typename Alloc = std::allocator<B>>
+inline std::unique_ptr<U, AllocDeleter<VarAllocator<B, Alloc, U>>> MakeUnique(
+    size_t length, B*& varsized, Arg&&... args, Alloc alloc = {}) {
+  return MakeUnique<U, B, alignof(B), Arg...>(
+      length, varsized, std::forward<Arg>(args)..., std::move(alloc));
+}
+
+template <typename U, typename B, size_t ArrayAlignment, typename... Arg,
+          typename Alloc = std::allocator<B>>
 inline std::shared_ptr<U> MakeShared(size_t length, B*& varsized, Arg&&... args,
                                      Alloc alloc = {}) {
-  VarAllocator<B, Alloc, U> var_alloc(std::move(alloc), length);
-  std::shared_ptr<U> shared =
-      std::allocate_shared<U, VarAllocator<B, Alloc, U>, Arg...>(
-          var_alloc, std::forward<Arg>(args)...);
-  varsized = new (var_alloc.Array(shared.get(), 1)) B[length];
+  using VarAlloc = VarAllocator<B, Alloc, U, ArrayAlignment>;
+  VarAlloc var_alloc(std::move(alloc), length);
+  std::shared_ptr<U> shared = std::allocate_shared<U, VarAlloc, Arg...>(
+      var_alloc, std::forward<Arg>(args)...);
+  varsized = internal::NewPaddedArray(var_alloc.Array(shared.get(), 1), length,
+                                      var_alloc.PaddedSize());
   return shared;
 }
 
+template <typename U, typename B, typename... Arg,
+          typename Alloc = std::allocator<B>>
+inline std::shared_ptr<U> MakeShared(size_t length, B*& varsized, Arg&&... args,
+                                     Alloc alloc = {}) {
+  return MakeShared<U, B, alignof(B), Arg...>(
+      length, varsized, std::forward<Arg>(args)..., std::move(alloc));
+}
+
 // Similar to `MakeUnique` above, also with a single memory allocation, with
 // the difference that it creates a reference counted value to allow efficient
 // and type-safe sharing of the construted value.
+template <typename U, typename B, size_t ArrayAlignment, typename... Arg,
+          typename Alloc = std::allocator<U>>
+inline Ref<U, VarAllocator<B, Alloc, U, ArrayAlignment>> MakeRefCounted(
+    size_t length, B*& varsized, Arg&&... args, Alloc alloc = {}) {
+  using VarAlloc = VarAllocator<B, Alloc, U, ArrayAlignment>;
+  auto* refcounted = Refcounted<U, VarAlloc>::New(
+      VarAlloc(std::move(alloc), length), std::forward<Arg>(args)...);
+  varsized = internal::NewPaddedArray(
+      refcounted->Allocator().Array(refcounted, 1), length,
+      refcounted->Allocator().PaddedSize());
+  return Ref<U, VarAlloc>(refcounted);
+}
+
 template <typename U, typename B, typename... Arg,
           typename Alloc = std::allocator<U>>
 inline Ref<U, VarAllocator<B, Alloc, U>> MakeRefCounted(size_t length,
                                                         B*& varsized,
                                                         Arg&&... args,
                                                         Alloc alloc = {}) {
-  auto* refcounted = Refcounted<U, VarAllocator<B, Alloc, U>>::New(
-      VarAllocator<B, Alloc, U>(std::move(alloc), length),
-      std::forward<Arg>(args)...);
-  varsized = new (refcounted->Allocator().Array(refcounted, 1)) B[length];
-  return Ref<U, VarAllocator<B, Alloc, U>>(refcounted);
+  return MakeRefCounted<U, B, alignof(B), Arg...>(
+      length, varsized, std::forward<Arg>(args)..., std::move(alloc));
 }
 
 }  // namespace refptr
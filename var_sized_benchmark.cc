@@ -14,17 +14,55 @@
 
 // Benchmarks comparing var-sized, reference-counted data structures to
 // unique/shared pointers.
+//
+// All allocations go through `CountingAllocator` to report the number of
+// allocations and bytes per object. Hardware events per object are reported
+// if `REFPTR_PERF_COUNTERS=1` is set in the environment.
 
 #include <cassert>
 #include <cstring>
 #include <memory>
 
-#include "absl/memory/memory.h"
 #include "benchmark/benchmark.h"
+#include "benchmark_counters.h"
+#include "counting_allocator.h"
 #include "var_sized.h"
 
 namespace {
 
+struct BenchmarkTag {};
+
+template <typename T>
+using Counted = refptr::CountingAllocator<T, BenchmarkTag>;
+using Counters = refptr::ScopedAllocationCounters<BenchmarkTag>;
+using PerfCounters = refptr::ScopedPerfCounters;
+
+// Equivalent of `std::make_unique` for the `std` baselines.
+template <typename T>
+std::unique_ptr<T, refptr::AllocDeleter<Counted<T>>> MakeCountedUnique() {
+  Counted<T> allocator;
+  T* ptr = std::allocator_traits<Counted<T>>::allocate(allocator, 1);
+  std::allocator_traits<Counted<T>>::construct(allocator, ptr);
+  return std::unique_ptr<T, refptr::AllocDeleter<Counted<T>>>(
+      ptr, refptr::AllocDeleter<Counted<T>>{allocator});
+}
+
+// Separately allocated array for the `std` baselines.
+class CountedArray {
+ public:
+  explicit CountedArray(size_t length)
+      : length_(length), array_(Counted<char>().allocate(length)) {}
+  CountedArray(const CountedArray&) = delete;
+  CountedArray& operator=(const CountedArray&) = delete;
+  ~CountedArray() { Counted<char>().deallocate(array_, length_); }
+
+  char* get() { return array_; }
+
+ private:
+  size_t length_;
+  char* array_;
+};
+
 // Copies `len` elements from `text` to an array provided by var-sized
 // allocated array at `buf`.
 class VarSizedString {
@@ -40,10 +78,13 @@ class VarSizedString {
 }  // namespace
 
 static void BM_VarSizedUniqueString(benchmark::State& state) {
+  Counters counters(state, /*objects_per_iteration=*/100);
+  PerfCounters perf(state, /*objects_per_iteration=*/100);
   for (auto _ : state) {
     for (int i = 0; i < 100; i++) {
       char* array;
-      auto unique = refptr::MakeUnique<VarSizedString, char>(16, array);
+      auto unique =
+          refptr::MakeUnique<VarSizedString, char>(16, array, Counted<char>());
       benchmark::DoNotOptimize(unique->SetArray(array, 16));
       benchmark::ClobberMemory();
     }
@@ -52,10 +93,13 @@ static void BM_VarSizedUniqueString(benchmark::State& state) {
 BENCHMARK(BM_VarSizedUniqueString);
 
 static void BM_VarSizedSharedString(benchmark::State& state) {
+  Counters counters(state, /*objects_per_iteration=*/100);
+  PerfCounters perf(state, /*objects_per_iteration=*/100);
   for (auto _ : state) {
     for (int i = 0; i < 100; i++) {
       char* array;
-      auto shared = refptr::MakeShared<VarSizedString, char>(16, array);
+      auto shared =
+          refptr::MakeShared<VarSizedString, char>(16, array, Counted<char>());
       benchmark::DoNotOptimize(shared->SetArray(array, 16));
       benchmark::ClobberMemory();
     }
@@ -64,10 +108,13 @@ static void BM_VarSizedSharedString(benchmark::State& state) {
 BENCHMARK(BM_VarSizedSharedString);
 
 static void BM_VarSizedRefCountedString(benchmark::State& state) {
+  Counters counters(state, /*objects_per_iteration=*/100);
+  PerfCounters perf(state, /*objects_per_iteration=*/100);
   for (auto _ : state) {
     for (int i = 0; i < 100; i++) {
       char* array;
-      auto ref = refptr::MakeRefCounted<VarSizedString, char>(16, array);
+      auto ref = refptr::MakeRefCounted<VarSizedString, char>(
+          16, array, Counted<char>());
       benchmark::DoNotOptimize(ref->SetArray(array, 16));
       benchmark::ClobberMemory();
     }
@@ -76,10 +123,13 @@ static void BM_VarSizedRefCountedString(benchmark::State& state) {
 BENCHMARK(BM_VarSizedRefCountedString);
 
 static void BM_VarSizedRefCountedSharedString(benchmark::State& state) {
+  Counters counters(state, /*objects_per_iteration=*/100);
+  PerfCounters perf(state, /*objects_per_iteration=*/100);
   for (auto _ : state) {
     for (int i = 0; i < 100; i++) {
       char* array;
-      auto ref = refptr::MakeRefCounted<VarSizedString, char>(16, array);
+      auto ref = refptr::MakeRefCounted<VarSizedString, char>(
+          16, array, Counted<char>());
       // Move the value to a shared pointer and back to trigger its atomic
       // refcount operations.
       auto shared = std::move(ref).Share();
@@ -92,10 +142,12 @@ static void BM_VarSizedRefCountedSharedString(benchmark::State& state) {
 BENCHMARK(BM_VarSizedRefCountedSharedString);
 
 static void BM_MakeUniqueStdString(benchmark::State& state) {
+  Counters counters(state, /*objects_per_iteration=*/100);
+  PerfCounters perf(state, /*objects_per_iteration=*/100);
   for (auto _ : state) {
     for (int i = 0; i < 100; i++) {
-      auto unique = absl::make_unique<VarSizedString>();
-      std::unique_ptr<char[]> array(new char[16]);
+      auto unique = MakeCountedUnique<VarSizedString>();
+      CountedArray array(16);
       benchmark::DoNotOptimize(unique->SetArray(array.get(), 16));
       benchmark::ClobberMemory();
     }
@@ -104,10 +156,16 @@ static void BM_MakeUniqueStdString(benchmark::State& state) {
 BENCHMARK(BM_MakeUniqueStdString);
 
 static void BM_SharedStdString(benchmark::State& state) {
+  Counters counters(state, /*objects_per_iteration=*/100);
+  PerfCounters perf(state, /*objects_per_iteration=*/100);
   for (auto _ : state) {
     for (int i = 0; i < 100; i++) {
-      auto shared = std::shared_ptr<VarSizedString>(new VarSizedString());
-      std::unique_ptr<char[]> array(new char[16]);
+      // Allocates the value and the reference counter separately.
+      auto unique = MakeCountedUnique<VarSizedString>();
+      auto shared = std::shared_ptr<VarSizedString>(
+          unique.get(), unique.get_deleter(), Counted<VarSizedString>());
+      unique.release();
+      CountedArray array(16);
       benchmark::DoNotOptimize(shared->SetArray(array.get(), 16));
       benchmark::ClobberMemory();
     }
@@ -118,10 +176,13 @@ BENCHMARK(BM_SharedStdString);
 // Using `make_shared` allocates both the value and the reference counter in a
 // single memory block, thus being a bit more efficient.
 static void BM_MakeSharedStdString(benchmark::State& state) {
+  Counters counters(state, /*objects_per_iteration=*/100);
+  PerfCounters perf(state, /*objects_per_iteration=*/100);
   for (auto _ : state) {
     for (int i = 0; i < 100; i++) {
-      auto shared = std::make_shared<VarSizedString>();
-      std::unique_ptr<char[]> array(new char[16]);
+      auto shared =
+          std::allocate_shared<VarSizedString>(Counted<VarSizedString>());
+      CountedArray array(16);
       benchmark::DoNotOptimize(shared->SetArray(array.get(), 16));
       benchmark::ClobberMemory();
     }
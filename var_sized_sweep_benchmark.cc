@@ -0,0 +1,215 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of `MakeUnique`, `MakeShared`, `MakeRefCounted` and a `std`
+// baseline over array sizes from 0 to 64 KiB, both swept by powers of two and
+// drawn from seeded distributions, and over array element types of various
+// sizes and alignments.
+//
+// Each benchmark creates, fills and destroys one object per iteration and
+// reports the payload throughput (`bytes_per_second`) and the allocation
+// counters of `ScopedAllocationCounters`.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "benchmark_counters.h"
+#include "counting_allocator.h"
+#include "var_sized.h"
+
+namespace {
+
+struct BenchmarkTag {};
+
+template <typename T>
+using Counted = refptr::CountingAllocator<T, BenchmarkTag>;
+using Counters = refptr::ScopedAllocationCounters<BenchmarkTag>;
+
+// Array element types.
+struct Block64 {
+  char bytes[64];
+};
+struct alignas(16) Aligned16 {
+  char bytes[16];
+};
+
+// The object co-allocated with an array of `length` elements.
+struct Header {
+  explicit Header(size_t length_) : length(length_) {}
+
+  size_t length;
+};
+
+template <typename E>
+void Fill(E* array, size_t length) {
+  memset(static_cast<void*>(array), 0, length * sizeof(E));
+  benchmark::DoNotOptimize(array);
+}
+
+// Each `Make` creates a `Header` with an array of `E[length]`, fills the array
+// and destroys both.
+
+struct UniqueMaker {
+  template <typename E>
+  static void Make(size_t length) {
+    E* array;
+    auto unique = refptr::MakeUnique<Header, E, size_t>(
+        length, array, size_t{length}, Counted<E>());
+    Fill(array, length);
+  }
+};
+
+struct SharedMaker {
+  template <typename E>
+  static void Make(size_t length) {
+    E* array;
+    auto shared = refptr::MakeShared<Header, E, size_t>(
+        length, array, size_t{length}, Counted<E>());
+    Fill(array, length);
+  }
+};
+
+struct RefCountedMaker {
+  template <typename E>
+  static void Make(size_t length) {
+    E* array;
+    auto ref = refptr::MakeRefCounted<Header, E, size_t>(
+        length, array, size_t{length}, Counted<Header>());
+    Fill(array, length);
+  }
+};
+
+// Allocates the header and the array separately, as `std::make_unique` of
+// a header owning a `std::unique_ptr<E[]>` would.
+struct StdMaker {
+  template <typename E>
+  static void Make(size_t length) {
+    Counted<Header> header_allocator;
+    Header* header = header_allocator.allocate(1);
+    new (header) Header(length);
+    Counted<E> array_allocator;
+    E* array = array_allocator.allocate(length);
+    Fill(array, length);
+    benchmark::DoNotOptimize(header);
+    array_allocator.deallocate(array, length);
+    header->~Header();
+    header_allocator.deallocate(header, 1);
+  }
+};
+
+// Distributions of payload sizes in bytes, all within [0, 64 KiB].
+enum Distribution {
+  // Uniform.
+  kUniform = 0,
+  // Uniform logarithm of the size, mostly small payloads.
+  kLogUniform = 1,
+  // Pareto with shape 1.2 and minimum 16 bytes, a long tail of large payloads.
+  kPareto = 2,
+};
+
+constexpr size_t kMaxPayloadBytes = 1 << 16;
+
+// Returns `count` sizes drawn from `distribution`. Deterministic for a given
+// `seed` on all platforms, as it doesn't use the implementation-defined
+// distributions of <random>.
+std::vector<size_t> PayloadSizes(Distribution distribution, uint64_t seed,
+                                 size_t count) {
+  std::mt19937_64 random(seed);
+  std::vector<size_t> sizes;
+  sizes.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    // Uniform in (0, 1].
+    const double uniform =
+        ((random() >> 11) + 1) * (1.0 / (uint64_t{1} << 53));
+    double size;
+    switch (distribution) {
+      case kUniform:
+        size = uniform * kMaxPayloadBytes;
+        break;
+      case kLogUniform:
+        size = std::pow(2.0, uniform * 16);
+        break;
+      case kPareto:
+        size = 16 / std::pow(uniform, 1 / 1.2);
+        break;
+    }
+    sizes.push_back(std::min(static_cast<size_t>(size), kMaxPayloadBytes));
+  }
+  return sizes;
+}
+
+template <typename M, typename E>
+void Run(benchmark::State& state, const std::vector<size_t>& payload_sizes) {
+  Counters counters(state);
+  int64_t payload_bytes = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    const size_t length = payload_sizes[i] / sizeof(E);
+    if (++i == payload_sizes.size()) {
+      i = 0;
+    }
+    M::template Make<E>(length);
+    payload_bytes += sizeof(Header) + length * sizeof(E);
+  }
+  state.SetBytesProcessed(payload_bytes);
+  counters.AddPayloadBytes(payload_bytes);
+}
+
+// Payloads of `state.range(0)` bytes.
+template <typename M, typename E>
+void BM_SizeSweep(benchmark::State& state) {
+  Run<M, E>(state, {static_cast<size_t>(state.range(0))});
+}
+
+// Payloads drawn from `Distribution(state.range(0))` seeded by
+// `state.range(1)`.
+template <typename M, typename E>
+void BM_SizeDistribution(benchmark::State& state) {
+  Run<M, E>(state, PayloadSizes(static_cast<Distribution>(state.range(0)),
+                                state.range(1), /*count=*/1024));
+}
+
+#define REGISTER(M, E)                          \
+  BENCHMARK_TEMPLATE(BM_SizeSweep, M, E)        \
+      ->Arg(0)                                  \
+      ->RangeMultiplier(4)                      \
+      ->Range(1, kMaxPayloadBytes);             \
+  BENCHMARK_TEMPLATE(BM_SizeDistribution, M, E) \
+      ->ArgNames({"distribution", "seed"})      \
+      ->Args({kUniform, 1})                     \
+      ->Args({kLogUniform, 1})                  \
+      ->Args({kPareto, 1})
+
+#define REGISTER_ALL_MAKERS(E)  \
+  REGISTER(UniqueMaker, E);     \
+  REGISTER(SharedMaker, E);     \
+  REGISTER(RefCountedMaker, E); \
+  REGISTER(StdMaker, E)
+
+REGISTER_ALL_MAKERS(char);
+REGISTER_ALL_MAKERS(int64_t);
+REGISTER_ALL_MAKERS(Block64);
+REGISTER_ALL_MAKERS(Aligned16);
+
+#undef REGISTER_ALL_MAKERS
+#undef REGISTER
+
+}  // namespace
@@ -14,6 +14,7 @@
 
 #include "var_sized.h"
 
+#include <cstdint>
 #include <memory>
 
 #include "absl/strings/string_view.h"
@@ -99,5 +100,59 @@ TEST_F(VarSizedTest, MaxSizeSubtractsReserve) {
       << "At least 16 bytes must be reserved for the additional char[]";
 }
 
+bool IsAligned(const void* ptr, uintptr_t alignment) {
+  return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+
+// Checks that all the padding elements after `length` are zero.
+bool HasZeroPadding(const float* array, size_t length, size_t padded) {
+  for (size_t i = length; i < padded; i++) {
+    if (array[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST_F(VarSizedTest, AlignsAndPadsArrays) {
+  using Alloc = VarAllocator<float, std::allocator<Foo>, Foo, 64>;
+  EXPECT_EQ(Alloc::PaddedSize(0), 0);
+  EXPECT_EQ(Alloc::PaddedSize(1), 16);
+  EXPECT_EQ(Alloc::PaddedSize(16), 16);
+  EXPECT_EQ(Alloc::PaddedSize(17), 32);
+  EXPECT_EQ((VarAllocator<float, std::allocator<Foo>, Foo>::PaddedSize(17)),
+            17);
+  for (size_t length : {1, 15, 16, 17, 100}) {
+    {
+      float* array;
+      auto owned = MakeUnique<Foo, float, 64, int&>(length, array, counter_);
+      EXPECT_TRUE(IsAligned(array, 64)) << length;
+      EXPECT_TRUE(HasZeroPadding(array, length, Alloc::PaddedSize(length)));
+      for (size_t i = 0; i < Alloc::PaddedSize(length); i++) {
+        array[i] = 1;
+      }
+    }
+    {
+      float* array;
+      auto shared = MakeShared<Foo, float, 32, int&>(length, array, counter_);
+      EXPECT_TRUE(IsAligned(array, 32)) << length;
+      EXPECT_TRUE(HasZeroPadding(array, length, (length + 7) / 8 * 8));
+      for (size_t i = 0; i < (length + 7) / 8 * 8; i++) {
+        array[i] = 1;
+      }
+    }
+    {
+      float* array;
+      auto ref = MakeRefCounted<Foo, float, 64, int&>(length, array, counter_);
+      EXPECT_TRUE(IsAligned(array, 64)) << length;
+      EXPECT_TRUE(HasZeroPadding(array, length, Alloc::PaddedSize(length)));
+      for (size_t i = 0; i < Alloc::PaddedSize(length); i++) {
+        array[i] = 1;
+      }
+      EXPECT_EQ(counter_, 1);
+    }
+  }
+}
+
 }  // namespace
 }  // namespace refptr